@@ -20,12 +20,17 @@
 #include "../core/iohelper.h"
 #include "../core/pos.h"
 #include "../core/types.h"
+#include "../eval/evaluator.h"
 #include "../game/board.h"
 #include "../search/hashtable.h"
 #include "../search/searchthread.h"
 #include "argutils.h"
 #include "command.h"
 
+#ifdef RUNTIME_DISPATCH
+    #include "../eval/dispatch.h"
+#endif
+
 #include <iostream>
 #include <memory>
 #include <vector>
@@ -99,6 +104,11 @@ void Command::benchmark()
     std::unique_ptr<Board> board;
     EngineState            backupState = saveEngineStateForBenckmark();
 
+#ifdef RUNTIME_DISPATCH
+    MESSAGEL("Evaluator kernel: " << Evaluation::dispatch::kernelISAName(
+                 Evaluation::dispatch::selectedKernelISA()));
+#endif
+
     // Benchmark for Board::move() and Board::undo()
     MESSAGEL("==========Move Bench==========");
     Time   duration        = 0;
@@ -140,6 +150,8 @@ void Command::benchmark()
     options.disableOpeningQuery = true;
     duration                    = 0;
     size_t searchNodes          = 0;
+    Evaluation::UpdateStats  updateStats {};
+    Evaluation::CascadeStats cascadeStats {};
 
     Hash::XXHasher hasher(TTSizeMB);
 
@@ -156,6 +168,13 @@ void Command::benchmark()
         options.maxDepth = benchEntry.searchDepth;
         Search::Threads.clear(true);
 
+        // Evaluator might be reused across entries, so only count the difference
+        auto                   &evaluator  = Search::Threads.main()->evaluator;
+        Evaluation::UpdateStats  statsStart = evaluator ? evaluator->getUpdateStats()
+                                                        : Evaluation::UpdateStats {};
+        Evaluation::CascadeStats cascadeStart =
+            evaluator ? evaluator->cascadeStats : Evaluation::CascadeStats {};
+
         Time startTime = now();
         Search::Threads.startThinking(*board, options, true);
         Search::Threads.waitForIdle();
@@ -163,6 +182,18 @@ void Command::benchmark()
 
         duration += endTime - startTime;
 
+        if (evaluator) {
+            Evaluation::UpdateStats stats = evaluator->getUpdateStats();
+            updateStats.numSyncs += stats.numSyncs - statsStart.numSyncs;
+            updateStats.numPendingMoves += stats.numPendingMoves - statsStart.numPendingMoves;
+            updateStats.numReplayedMoves += stats.numReplayedMoves - statsStart.numReplayedMoves;
+            updateStats.numSnapshotRestores +=
+                stats.numSnapshotRestores - statsStart.numSnapshotRestores;
+            cascadeStats.numEvals += evaluator->cascadeStats.numEvals - cascadeStart.numEvals;
+            cascadeStats.numEscalations +=
+                evaluator->cascadeStats.numEscalations - cascadeStart.numEscalations;
+        }
+
         size_t nodes = Search::Threads.nodesSearched();
         searchNodes += nodes;
 
@@ -177,6 +208,17 @@ void Command::benchmark()
     MESSAGEL("Nodes: " << searchNodes);
     MESSAGEL("Nodes/s: " << searchNodes * 1000 / std::max<size_t>(duration, 1));
     MESSAGEL("Hash: " << std::hex << hash32 << std::dec);
+    if (updateStats.numSyncs) {
+        double numSyncs = double(updateStats.numSyncs);
+        MESSAGEL("Avg Pending Replay: " << updateStats.numPendingMoves / numSyncs);
+        MESSAGEL("Avg Replay: " << updateStats.numReplayedMoves / numSyncs);
+        MESSAGEL("Snapshot Restores: " << updateStats.numSnapshotRestores);
+    }
+    if (cascadeStats.numEvals) {
+        MESSAGEL("Cascade Evals: " << cascadeStats.numEvals << ", Escalated: "
+                                   << 100.0 * cascadeStats.numEscalations / cascadeStats.numEvals
+                                   << "%");
+    }
 
     recoverEngineState(backupState);
 }
@@ -0,0 +1,203 @@
+/*
+ *  Rapfi, a Gomoku/Renju playing engine supporting piskvork protocol.
+ *  Copyright (C) 2022  Rapfi developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../core/hash.h"
+#include "../core/iohelper.h"
+#include "../core/utils.h"
+#include "../database/cache.h"
+#include "../database/dbstorage.h"
+#include "command.h"
+
+#define CXXOPTS_NO_REGEX
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cxxopts.hpp>
+#include <iomanip>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+using namespace Database;
+
+struct CacheBenchOptions
+{
+    size_t   capacity;    /// Number of entries of the cache table
+    size_t   numKeys;     /// Number of distinct keys accessed
+    size_t   numOps;      /// Number of operations in the access trace
+    double   skew;        /// Zipf exponent of key popularity
+    double   writeRatio;  /// Probability of an operation to modify the entry
+    uint64_t seed;
+};
+
+/// BenchEntry mirrors the entry cached by DBClient, so that copying costs are realistic.
+struct BenchEntry
+{
+    DBKey    key;
+    DBRecord record;
+    bool     dirty;
+};
+
+struct CacheOp
+{
+    HashKey key;
+    bool    write;
+};
+
+struct CacheBenchResult
+{
+    uint64_t totalNs        = 0;
+    uint64_t numHits        = 0;
+    uint64_t numDirtyEvicts = 0;  /// Number of dirty entries passed to the collector
+};
+
+/// Generate an access trace with Zipf distributed key popularity, as search revisits
+/// positions near the root much more frequently than the deep ones.
+std::vector<CacheOp> makeAccessTrace(const CacheBenchOptions &opts)
+{
+    std::mt19937_64      rng(opts.seed);
+    std::vector<HashKey> keys(opts.numKeys);
+    std::vector<double>  cdf(opts.numKeys);
+    double               sum = 0.0;
+    for (size_t i = 0; i < opts.numKeys; i++) {
+        keys[i] = HashKey(rng());
+        sum += 1.0 / std::pow(double(i + 1), opts.skew);
+        cdf[i] = sum;
+    }
+
+    std::uniform_real_distribution<double> uniform(0.0, sum);
+    std::bernoulli_distribution            isWrite(opts.writeRatio);
+    std::vector<CacheOp>                   trace(opts.numOps);
+    for (CacheOp &op : trace) {
+        size_t rank = std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+        op.key      = keys[std::min(rank, opts.numKeys - 1)];
+        op.write    = isWrite(rng);
+    }
+    return trace;
+}
+
+/// Replay the trace in the same way as DBClient: lookup the entry first, and put a
+/// new entry on miss, whose dirty entries evicted are written back to the storage.
+template <typename Table>
+CacheBenchResult runCacheBench(Table &table, const std::vector<CacheOp> &trace)
+{
+    CacheBenchResult r;
+    BenchEntry       newEntry  = BenchEntry();
+    auto             collector = [&](std::pair<HashKey, BenchEntry> &&kv) {
+        r.numDirtyEvicts += kv.second.dirty;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (const CacheOp &op : trace) {
+        BenchEntry *entry = table.get(op.key);
+        if (entry)
+            r.numHits++;
+        else
+            entry = &table.put(op.key, newEntry, collector);
+
+        if (op.write) {
+            entry->record.value++;
+            entry->dirty = true;
+        }
+    }
+    auto end  = std::chrono::steady_clock::now();
+    r.totalNs = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    return r;
+}
+
+void printCacheBenchResult(const char             *name,
+                           const CacheBenchOptions &opts,
+                           const CacheBenchResult  &r)
+{
+    MESSAGEL(std::fixed << std::setprecision(1) << name << ": " << double(r.totalNs) / opts.numOps
+                        << " ns/op, hit rate " << 100.0 * r.numHits / opts.numOps
+                        << "%, dirty evictions " << r.numDirtyEvicts);
+}
+
+}  // namespace
+
+void Command::cachebench(int argc, char *argv[])
+{
+    CacheBenchOptions opts;
+
+    cxxopts::Options options("rapfi cachebench");
+    options.add_options()  //
+        ("c,capacity",
+         "Number of entries of the cache table",
+         cxxopts::value<size_t>()->default_value("4096"))  //
+        ("k,keys",
+         "Number of distinct keys accessed",
+         cxxopts::value<size_t>()->default_value("65536"))  //
+        ("n,ops",
+         "Number of operations in the access trace",
+         cxxopts::value<size_t>()->default_value("4000000"))  //
+        ("skew",
+         "Zipf exponent of key popularity, 0 for uniform access",
+         cxxopts::value<double>()->default_value("0.9"))  //
+        ("write-ratio",
+         "Probability of an operation to modify the entry",
+         cxxopts::value<double>()->default_value("0.3"))                          //
+        ("seed", "Random seed", cxxopts::value<uint64_t>()->default_value("0"))  //
+        ("h,help", "Print cachebench usage");
+    // Global options such as --config are parsed by main
+    options.allow_unrecognised_options();
+
+    try {
+        auto args = options.parse(argc, argv);
+
+        if (args.count("help")) {
+            std::cout << options.help() << std::endl;
+            std::exit(EXIT_SUCCESS);
+        }
+
+        opts.capacity   = args["capacity"].as<size_t>();
+        opts.numKeys    = args["keys"].as<size_t>();
+        opts.numOps     = args["ops"].as<size_t>();
+        opts.skew       = args["skew"].as<double>();
+        opts.writeRatio = args["write-ratio"].as<double>();
+        opts.seed       = args["seed"].as<uint64_t>();
+
+        if (opts.capacity == 0 || opts.numKeys == 0 || opts.numOps == 0)
+            throw std::invalid_argument("capacity, keys and ops must be positive");
+        if (opts.skew < 0)
+            throw std::invalid_argument("skew must be non-negative");
+        if (opts.writeRatio < 0 || opts.writeRatio > 1)
+            throw std::invalid_argument("write-ratio must be in range [0,1]");
+    }
+    catch (const std::exception &e) {
+        ERRORL("cachebench argument: " << e.what());
+        std::exit(EXIT_FAILURE);
+    }
+
+    MESSAGEL("==========Cache Bench==========");
+    MESSAGEL("Capacity: " << opts.capacity << ", Keys: " << opts.numKeys << ", Ops: "
+                          << opts.numOps << ", Skew: " << opts.skew
+                          << ", Write ratio: " << opts.writeRatio);
+    std::vector<CacheOp> trace = makeAccessTrace(opts);
+
+    {
+        LRUCacheTable<HashKey, BenchEntry> lruTable(opts.capacity);
+        printCacheBenchResult("LRUCacheTable", opts, runCacheBench(lruTable, trace));
+    }
+    {
+        ClockCacheTable<HashKey, BenchEntry> clockTable(opts.capacity);
+        printCacheBenchResult("ClockCacheTable", opts, runCacheBench(clockTable, trace));
+    }
+}
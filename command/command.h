@@ -73,5 +73,9 @@ void tuning(int argc, char *argv[]);
 void selfplay(int argc, char *argv[]);
 void dataprep(int argc, char *argv[]);
 void database(int argc, char *argv[]);
+void perft(int argc, char *argv[]);
+void evalbench(int argc, char *argv[]);
+void evalfuzz(int argc, char *argv[]);
+void cachebench(int argc, char *argv[]);
 
 }  // namespace Command
@@ -21,6 +21,7 @@
 #include "../database/dbclient.h"
 #include "../database/dbstorage.h"
 #include "../database/dbutils.h"
+#include "../database/sorteddbstorage.h"
 #include "../database/yxdbstorage.h"
 #include "../game/board.h"
 #include "argutils.h"
@@ -35,7 +36,7 @@ using namespace Database;
 
 namespace {
 
-enum class DatabaseType { YixinDB };
+enum class DatabaseType { YixinDB, SortedDB };
 
 auto makeDBCreationOptions(std::string headline)
 {
@@ -56,7 +57,13 @@ auto makeDBCreationOptions(std::string headline)
          cxxopts::value<bool>()->default_value("true"))  //
         ("yixindb-ignore-corrupted",
          "YixinDB - ignore corrupted data",
-         cxxopts::value<bool>()->default_value("false"));
+         cxxopts::value<bool>()->default_value("false"))  //
+        ("yixindb-write-ahead-log",
+         "YixinDB - append changes to a write-ahead log",
+         cxxopts::value<bool>()->default_value("false"))  //
+        ("sorteddb-save-on-close",
+         "SortedDB - compact changes into base file on close",
+         cxxopts::value<bool>()->default_value("true"));
 
     return options;
 }
@@ -65,6 +72,8 @@ DatabaseType parseDatabaseType(std::string dbTypeStr)
 {
     if (dbTypeStr == "yixindb")
         return DatabaseType::YixinDB;
+    else if (dbTypeStr == "sorteddb")
+        return DatabaseType::SortedDB;
     else
         throw std::invalid_argument("unknown database type " + dbTypeStr);
 }
@@ -80,11 +89,21 @@ std::unique_ptr<DBStorage> createDBStorage(const cxxopts::ParseResult &args)
                                           args["yixindb-compressed-save"].as<bool>(),
                                           args["yixindb-save-on-close"].as<bool>(),
                                           args["yixindb-backup-on-save"].as<bool>(),
-                                          args["yixindb-ignore-corrupted"].as<bool>());
+                                          args["yixindb-ignore-corrupted"].as<bool>(),
+                                          args["yixindb-write-ahead-log"].as<bool>());
         if (yxdbStorage->size() > 0)
             MESSAGEL("Yixindb loaded " << yxdbStorage->size() << " entries from " << databaseURL);
         return yxdbStorage;
     }
+    else if (databaseType == "sorteddb") {
+        auto sortedDBStorage =
+            std::make_unique<SortedDBStorage>(pathFromConsoleString(databaseURL),
+                                              args["sorteddb-save-on-close"].as<bool>());
+        if (sortedDBStorage->size() > 0)
+            MESSAGEL("Sorteddb mapped " << sortedDBStorage->size() << " entries from "
+                                        << databaseURL);
+        return sortedDBStorage;
+    }
     else
         throw std::invalid_argument("unknown database type " + databaseType);
 }
@@ -246,18 +265,28 @@ void printDBQuery(std::ostream &os, DBStorage &dbStorage, const DBKey &dbKey)
         os << "(null)" << std::endl;
 }
 
+/// Returns the throughput of processing a number of records in some milliseconds.
+uint64_t recordsPerSecond(size_t numRecords, Time elapsedMs)
+{
+    return uint64_t(numRecords) * 1000 / uint64_t(std::max<Time>(elapsedMs, 1));
+}
+
 }  // namespace
 
 void Command::database(int argc, char *argv[])
 {
     std::unique_ptr<DBStorage> dbStorage;
     std::istringstream         commandStream;
+    size_t                     numThreads;
 
     auto options = makeDBCreationOptions("rapfi database");
     options.add_options()  //
         ("commands",
          "Database commands (seperate multiple commands with ';')",
          cxxopts::value<std::string>()->default_value(""))  //
+        ("t,threads",
+         "Number of threads for merging, splitting and exporting, 0 for all hardware threads",
+         cxxopts::value<size_t>()->default_value("1"))  //
         ("h,help", "Print database usage");
 
     try {
@@ -277,7 +306,8 @@ void Command::database(int argc, char *argv[])
             }
         }
 
-        dbStorage = createDBStorage(args);
+        numThreads = args["threads"].as<size_t>();
+        dbStorage  = createDBStorage(args);
     }
     catch (const std::exception &e) {
         ERRORL("database command: " << e.what());
@@ -424,11 +454,18 @@ void Command::database(int argc, char *argv[])
             trimInplace(csvPath);
 
             if (csvPath.empty())
-                databaseToCSVFile(*dbStorage, std::cout);
+                databaseToCSVFile(*dbStorage, std::cout, nullptr, numThreads);
             else {
                 std::ofstream csvStream(csvPath);
                 if (csvStream.is_open() && csvStream) {
-                    databaseToCSVFile(*dbStorage, csvStream);
+                    auto   startTime = now();
+                    size_t recordCount =
+                        databaseToCSVFile(*dbStorage, csvStream, nullptr, numThreads);
+                    auto endTime = now();
+                    MESSAGEL("Exported " << recordCount << " records to csv file " << csvPath
+                                         << " using " << (endTime - startTime) << " ms ("
+                                         << recordsPerSecond(recordCount, endTime - startTime)
+                                         << " records/s).");
                     std::cout << "OK" << std::endl;
                 }
                 else
@@ -452,10 +489,17 @@ void Command::database(int argc, char *argv[])
             std::string cmdline;
             std::getline(is, cmdline);
             if (auto dbToMerge = createDBStorageFromCmdline(cmdline)) {
-                size_t writeCount =
-                    mergeDatabase(*dbStorage, *dbToMerge, Config::DatabaseOverwriteRule);
-                MESSAGEL("Merged " << writeCount << " out of " << dbToMerge->size()
-                                   << " records into the database.");
+                auto   startTime  = now();
+                size_t writeCount = mergeDatabase(*dbStorage,
+                                                  *dbToMerge,
+                                                  Config::DatabaseOverwriteRule,
+                                                  numThreads);
+                auto   endTime    = now();
+                size_t mergeCount = dbToMerge->size();
+                MESSAGEL("Merged " << writeCount << " out of " << mergeCount
+                                   << " records into the database using " << (endTime - startTime)
+                                   << " ms (" << recordsPerSecond(mergeCount, endTime - startTime)
+                                   << " records/s).");
             }
         }
         else if (cmd == "DBSPLIT") {
@@ -465,7 +509,7 @@ void Command::database(int argc, char *argv[])
                 MESSAGEL("Spliting branch " << board->positionString()
                                             << ", this might take a while...");
                 auto   startTime  = now();
-                size_t writeCount = splitDatabase(*dbStorage, *dbToSplit, *board, rule);
+                size_t writeCount = splitDatabase(*dbStorage, *dbToSplit, *board, rule, numThreads);
                 auto   endTime    = now();
                 MESSAGEL("Write " << writeCount << " records into the spilted database using "
                                   << (endTime - startTime) << " ms.");
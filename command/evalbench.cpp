@@ -0,0 +1,359 @@
+/*
+ *  Rapfi, a Gomoku/Renju playing engine supporting piskvork protocol.
+ *  Copyright (C) 2022  Rapfi developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../core/iohelper.h"
+#include "../core/utils.h"
+#include "../eval/evaluator.h"
+#include "../game/board.h"
+#include "../search/searchthread.h"
+#include "argutils.h"
+#include "command.h"
+
+#define CXXOPTS_NO_REGEX
+#include <algorithm>
+#include <chrono>
+#include <cxxopts.hpp>
+#include <iomanip>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+using namespace Evaluation;
+
+struct EvalBenchOptions
+{
+    Rule     rule;
+    int      numGames;        /// Number of random games to play for each board size
+    int      maxPly;          /// Maximum number of plies of each random game
+    int      replayInterval;  /// Average number of plies between two line switches
+    int      coldInterval;    /// Average number of positions between two cold samples
+    size_t   evictMB;         /// Size of the buffer swept to evict CPU caches
+    uint64_t seed;
+};
+
+/// OpTimer accumulates the elapsed time of one kind of evaluator operation.
+struct OpTimer
+{
+    uint64_t totalNs  = 0;  /// Total elapsed time in nanoseconds
+    uint64_t numOps   = 0;  /// Number of timed operations
+    uint64_t numUnits = 0;  /// Number of work units (eg. moves) done in the timed operations
+
+    template <typename Fn>
+    void time(Fn &&fn, uint64_t units = 1)
+    {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        auto end = std::chrono::steady_clock::now();
+        totalNs += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        numOps++;
+        numUnits += units;
+    }
+
+    double nsPerOp() const { return numOps ? double(totalNs) / numOps : 0.0; }
+    double nsPerUnit() const { return numUnits ? double(totalNs) / numUnits : 0.0; }
+    double unitsPerOp() const { return numOps ? double(numUnits) / numOps : 0.0; }
+};
+
+struct EvalBenchResult
+{
+    OpTimer              incrementalMove;  /// Applying the pending update of a single move
+    OpTimer              incrementalUndo;  /// Applying the pending update of a single undo
+    OpTimer              replay;           /// Applying all pending moves after a line switch
+    std::vector<OpTimer> value, coldValue;    /// Value head of each acc level (warm/cold)
+    std::vector<OpTimer> policy, coldPolicy;  /// Policy head of each acc level (warm/cold)
+    uint64_t             numPositions = 0;
+    UpdateStats          updateStats {};
+};
+
+/// CacheEvictor evicts the working set of previous operations from CPU
+/// caches by sweeping a buffer larger than the last level cache.
+class CacheEvictor
+{
+public:
+    explicit CacheEvictor(size_t sizeMB) : buffer(sizeMB << 20) {}
+    bool enabled() const { return !buffer.empty(); }
+    void evict()
+    {
+        for (size_t i = 0; i < buffer.size(); i += 64)
+            buffer[i]++;
+        sink = sink + buffer[buffer.size() / 2];
+    }
+
+private:
+    std::vector<uint8_t> buffer;
+    volatile uint8_t     sink = 0;
+};
+
+/// Pick a random legal move on board, or Pos::NONE if there is no move to play.
+Pos pickRandomMove(const Board &board, Rule rule, std::mt19937_64 &rng)
+{
+    if (board.ply() == 0)
+        return board.centerPos();
+
+    std::vector<Pos> moves;
+    FOR_EVERY_CAND_POS(&board, pos)
+    {
+        // Forbidden points are not legal moves for black in Renju
+        if (rule == RENJU && board.sideToMove() == BLACK && board.checkForbiddenPoint(pos))
+            continue;
+        moves.push_back(pos);
+    }
+
+    if (moves.empty())
+        return Pos::NONE;
+    return moves[rng() % moves.size()];
+}
+
+void moveWithEvaluator(Board &board, Rule rule, Pos pos, Evaluator &evaluator)
+{
+    evaluator.beforeMove(board, pos);
+    board.move(rule, pos);
+    evaluator.afterMove(board, pos);
+}
+
+void undoWithEvaluator(Board &board, Rule rule, Evaluator &evaluator)
+{
+    Pos pos = board.getLastMove();
+    evaluator.beforeUndo(board, pos);
+    board.undo(rule);
+    evaluator.afterUndo(board, pos);
+}
+
+/// Returns true if the game is over at the current position.
+bool isTerminal(const Board &board)
+{
+    Pos lastMove = board.getLastMove();
+    return board.movesLeft() == 0
+           || lastMove != Pos::NONE && lastMove != Pos::PASS
+                  && board.cell(lastMove).pattern4[~board.sideToMove()] == A_FIVE;
+}
+
+/// Time value and policy heads of all acc levels at the current position.
+/// A position is either sampled warm or cold (after evicting all caches), as
+/// evaluators may cache shared features of a position after the first evaluation.
+void timeHeads(Evaluator       &evaluator,
+               const Board     &board,
+               PolicyBuffer    &policyBuffer,
+               CacheEvictor    &evictor,
+               bool             cold,
+               EvalBenchResult &r)
+{
+    for (int level = 0; level < (int)r.value.size(); level++) {
+        if (cold)
+            evictor.evict();
+        (cold ? r.coldValue : r.value)[level].time(
+            [&] { evaluator.evaluateValue(board, AccLevel(level)); });
+    }
+
+    for (int level = 0; level < (int)r.policy.size(); level++) {
+        policyBuffer.setComputeFlagForAllCell(board, false);
+        policyBuffer.setComputeFlagForAllCandidateCell(board);
+        if (cold)
+            evictor.evict();
+        (cold ? r.coldPolicy : r.policy)[level].time(
+            [&] { evaluator.evaluatePolicy(board, policyBuffer, AccLevel(level)); });
+    }
+
+    r.numPositions++;
+}
+
+EvalBenchResult runEvalBench(Evaluator &evaluator, int boardSize, const EvalBenchOptions &opts)
+{
+    auto            board = std::make_unique<Board>(boardSize);
+    PolicyBuffer    policyBuffer(boardSize);
+    CacheEvictor    evictor(opts.evictMB);
+    std::mt19937_64 rng(opts.seed);
+    EvalBenchResult r;
+    Rule            rule = opts.rule;
+
+    r.value.resize(evaluator.getNumValueAccLevel());
+    r.coldValue.resize(evaluator.getNumValueAccLevel());
+    r.policy.resize(evaluator.getNumPolicyAccLevel());
+    r.coldPolicy.resize(evaluator.getNumPolicyAccLevel());
+    UpdateStats statsBefore = evaluator.getUpdateStats();
+
+    for (int game = 0; game < opts.numGames; game++) {
+        board->newGame(rule);
+        evaluator.syncWithBoard(*board);
+
+        while (board->ply() < opts.maxPly && !isTerminal(*board)) {
+            Pos pos = pickRandomMove(*board, rule, rng);
+            if (pos == Pos::NONE)
+                break;
+
+            moveWithEvaluator(*board, rule, pos, evaluator);
+            r.incrementalMove.time([&] { evaluator.applyPendingUpdates(*board); });
+
+            // Take back and replay the move to time a single incremental undo
+            undoWithEvaluator(*board, rule, evaluator);
+            r.incrementalUndo.time([&] { evaluator.applyPendingUpdates(*board); });
+            moveWithEvaluator(*board, rule, pos, evaluator);
+            evaluator.applyPendingUpdates(*board);
+
+            bool cold = evictor.enabled() && rng() % opts.coldInterval == 0;
+            timeHeads(evaluator, *board, policyBuffer, evictor, cold, r);
+
+            // Occasionally switch to another line like a search does when it
+            // moves to a sibling subtree, which leaves a batch of pending updates
+            constexpr int MinSwitchDepth = 2, MaxSwitchDepth = 8;
+            if (board->ply() > MaxSwitchDepth && !isTerminal(*board)
+                && rng() % opts.replayInterval == 0) {
+                int depth = MinSwitchDepth + rng() % (MaxSwitchDepth - MinSwitchDepth + 1);
+                for (int i = 0; i < depth; i++)
+                    undoWithEvaluator(*board, rule, evaluator);
+
+                int numMoves = 0;
+                for (; numMoves < depth && !isTerminal(*board); numMoves++) {
+                    Pos linePos = pickRandomMove(*board, rule, rng);
+                    if (linePos == Pos::NONE)
+                        break;
+                    moveWithEvaluator(*board, rule, linePos, evaluator);
+                }
+
+                r.replay.time([&] { evaluator.applyPendingUpdates(*board); }, depth + numMoves);
+            }
+        }
+    }
+
+    UpdateStats statsAfter           = evaluator.getUpdateStats();
+    r.updateStats.numSyncs           = statsAfter.numSyncs - statsBefore.numSyncs;
+    r.updateStats.numPendingMoves    = statsAfter.numPendingMoves - statsBefore.numPendingMoves;
+    r.updateStats.numReplayedMoves   = statsAfter.numReplayedMoves - statsBefore.numReplayedMoves;
+    r.updateStats.numSnapshotRestores =
+        statsAfter.numSnapshotRestores - statsBefore.numSnapshotRestores;
+    return r;
+}
+
+/// Format timings of a head as "warm ns/op" with cold timings and a cache-miss hint if sampled.
+std::string formatHeadTiming(const OpTimer &warm, const OpTimer &cold)
+{
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(1) << warm.nsPerOp() << " ns/op";
+    if (cold.numOps) {
+        double ratio = cold.nsPerOp() / std::max(warm.nsPerOp(), 1.0);
+        ss << ", cold " << cold.nsPerOp() << " ns/op (x" << std::setprecision(2) << ratio
+           << (ratio >= 2.0   ? ", weight loads likely miss cache"
+               : ratio >= 1.3 ? ", partially cache bound"
+                              : ", compute bound")
+           << ")";
+    }
+    return ss.str();
+}
+
+void printEvalBenchResult(int boardSize, const EvalBenchOptions &opts, const EvalBenchResult &r)
+{
+    MESSAGEL("Board size: " << boardSize << ", Rule: " << opts.rule
+                            << ", Games: " << opts.numGames << ", Positions: " << r.numPositions);
+    MESSAGEL(std::fixed << std::setprecision(1)
+                        << "Incremental move: " << r.incrementalMove.nsPerOp() << " ns/op");
+    MESSAGEL(std::fixed << std::setprecision(1)
+                        << "Incremental undo: " << r.incrementalUndo.nsPerOp() << " ns/op");
+    MESSAGEL(std::fixed << std::setprecision(1) << "Replay: " << r.replay.nsPerOp()
+                        << " ns/op, " << r.replay.nsPerUnit() << " ns/update, "
+                        << r.replay.unitsPerOp() << " updates/op");
+    MESSAGEL("Update stats: Syncs " << r.updateStats.numSyncs << ", Replayed moves "
+                                    << r.updateStats.numReplayedMoves << ", Snapshot restores "
+                                    << r.updateStats.numSnapshotRestores);
+    for (size_t level = 0; level < r.value.size(); level++)
+        MESSAGEL("Value level " << level << ": "
+                                << formatHeadTiming(r.value[level], r.coldValue[level]));
+    for (size_t level = 0; level < r.policy.size(); level++)
+        MESSAGEL("Policy level " << level << ": "
+                                 << formatHeadTiming(r.policy[level], r.coldPolicy[level]));
+}
+
+}  // namespace
+
+void Command::evalbench(int argc, char *argv[])
+{
+    EvalBenchOptions opts;
+    std::vector<int> boardSizes;
+
+    cxxopts::Options options("rapfi evalbench");
+    options.add_options()  //
+        ("r,rule",
+         "One of [freestyle, standard, renju] rule",
+         cxxopts::value<std::string>()->default_value("freestyle"))  //
+        ("s,boardsize",
+         "Board sizes in [5,22] (eg. 15,20)",
+         cxxopts::value<std::vector<int>>()->default_value("15"))                      //
+        ("g,games", "Number of random games", cxxopts::value<int>()->default_value("100"))  //
+        ("p,maxply", "Maximum plies of each game", cxxopts::value<int>()->default_value("100"))  //
+        ("replay-interval",
+         "Average plies between two line switches that replay pending updates",
+         cxxopts::value<int>()->default_value("4"))  //
+        ("cold-interval",
+         "Average positions between two samples taken with evicted caches",
+         cxxopts::value<int>()->default_value("8"))  //
+        ("evict-mb",
+         "Size of buffer in MiB swept to evict caches, 0 to disable cold samples",
+         cxxopts::value<size_t>()->default_value("64"))  //
+        ("seed", "Random seed", cxxopts::value<uint64_t>()->default_value("0"))  //
+        ("h,help", "Print evalbench usage");
+    // Global options such as --config are parsed by main
+    options.allow_unrecognised_options();
+
+    try {
+        auto args = options.parse(argc, argv);
+
+        if (args.count("help")) {
+            std::cout << options.help() << std::endl;
+            std::exit(EXIT_SUCCESS);
+        }
+
+        opts.rule           = parseRule(args["rule"].as<std::string>());
+        boardSizes          = args["boardsize"].as<std::vector<int>>();
+        opts.numGames       = args["games"].as<int>();
+        opts.maxPly         = args["maxply"].as<int>();
+        opts.replayInterval = args["replay-interval"].as<int>();
+        opts.coldInterval   = args["cold-interval"].as<int>();
+        opts.evictMB        = args["evict-mb"].as<size_t>();
+        opts.seed           = args["seed"].as<uint64_t>();
+
+        for (int boardSize : boardSizes)
+            if (boardSize < 5 || boardSize > MAX_BOARD_SIZE)
+                throw std::invalid_argument("boardsize must be in range [5,22]");
+        if (opts.numGames <= 0)
+            throw std::invalid_argument("games must be positive");
+        if (opts.replayInterval <= 0 || opts.coldInterval <= 0)
+            throw std::invalid_argument("intervals must be positive");
+    }
+    catch (const std::exception &e) {
+        ERRORL("evalbench argument: " << e.what());
+        std::exit(EXIT_FAILURE);
+    }
+
+    MESSAGEL("==========Eval Bench==========");
+    for (int boardSize : boardSizes) {
+        auto evaluator = Search::Threads.createEvaluator(boardSize, opts.rule);
+        if (!evaluator) {
+            ERRORL("evalbench: no evaluator is configured");
+            std::exit(EXIT_FAILURE);
+        }
+
+        EvalBenchResult result = runEvalBench(*evaluator, boardSize, opts);
+        printEvalBenchResult(boardSize, opts, result);
+    }
+    if (opts.evictMB)
+        MESSAGEL("Cold timings are sampled after sweeping " << opts.evictMB
+                                                            << " MiB to evict CPU caches");
+}
@@ -0,0 +1,426 @@
+/*
+ *  Rapfi, a Gomoku/Renju playing engine supporting piskvork protocol.
+ *  Copyright (C) 2022  Rapfi developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../core/iohelper.h"
+#include "../core/utils.h"
+#include "../eval/evaluator.h"
+#include "../game/board.h"
+#include "../search/searchthread.h"
+#include "argutils.h"
+#include "command.h"
+
+#ifdef RUNTIME_DISPATCH
+    #include "../eval/dispatch.h"
+#endif
+
+#define CXXOPTS_NO_REGEX
+#include <algorithm>
+#include <cmath>
+#include <cxxopts.hpp>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+using namespace Evaluation;
+
+struct FuzzOptions
+{
+    Rule     rule;
+    int      boardSize;
+    int      numGames;         /// Number of random games to fuzz
+    int      numSteps;         /// Number of move or undo steps of each game
+    int      maxPly;           /// Maximum ply of each game before it is forced to undo
+    int      maxUndo;          /// Maximum number of moves taken back in one undo step
+    float    undoProb;         /// Probability of an undo step
+    float    revisitProb;      /// Probability of revisiting a line after a step
+    int      checkInterval;    /// Average number of steps between two checked positions
+    float    tolerance;        /// Relative tolerance of incremental outputs to synced outputs
+    float    kernelTolerance;  /// Relative tolerance of outputs of different kernel variants
+    bool     allKernels;       /// Cross check all kernel variants supported by the CPU
+    uint64_t seed;
+};
+
+/// FuzzSubject is an evaluator updated incrementally through the random game,
+/// together with a reference evaluator of the same kernel variant, which is
+/// synced with the board from scratch at every checked position.
+struct FuzzSubject
+{
+    std::string                name;
+    std::unique_ptr<Evaluator> incremental;
+    std::unique_ptr<Evaluator> scratch;
+};
+
+/// Value and policy outputs of all acc levels of an evaluator at one position.
+struct FuzzOutput
+{
+    std::vector<ValueType>    values;
+    std::vector<PolicyBuffer> policies;
+};
+
+struct FuzzResult
+{
+    uint64_t    moves;      /// Number of moves played
+    uint64_t    undos;      /// Number of moves taken back
+    uint64_t    checked;    /// Number of positions cross checked
+    UpdateStats stats;      /// Update stats of the first incremental evaluator
+    Time        duration;   /// Elapsed time in milliseconds
+};
+
+FuzzSubject createSubject(std::string name, const FuzzOptions &opts)
+{
+    FuzzSubject subject {std::move(name),
+                         Search::Threads.createEvaluator(opts.boardSize, opts.rule),
+                         Search::Threads.createEvaluator(opts.boardSize, opts.rule)};
+    if (!subject.incremental || !subject.scratch)
+        throw std::runtime_error("no evaluator is configured for this rule and board size");
+    return subject;
+}
+
+/// Create one subject for each kernel variant to cross check. Without runtime
+/// dispatch, only the kernel variant compiled into the engine is checked.
+std::vector<FuzzSubject> createSubjects(const FuzzOptions &opts)
+{
+    std::vector<FuzzSubject> subjects;
+
+#ifdef RUNTIME_DISPATCH
+    using namespace Evaluation::dispatch;
+    if (opts.allKernels) {
+        for (KernelISA isa :
+             {KernelISA::SSE, KernelISA::AVX2, KernelISA::AVX512, KernelISA::AVX512VNNI}) {
+            if (isa > supportedKernelISA())
+                break;
+            overrideKernelISA(isa);
+            subjects.push_back(createSubject(kernelISAName(isa), opts));
+        }
+        overrideKernelISA(KernelISA::NONE);
+    }
+    else
+        subjects.push_back(createSubject(kernelISAName(selectedKernelISA()), opts));
+#else
+    subjects.push_back(createSubject("native", opts));
+#endif
+
+    return subjects;
+}
+
+FuzzOutput evaluateAll(Evaluator &evaluator, const Board &board)
+{
+    FuzzOutput output;
+    for (int level = 0; level < evaluator.getNumValueAccLevel(); level++)
+        output.values.push_back(evaluator.evaluateValue(board, AccLevel(level)));
+    for (int level = 0; level < evaluator.getNumPolicyAccLevel(); level++) {
+        PolicyBuffer &policyBuffer = output.policies.emplace_back(board.size());
+        policyBuffer.setComputeFlagForAllEmptyCell(board);
+        evaluator.evaluatePolicy(board, policyBuffer, AccLevel(level));
+    }
+    return output;
+}
+
+/// Compare two sets of evaluator outputs within the given tolerance, which is relative
+/// to the largest magnitude of each output, as kernel variants sum floats in different
+/// orders and the rounding error grows with the magnitude of the summed terms.
+/// @return An empty string if both outputs match, otherwise a list of mismatched fields.
+std::string
+compareOutputs(const Board &board, const FuzzOutput &a, const FuzzOutput &b, float tolerance)
+{
+    std::ostringstream ss;
+    for (size_t level = 0; level < a.values.size(); level++) {
+        const ValueType &va = a.values[level], &vb = b.values[level];
+        if (std::abs(va.win() - vb.win()) > tolerance || std::abs(va.loss() - vb.loss()) > tolerance
+            || std::abs(va.draw() - vb.draw()) > tolerance)
+            ss << "value[" << level << "] (" << va.win() << "," << va.loss() << ","
+               << va.draw() << " vs " << vb.win() << "," << vb.loss() << "," << vb.draw()
+               << ") ";
+    }
+    for (size_t level = 0; level < a.policies.size(); level++) {
+        const PolicyBuffer &pa = a.policies[level], &pb = b.policies[level];
+
+        float scale = 1.0f;
+        FOR_EVERY_EMPTY_POS(&board, pos)
+        {
+            scale = std::max({scale, std::abs(pa[pos]), std::abs(pb[pos])});
+        }
+
+        int numCells = 0;
+        Pos firstPos = Pos::NONE;
+        FOR_EVERY_EMPTY_POS(&board, pos)
+        {
+            if (std::abs(pa[pos] - pb[pos]) > tolerance * scale && numCells++ == 0)
+                firstPos = pos;
+        }
+        if (numCells)
+            ss << "policy[" << level << "] (" << numCells << " cells, " << firstPos << ": "
+               << pa[firstPos] << " vs " << pb[firstPos] << ") ";
+    }
+    return ss.str();
+}
+
+/// Pick a random move to play. Most moves are chosen from candidates to
+/// resemble real games, while the rest are anywhere on board to cover
+/// sparse and edge features.
+Pos pickFuzzMove(const Board &board, Rule rule, std::mt19937_64 &rng)
+{
+    std::vector<Pos> moves;
+    bool             anywhere = board.ply() == 0 || rng() % 4 == 0;
+    FOR_EVERY_EMPTY_POS(&board, pos)
+    {
+        if (!anywhere && !board.cell(pos).isCandidate())
+            continue;
+        // Forbidden points are not legal moves for black in Renju
+        if (rule == RENJU && board.sideToMove() == BLACK && board.checkForbiddenPoint(pos))
+            continue;
+        moves.push_back(pos);
+    }
+
+    if (moves.empty())
+        return Pos::NONE;
+    return moves[rng() % moves.size()];
+}
+
+/// Returns true if the game is over at the current position.
+bool isTerminal(const Board &board)
+{
+    Pos lastMove = board.getLastMove();
+    return board.movesLeft() == 0
+           || lastMove != Pos::NONE && lastMove != Pos::PASS
+                  && board.cell(lastMove).pattern4[~board.sideToMove()] == A_FIVE;
+}
+
+void moveWithSubjects(Board &board, Rule rule, Pos pos, std::vector<FuzzSubject> &subjects)
+{
+    for (FuzzSubject &subject : subjects)
+        subject.incremental->beforeMove(board, pos);
+    board.move(rule, pos);
+    for (FuzzSubject &subject : subjects)
+        subject.incremental->afterMove(board, pos);
+}
+
+void undoWithSubjects(Board &board, Rule rule, std::vector<FuzzSubject> &subjects)
+{
+    Pos pos = board.getLastMove();
+    for (FuzzSubject &subject : subjects)
+        subject.incremental->beforeUndo(board, pos);
+    board.undo(rule);
+    for (FuzzSubject &subject : subjects)
+        subject.incremental->afterUndo(board, pos);
+}
+
+/// Cross check incremental outputs against outputs after a sync from scratch
+/// for every subject, and outputs of all kernel variants against the first one.
+void checkPosition(const Board &board, std::vector<FuzzSubject> &subjects, const FuzzOptions &opts)
+{
+    FuzzOutput baseline;
+    for (size_t i = 0; i < subjects.size(); i++) {
+        FuzzSubject &subject = subjects[i];
+        subject.scratch->syncWithBoard(board);
+        FuzzOutput incremental = evaluateAll(*subject.incremental, board);
+        FuzzOutput scratch     = evaluateAll(*subject.scratch, board);
+
+        std::string mismatch = compareOutputs(board, incremental, scratch, opts.tolerance);
+        if (!mismatch.empty()) {
+            ERRORL("evalfuzz: " << subject.name << " incremental output mismatch at "
+                                << board.positionString() << ": " << mismatch);
+            std::exit(EXIT_FAILURE);
+        }
+
+        if (i == 0)
+            baseline = std::move(scratch);
+        else if (!(mismatch = compareOutputs(board, scratch, baseline, opts.kernelTolerance))
+                      .empty()) {
+            ERRORL("evalfuzz: " << subject.name << " output mismatch to " << subjects[0].name
+                                << " at " << board.positionString() << ": " << mismatch);
+            std::exit(EXIT_FAILURE);
+        }
+    }
+}
+
+FuzzResult runFuzz(std::vector<FuzzSubject> &subjects, const FuzzOptions &opts)
+{
+    auto            board = std::make_unique<Board>(opts.boardSize);
+    std::mt19937_64 rng(opts.seed);
+    FuzzResult      result {};
+    Time            startTime = now();
+
+    auto chance = [&](float prob) { return std::uniform_real_distribution<float>()(rng) < prob; };
+
+    for (int game = 0; game < opts.numGames; game++) {
+        board->newGame(opts.rule);
+        for (FuzzSubject &subject : subjects)
+            subject.incremental->syncWithBoard(*board);
+
+        for (int step = 0; step < opts.numSteps; step++) {
+            bool mustUndo = isTerminal(*board) || board->ply() >= opts.maxPly;
+            Pos  pos      = Pos::NONE;
+            if (!mustUndo && (board->ply() == 0 || !chance(opts.undoProb)))
+                pos = pickFuzzMove(*board, opts.rule, rng);
+
+            if (pos != Pos::NONE) {
+                moveWithSubjects(*board, opts.rule, pos, subjects);
+                result.moves++;
+            }
+            else if (board->ply() > 0) {
+                int numUndo = 1 + rng() % std::min(board->ply(), opts.maxUndo);
+                for (int i = 0; i < numUndo; i++)
+                    undoWithSubjects(*board, opts.rule, subjects);
+                result.undos += numUndo;
+            }
+
+            // Leave some steps unchecked so that batches of pending updates are applied
+            if (rng() % opts.checkInterval == 0) {
+                checkPosition(*board, subjects, opts);
+                result.checked++;
+            }
+
+            // Occasionally play a line, take it back and play it again, so that
+            // the state of its last position can be restored from snapshots
+            if (!isTerminal(*board) && chance(opts.revisitProb)) {
+                std::vector<Pos> line;
+                while ((int)line.size() < opts.maxUndo && board->ply() < opts.maxPly
+                       && !isTerminal(*board)) {
+                    Pos linePos = pickFuzzMove(*board, opts.rule, rng);
+                    if (linePos == Pos::NONE)
+                        break;
+                    moveWithSubjects(*board, opts.rule, linePos, subjects);
+                    line.push_back(linePos);
+                }
+                checkPosition(*board, subjects, opts);
+
+                for (size_t i = 0; i < line.size(); i++)
+                    undoWithSubjects(*board, opts.rule, subjects);
+                checkPosition(*board, subjects, opts);
+
+                for (Pos linePos : line)
+                    moveWithSubjects(*board, opts.rule, linePos, subjects);
+                checkPosition(*board, subjects, opts);
+
+                result.moves += 2 * line.size();
+                result.undos += line.size();
+                result.checked += 3;
+            }
+        }
+    }
+
+    result.stats    = subjects[0].incremental->getUpdateStats();
+    result.duration = now() - startTime;
+    return result;
+}
+
+}  // namespace
+
+void Command::evalfuzz(int argc, char *argv[])
+{
+    FuzzOptions opts;
+
+    cxxopts::Options options("rapfi evalfuzz");
+    options.add_options()  //
+        ("r,rule",
+         "One of [freestyle, standard, renju] rule",
+         cxxopts::value<std::string>()->default_value("freestyle"))  //
+        ("s,boardsize", "Board size in [5,22]", cxxopts::value<int>()->default_value("15"))  //
+        ("g,games", "Number of random games", cxxopts::value<int>()->default_value("20"))    //
+        ("n,steps",
+         "Number of move or undo steps of each game",
+         cxxopts::value<int>()->default_value("500"))  //
+        ("p,maxply", "Maximum ply of each game", cxxopts::value<int>()->default_value("120"))  //
+        ("maxundo",
+         "Maximum number of moves taken back in one step",
+         cxxopts::value<int>()->default_value("8"))  //
+        ("undo-prob",
+         "Probability of an undo step",
+         cxxopts::value<float>()->default_value("0.35"))  //
+        ("revisit-prob",
+         "Probability of playing a line again after taking it back",
+         cxxopts::value<float>()->default_value("0.05"))  //
+        ("i,interval",
+         "Average number of steps between two checked positions",
+         cxxopts::value<int>()->default_value("2"))  //
+        ("t,tolerance",
+         "Relative tolerance of incremental outputs to outputs after a full sync",
+         cxxopts::value<float>()->default_value("0"))  //
+        ("kernel-tolerance",
+         "Relative tolerance of outputs between kernel variants",
+         cxxopts::value<float>()->default_value("1e-4"))  //
+        ("a,all-kernels",
+         "Cross check all kernel variants supported by the CPU (runtime dispatch build only)")  //
+        ("seed", "Random seed", cxxopts::value<uint64_t>()->default_value("0"))  //
+        ("h,help", "Print evalfuzz usage");
+    // Global options such as --config are parsed by main
+    options.allow_unrecognised_options();
+
+    try {
+        auto args = options.parse(argc, argv);
+
+        if (args.count("help")) {
+            std::cout << options.help() << std::endl;
+            std::exit(EXIT_SUCCESS);
+        }
+
+        opts.rule            = parseRule(args["rule"].as<std::string>());
+        opts.boardSize       = args["boardsize"].as<int>();
+        opts.numGames        = args["games"].as<int>();
+        opts.numSteps        = args["steps"].as<int>();
+        opts.maxPly          = args["maxply"].as<int>();
+        opts.maxUndo         = args["maxundo"].as<int>();
+        opts.undoProb        = args["undo-prob"].as<float>();
+        opts.revisitProb     = args["revisit-prob"].as<float>();
+        opts.checkInterval   = args["interval"].as<int>();
+        opts.tolerance       = args["tolerance"].as<float>();
+        opts.kernelTolerance = args["kernel-tolerance"].as<float>();
+        opts.allKernels      = args.count("all-kernels");
+        opts.seed            = args["seed"].as<uint64_t>();
+
+        if (opts.boardSize < 5 || opts.boardSize > MAX_BOARD_SIZE)
+            throw std::invalid_argument("boardsize must be in range [5,22]");
+        if (opts.maxPly <= 0 || opts.maxUndo <= 0 || opts.checkInterval <= 0)
+            throw std::invalid_argument("maxply, maxundo and interval must be positive");
+#ifndef RUNTIME_DISPATCH
+        if (opts.allKernels)
+            throw std::invalid_argument("all-kernels requires a runtime dispatch build");
+#endif
+    }
+    catch (const std::exception &e) {
+        ERRORL("evalfuzz argument: " << e.what());
+        std::exit(EXIT_FAILURE);
+    }
+
+    try {
+        std::vector<FuzzSubject> subjects = createSubjects(opts);
+        FuzzResult               result   = runFuzz(subjects, opts);
+
+        std::string kernels;
+        for (const FuzzSubject &subject : subjects)
+            kernels += (kernels.empty() ? "" : " ") + subject.name;
+
+        MESSAGEL("Rule: " << opts.rule << ", Board size: " << opts.boardSize
+                          << ", Kernels: " << kernels << ", Moves: " << result.moves
+                          << ", Undos: " << result.undos << ", Checked: " << result.checked
+                          << ", Time (ms): " << result.duration);
+        MESSAGEL("Update stats: Syncs " << result.stats.numSyncs << ", Replayed moves "
+                                        << result.stats.numReplayedMoves << ", Snapshot restores "
+                                        << result.stats.numSnapshotRestores);
+        MESSAGEL("All checked positions match.");
+    }
+    catch (const std::exception &e) {
+        ERRORL("evalfuzz: " << e.what());
+        std::exit(EXIT_FAILURE);
+    }
+}
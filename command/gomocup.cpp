@@ -442,6 +442,35 @@ void showHashUsage()
     int hashfull_permill = Search::TT.hashUsage();
     MESSAGEL("Transposition table full: " << hashfull_permill / 10 << "." << hashfull_permill % 10
                                           << "%");
+#ifdef WIDE_HASH_KEY
+    auto showCollisions = [](const char *name, const Hash::CollisionStats &stats) {
+        MESSAGEL(name << " 64-bit key collisions: " << stats.numCollisions.load() << "/"
+                      << stats.numProbes.load() << " (rate " << stats.rate() << ")");
+    };
+    showCollisions("Node table", Hash::nodeTableCollisions);
+    showCollisions("Database cache", Hash::dbCacheCollisions);
+#endif
+
+    if (auto dbStorage = Search::Threads.dbStorage()) {
+        if (auto filter = dbStorage->lookupFilter()) {
+            ::Database::DBClient::LookupStats stats;
+            for (const auto &th : Search::Threads) {
+                if (th->dbClient && &th->dbClient->getStorage() == dbStorage) {
+                    stats.numRejects += th->dbClient->getLookupStats().numRejects;
+                    stats.numPasses += th->dbClient->getLookupStats().numPasses;
+                    stats.numFalsePositives += th->dbClient->getLookupStats().numFalsePositives;
+                }
+            }
+
+            uint64_t numMisses = stats.numRejects + stats.numFalsePositives;
+            MESSAGEL("Database filter: " << filter->size() << " keys, "
+                                         << filter->memoryUsage() / 1024 << " KiB, estimated FPR "
+                                         << filter->estimatedFPR() << ", measured FPR "
+                                         << stats.numFalsePositives << "/" << numMisses
+                                         << ", rejected " << stats.numRejects << "/"
+                                         << stats.numRejects + stats.numPasses << " queries");
+        }
+    }
 }
 
 void dumpHash()
@@ -0,0 +1,304 @@
+/*
+ *  Rapfi, a Gomoku/Renju playing engine supporting piskvork protocol.
+ *  Copyright (C) 2022  Rapfi developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../core/iohelper.h"
+#include "../core/utils.h"
+#include "../game/board.h"
+#include "../game/movegen.h"
+#include "../game/wincheck.h"
+#include "argutils.h"
+#include "command.h"
+
+#define CXXOPTS_NO_REGEX
+#include <algorithm>
+#include <cxxopts.hpp>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+/// Move generation mode used to enumerate the perft tree.
+enum class PerftGen {
+    All,     /// generate<ALL> at every node
+    VCF,     /// generate<VCF> for the attacker, generate<DEFEND_FIVE> for the defender
+    Defend,  /// generate<DEFEND_*> when opponent has a threat, otherwise generate<ALL>
+};
+
+struct PerftResult
+{
+    uint64_t leaves;    /// Number of leaf nodes at the given depth
+    uint64_t nodes;     /// Number of all visited nodes (including interior nodes)
+    uint64_t wins;      /// Number of visited nodes that quickWinCheck() found a mate
+    uint64_t checked;   /// Number of nodes cross checked with a fresh rebuilt board
+    Time     duration;  /// Elapsed time in milliseconds
+};
+
+PerftGen parsePerftGen(std::string_view genStr)
+{
+    if (genStr == "all")
+        return PerftGen::All;
+    else if (genStr == "vcf")
+        return PerftGen::VCF;
+    else if (genStr == "defend")
+        return PerftGen::Defend;
+    else
+        throw std::invalid_argument("unknown gen type " + std::string(genStr));
+}
+
+/// Compare the incremental board state to a board rebuilt from scratch.
+/// @return An empty string if both states match, otherwise a list of mismatched fields.
+template <Rule R>
+std::string compareWithRebuild(const Board &board, Board &fresh)
+{
+    fresh.newGame<R>();
+    for (int i = 0; i < board.ply(); i++)
+        fresh.move<R>(board.getHistoryMove(i));
+
+    std::ostringstream ss;
+    if (board.zobristKey() != fresh.zobristKey())
+        ss << "zobristKey ";
+    if (board.sideToMove() != fresh.sideToMove())
+        ss << "sideToMove ";
+
+    const StateInfo &st = board.stateInfo(), &fst = fresh.stateInfo();
+    if (st.valueBlack != fst.valueBlack)
+        ss << "valueBlack ";
+    for (Color c : {BLACK, WHITE}) {
+        for (int p4 = 0; p4 < PATTERN4_NB; p4++)
+            if (st.p4Count[c][p4] != fst.p4Count[c][p4])
+                ss << "p4Count[" << c << "][" << Pattern4(p4) << "] ";
+        if (st.lastFlex4AttackMove[c] != fst.lastFlex4AttackMove[c])
+            ss << "lastFlex4AttackMove[" << c << "] ";
+        for (int i = 0; i < 3; i++)
+            if (st.lastPattern4Move[c][i] != fst.lastPattern4Move[c][i])
+                ss << "lastPattern4Move[" << c << "][" << i << "] ";
+        for (int p4 = 0; p4 < PATTERN4_NB; p4++)
+            if (!std::equal(std::begin(board.p4Bitboard(c, Pattern4(p4)).bits),
+                            std::end(board.p4Bitboard(c, Pattern4(p4)).bits),
+                            std::begin(fresh.p4Bitboard(c, Pattern4(p4)).bits)))
+                ss << "p4Bitboard[" << c << "][" << Pattern4(p4) << "] ";
+    }
+
+    FOR_EVERY_POSITION(&board, pos)
+    {
+        const Cell &c = board.cell(pos), &fc = fresh.cell(pos);
+        bool        same = c.piece == fc.piece && c.cand == fc.cand;
+        if (same && c.piece == EMPTY) {
+            same = c.valueBlack == fc.valueBlack;
+            for (Color side : {BLACK, WHITE})
+                same = same && c.pattern4[side] == fc.pattern4[side]
+                       && c.score[side] == fc.score[side];
+            for (int dir = 0; dir < 4; dir++)
+                same = same && c.pattern2x[dir].patBlack == fc.pattern2x[dir].patBlack
+                       && c.pattern2x[dir].patWhite == fc.pattern2x[dir].patWhite;
+        }
+        if (!same)
+            ss << "cell " << pos << " ";
+    }
+
+    if (quickWinCheck<R>(board, 0) != quickWinCheck<R>(fresh, 0))
+        ss << "quickWinCheck";
+
+    return ss.str();
+}
+
+/// Generate all moves to enumerate at the current node with the given gen mode.
+template <Rule R>
+ScoredMove *generatePerftMoves(const Board &board, PerftGen gen, ScoredMove *moveList)
+{
+    constexpr GenType RuleType = R == FREESTYLE  ? RULE_FREESTYLE
+                                 : R == STANDARD ? RULE_STANDARD
+                                                 : RULE_RENJU;
+    Color self = board.sideToMove(), oppo = ~self;
+    ScoredMove *last = moveList;
+
+    switch (gen) {
+    case PerftGen::All: last = generate<ALL>(board, moveList); break;
+    case PerftGen::VCF:
+        if (board.p4Count(oppo, A_FIVE))
+            last = generate<DEFEND_FIVE>(board, moveList);
+        else if (R == RENJU)
+            last = generate<VCF | RULE_RENJU>(board, moveList);
+        else
+            last = generate<VCF>(board, moveList);
+        break;
+    case PerftGen::Defend:
+        if (board.p4Count(oppo, A_FIVE))
+            last = generate<DEFEND_FIVE>(board, moveList);
+        else if (board.p4Count(oppo, B_FLEX4))
+            last = generate<DEFEND_FOUR | ALL>(board, moveList);
+        else if (board.p4Count(oppo, C_BLOCK4_FLEX3)
+                 && (last = generate<DEFEND_B4F3 | RuleType>(board, moveList)) > moveList)
+            break;
+        else
+            last = generate<ALL>(board, moveList);
+        break;
+    }
+
+    // Forbidden points are not legal moves for black in Renju
+    if (R == RENJU && self == BLACK)
+        last = std::remove_if(moveList, last, [&](Pos pos) {
+            return board.checkForbiddenPoint(pos);
+        });
+
+    return last;
+}
+
+template <Rule R>
+void perft(Board &board, Board &fresh, PerftGen gen, int depth, bool check, PerftResult &result)
+{
+    result.nodes++;
+    if (quickWinCheck<R>(board, 0))
+        result.wins++;
+
+    if (check) {
+        std::string mismatch = compareWithRebuild<R>(board, fresh);
+        result.checked++;
+        if (!mismatch.empty()) {
+            ERRORL("perft: board state mismatch at " << board.positionString() << ": "
+                                                     << mismatch);
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    // Stop at depth limit, or at the terminal node where the last move made a five
+    Pos lastMove = board.getLastMove();
+    if (depth <= 0 || board.movesLeft() == 0
+        || lastMove != Pos::NONE && lastMove != Pos::PASS
+               && board.cell(lastMove).pattern4[~board.sideToMove()] == A_FIVE) {
+        result.leaves++;
+        return;
+    }
+
+    ScoredMove  moves[MAX_MOVES];
+    ScoredMove *end = generatePerftMoves<R>(board, gen, moves);
+
+    for (ScoredMove *move = moves; move < end; move++) {
+        board.move<R>(move->pos);
+        perft<R>(board, fresh, gen, depth - 1, check, result);
+        board.undo<R>();
+    }
+}
+
+template <Rule R>
+PerftResult
+runPerft(int boardSize, const std::vector<Pos> &position, PerftGen gen, int depth, bool check)
+{
+    auto board = std::make_unique<Board>(boardSize);
+    auto fresh = std::make_unique<Board>(boardSize);
+    board->newGame<R>();
+    for (Pos pos : position) {
+        if (!board->isLegal(pos))
+            throw std::invalid_argument("illegal move in position string");
+        board->move<R>(pos);
+    }
+
+    PerftResult result {};
+    Time        startTime = now();
+    perft<R>(*board, *fresh, gen, depth, check, result);
+    result.duration = now() - startTime;
+    return result;
+}
+
+}  // namespace
+
+void Command::perft(int argc, char *argv[])
+{
+    std::vector<Rule> rules;
+    int               boardSize;
+    int               depth;
+    PerftGen          gen;
+    bool              check;
+    std::string       positionString;
+
+    cxxopts::Options options("rapfi perft");
+    options.add_options()  //
+        ("r,rule",
+         "One of [freestyle, standard, renju, all] rules",
+         cxxopts::value<std::string>()->default_value("all"))  //
+        ("s,boardsize", "Board size in [5,22]", cxxopts::value<int>()->default_value("15"))  //
+        ("d,depth", "Depth to enumerate", cxxopts::value<int>()->default_value("3"))         //
+        ("p,position",
+         "Position string of the root (eg. h8h7j6)",
+         cxxopts::value<std::string>()->default_value(""))  //
+        ("g,gen",
+         "One of [all, vcf, defend] move generation types",
+         cxxopts::value<std::string>()->default_value("all"))  //
+        ("c,check", "Cross check incremental board state against a rebuild at every node")  //
+        ("h,help", "Print perft usage");
+
+    try {
+        auto args = options.parse(argc, argv);
+
+        if (args.count("help")) {
+            std::cout << options.help() << std::endl;
+            std::exit(EXIT_SUCCESS);
+        }
+
+        std::string ruleStr = args["rule"].as<std::string>();
+        if (ruleStr == "all")
+            rules = {FREESTYLE, STANDARD, RENJU};
+        else
+            rules = {parseRule(ruleStr)};
+
+        boardSize      = args["boardsize"].as<int>();
+        depth          = args["depth"].as<int>();
+        gen            = parsePerftGen(args["gen"].as<std::string>());
+        check          = args.count("check");
+        positionString = args["position"].as<std::string>();
+
+        if (boardSize < 5 || boardSize > MAX_BOARD_SIZE)
+            throw std::invalid_argument("boardsize must be in range [5,22]");
+        if (depth < 0)
+            throw std::invalid_argument("depth must be non-negative");
+    }
+    catch (const std::exception &e) {
+        ERRORL("perft argument: " << e.what());
+        std::exit(EXIT_FAILURE);
+    }
+
+    try {
+        std::vector<Pos> position = parsePositionString(positionString, boardSize, boardSize);
+
+        for (Rule rule : rules) {
+            PerftResult result;
+            switch (rule) {
+            default:
+            case FREESTYLE:
+                result = runPerft<FREESTYLE>(boardSize, position, gen, depth, check);
+                break;
+            case STANDARD:
+                result = runPerft<STANDARD>(boardSize, position, gen, depth, check);
+                break;
+            case RENJU: result = runPerft<RENJU>(boardSize, position, gen, depth, check); break;
+            }
+
+            MESSAGEL("Rule: " << rule << ", Depth: " << depth << ", Leaves: " << result.leaves
+                              << ", Nodes: " << result.nodes << ", Wins: " << result.wins
+                              << ", Time (ms): " << result.duration << ", Mnodes/s: "
+                              << result.nodes / 1000.0 / std::max<Time>(result.duration, 1)
+                              << (check ? ", Checked: " + std::to_string(result.checked) : ""));
+        }
+    }
+    catch (const std::exception &e) {
+        ERRORL("perft: " << e.what());
+        std::exit(EXIT_FAILURE);
+    }
+}
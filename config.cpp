@@ -21,6 +21,7 @@
 #include "command/command.h"
 #include "core/iohelper.h"
 #include "database/dbstorage.h"
+#include "database/sorteddbstorage.h"
 #include "database/yxdbstorage.h"
 #include "eval/evaluator.h"
 #include "eval/mix10nnue.h"
@@ -34,6 +35,9 @@
 #ifdef USE_ORT_EVALUATOR
     #include "eval/onnxevaluator.h"
 #endif
+#ifdef RUNTIME_DISPATCH
+    #include "eval/dispatch.h"
+#endif
 
 #include <cpptoml.h>
 #include <fstream>
@@ -72,6 +76,17 @@ float EvaluatorMarginScale           = 395.0f;
 float EvaluatorDrawBlackWinRate      = 0.5f;
 float EvaluatorDrawRatio             = 1.0f;
 
+/// Cascade evaluation first evaluates value with the cheapest accuracy level of evaluator,
+/// and escalates to the best level if the uncertainty is above the threshold, or the value
+/// lies within the margin of alpha-beta window.
+bool  EvaluatorCascade            = false;
+float EvaluatorCascadeUncertainty = 0.25f;
+int   EvaluatorCascadeMargin      = 80;
+
+/// Evaluators restore their state from the snapshot table instead of replaying moves,
+/// when at least this number of moves need to be replayed. Zero disables snapshots.
+int EvaluatorSnapshotMinReplay = 4;
+
 // Classical evaluation and score tables
 // Note that Renju has asymmetry eval and score
 
@@ -79,6 +94,11 @@ Eval          EVALS[RULE_NB + 1][PCODE_NB];
 Eval          EVALS_THREAT[RULE_NB + 1][THREAT_NB];
 Pattern4Score P4SCORES[RULE_NB + 1][PCODE_NB];
 
+/// Directory to store preprocessed weight cache of evaluators (empty for disabled).
+std::filesystem::path WeightCacheDirectory;
+/// Whether to share preprocessed weight of evaluators across processes in shared memory.
+bool WeightSharedMemory = false;
+
 // -------------------------------------------------
 // General options
 
@@ -563,6 +583,11 @@ void Config::readEvaluator(const cpptoml::table &t)
 {
     using namespace std::filesystem;
 
+    if (auto cacheDir = t.get_as<std::string>("weight_cache_dir"))
+        WeightCacheDirectory =
+            cacheDir->empty() ? path {} : Command::getModelFullPath(u8path(*cacheDir));
+    WeightSharedMemory = t.get_as<bool>("weight_shared_memory").value_or(WeightSharedMemory);
+
     auto evaluatorType = t.get_as<std::string>("type");
     auto weights       = t.get_table_array("weights");
     if (!evaluatorType || !weights || weights->begin() == weights->end())
@@ -643,7 +668,11 @@ void Config::readEvaluator(const cpptoml::table &t)
                 path                  weightPath,
                 std::pair<path, path> blackAndWhiteWeightPath,
                 const cpptoml::table &weightCfg) {
+#ifdef RUNTIME_DISPATCH
+                return Evaluation::dispatch::createMix9svqEvaluator(
+#else
                 return std::make_unique<Evaluation::mix9svq::Evaluator>(
+#endif
                     boardSize,
                     rule,
                     numaId,
@@ -660,7 +689,11 @@ void Config::readEvaluator(const cpptoml::table &t)
                 path                  weightPath,
                 std::pair<path, path> blackAndWhiteWeightPath,
                 const cpptoml::table &weightCfg) {
+#ifdef RUNTIME_DISPATCH
+                return Evaluation::dispatch::createMix10Evaluator(
+#else
                 return std::make_unique<Evaluation::mix10::Evaluator>(
+#endif
                     boardSize,
                     rule,
                     numaId,
@@ -704,6 +737,16 @@ void Config::readEvaluator(const cpptoml::table &t)
     EvaluatorDrawBlackWinRate = std::clamp(EvaluatorDrawBlackWinRate, 0.0f, 1.0f);
     EvaluatorDrawRatio        = std::clamp(EvaluatorDrawRatio, 0.0f, 1.0f);
 
+    // Read cascade evaluation thresholds
+    EvaluatorCascade = t.get_as<bool>("cascade").value_or(EvaluatorCascade);
+    EvaluatorCascadeUncertainty =
+        (float)t.get_as<double>("cascade_uncertainty").value_or(EvaluatorCascadeUncertainty);
+    EvaluatorCascadeMargin = t.get_as<int>("cascade_margin").value_or(EvaluatorCascadeMargin);
+
+    // Read min number of replayed moves to use evaluator snapshots
+    EvaluatorSnapshotMinReplay =
+        std::max(t.get_as<int>("snapshot_min_replay").value_or(EvaluatorSnapshotMinReplay), 0);
+
     MESSAGEL("Evaluator set to " << *evaluatorType << ".");
 }
 
@@ -728,11 +771,13 @@ void Config::readDatabase(const cpptoml::table &t)
         bool saveOnClose      = true;
         int  numBackupsOnSave = 1;
         bool ignoreCorrupted  = false;
+        bool writeAheadLog    = false;
         if (auto args = t.get_table("yixindb")) {
             compressedSave   = args->get_as<bool>("compressed_save").value_or(compressedSave);
             saveOnClose      = args->get_as<bool>("save_on_close").value_or(saveOnClose);
             numBackupsOnSave = args->get_as<int>("num_backups_on_save").value_or(numBackupsOnSave);
             ignoreCorrupted  = args->get_as<bool>("ignore_corrupted").value_or(ignoreCorrupted);
+            writeAheadLog    = args->get_as<bool>("write_ahead_log").value_or(writeAheadLog);
         }
 
         DatabaseMaker = [=](std::string utf8URL) -> std::unique_ptr<::Database::DBStorage> {
@@ -745,7 +790,8 @@ void Config::readDatabase(const cpptoml::table &t)
                                                                            compressedSave,
                                                                            saveOnClose,
                                                                            numBackupsOnSave,
-                                                                           ignoreCorrupted);
+                                                                           ignoreCorrupted,
+                                                                           writeAheadLog);
                 if (existing)
                     MESSAGEL("Loaded Yixin database (" << dbStorage->size() << " records) using "
                                                        << (now() - startTime) << " ms.");
@@ -757,6 +803,30 @@ void Config::readDatabase(const cpptoml::table &t)
             }
         };
     }
+    else if (DatabaseType == "sorteddb") {
+        if (DatabaseURL.empty())
+            DatabaseURL = "rapfi.sdb";
+
+        bool saveOnClose = true;
+        if (auto args = t.get_table("sorteddb"))
+            saveOnClose = args->get_as<bool>("save_on_close").value_or(saveOnClose);
+
+        DatabaseMaker = [=](std::string utf8URL) -> std::unique_ptr<::Database::DBStorage> {
+            try {
+                auto dbPath    = std::filesystem::u8path(utf8URL);
+                auto startTime = now();
+                MESSAGEL("Opening sorted database at " << pathToConsoleString(dbPath) << " ...");
+                auto dbStorage = std::make_unique<::Database::SortedDBStorage>(dbPath, saveOnClose);
+                MESSAGEL("Mapped sorted database (" << dbStorage->size() << " records) using "
+                                                    << (now() - startTime) << " ms.");
+                return std::move(dbStorage);
+            }
+            catch (const std::exception &e) {
+                ERRORL("Failed to create sorted database: " << e.what());
+                return nullptr;
+            }
+        };
+    }
     else if (!DatabaseType.empty()) {
         throw std::runtime_error("unsupported database type " + DatabaseType);
     }
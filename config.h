@@ -24,6 +24,7 @@
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <filesystem>
 #include <memory>
 
 /// Total count of patterncode (pattern combination for 4 directions)
@@ -97,10 +98,17 @@ extern float         EvaluatorMarginWinLossExponent;
 extern float         EvaluatorMarginScale;
 extern float         EvaluatorDrawBlackWinRate;
 extern float         EvaluatorDrawRatio;
+extern bool          EvaluatorCascade;
+extern float         EvaluatorCascadeUncertainty;
+extern int           EvaluatorCascadeMargin;
+extern int           EvaluatorSnapshotMinReplay;
 extern Eval          EVALS[RULE_NB + 1][PCODE_NB];
 extern Eval          EVALS_THREAT[RULE_NB + 1][THREAT_NB];
 extern Pattern4Score P4SCORES[RULE_NB + 1][PCODE_NB];
 
+extern std::filesystem::path WeightCacheDirectory;
+extern bool                  WeightSharedMemory;
+
 // -------------------------------------------------
 // General options
 extern bool                ReloadConfigEachMove;
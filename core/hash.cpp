@@ -28,6 +28,30 @@ namespace Hash {
 HashKey zobrist[SIDE_NB][FULL_BOARD_CELL_COUNT];
 HashKey zobristSide[SIDE_NB];
 
+#ifdef WIDE_HASH_KEY
+CollisionStats nodeTableCollisions;
+CollisionStats dbCacheCollisions;
+
+/// Init zobrish table using PRNG with the given seed.
+/// The lower halves are generated with the same sequence as the 64-bit build,
+/// and the higher halves are generated from an independent PRNG stream.
+/// @param seed Seed of PRNG.
+void initZobrish(uint64_t seed)
+{
+    PRNG prng {seed};
+    PRNG prngHi {LCHash(seed)};
+
+    for (int i = 0; i < FULL_BOARD_CELL_COUNT; i++) {
+        zobrist[BLACK][i].lo = prng();
+        zobrist[WHITE][i].lo = prng();
+        zobrist[BLACK][i].hi = prngHi();
+        zobrist[WHITE][i].hi = prngHi();
+    }
+
+    zobristSide[BLACK] = {prng(), prngHi()};
+    zobristSide[WHITE] = {prng(), prngHi()};
+}
+#else
 /// Init zobrish table using PRNG with the given seed.
 /// @param seed Seed of PRNG.
 void initZobrish(uint64_t seed)
@@ -42,6 +66,7 @@ void initZobrish(uint64_t seed)
     zobristSide[BLACK] = prng();
     zobristSide[WHITE] = prng();
 }
+#endif
 
 const auto init = []() {
     initZobrish(ZOBRISH_SEED);
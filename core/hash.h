@@ -21,7 +21,10 @@
 #include "pos.h"
 #include "types.h"
 
+#include <atomic>
 #include <cstdint>
+#include <functional>
+#include <ostream>
 #include <xxhash.h>
 
 namespace Hash {
@@ -63,4 +66,81 @@ private:
 extern HashKey zobrist[SIDE_NB][FULL_BOARD_CELL_COUNT];
 extern HashKey zobristSide[SIDE_NB];
 
+/// Get the bits of a hash key that a table should use for indexing.
+/// @note Consumers should take the index from indexBits() and verify entries with
+///     checkBits(). With a 64-bit key both are the same word, so a consumer must take
+///     different bit ranges of it (eg. mulhi64 for index and the lower 32 bits for
+///     verification), while a 128-bit key gives two fully independent halves.
+constexpr uint64_t indexBits(HashKey key)
+{
+#ifdef WIDE_HASH_KEY
+    return key.lo;
+#else
+    return key;
+#endif
+}
+
+/// Get the bits of a hash key that a table should use for entry verification.
+constexpr uint64_t checkBits(HashKey key)
+{
+#ifdef WIDE_HASH_KEY
+    return key.hi;
+#else
+    return key;
+#endif
+}
+
+#ifdef WIDE_HASH_KEY
+/// CollisionStats counts the narrow hash collisions observed by the consumers of
+/// 128-bit hash keys. A narrow collision happens when two different keys share
+/// the same lower 64 bits, which a default 64-bit build could not tell apart.
+struct CollisionStats
+{
+    std::atomic<uint64_t> numProbes {0};
+    std::atomic<uint64_t> numCollisions {0};
+
+    /// Record a probe of a new key against a stored key of a different position.
+    /// @param collided Whether the two keys share the same lower 64 bits.
+    void record(bool collided)
+    {
+        numProbes.fetch_add(1, std::memory_order_relaxed);
+        if (collided)
+            numCollisions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// Returns the measured collision rate of all recorded probes.
+    double rate() const
+    {
+        uint64_t probes = numProbes.load(std::memory_order_relaxed);
+        return probes ? double(numCollisions.load(std::memory_order_relaxed)) / probes : 0.0;
+    }
+};
+
+/// Check if two keys would collide if only the lower 64 bits are compared.
+constexpr bool isNarrowCollision(HashKey a, HashKey b)
+{
+    return a.lo == b.lo && a.hi != b.hi;
+}
+
+/// Collision stats of the MCTS node table.
+extern CollisionStats nodeTableCollisions;
+/// Collision stats of the database record caches.
+extern CollisionStats dbCacheCollisions;
+#endif
+
 }  // namespace Hash
+
+#ifdef WIDE_HASH_KEY
+inline std::ostream &operator<<(std::ostream &out, HashKey key)
+{
+    return out << key.hi << ':' << key.lo;
+}
+
+namespace std {
+template <>
+struct hash<HashKey>
+{
+    size_t operator()(HashKey key) const noexcept { return size_t(key.lo ^ Hash::LCHash(key.hi)); }
+};
+}  // namespace std
+#endif
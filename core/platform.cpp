@@ -20,10 +20,16 @@
 
 #include "iohelper.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <map>
 #include <vector>
 
+#ifdef MULTI_THREADING
+    #include <thread>
+#endif
+
 #ifdef _WIN32
     #if _WIN32_WINNT < 0x0601
         #undef _WIN32_WINNT
@@ -60,6 +66,13 @@ typedef bool (*fun6_t)(HANDLE, PGROUP_AFFINITY, USHORT);
     #include <unistd.h>
 #endif
 
+#if !defined(_WIN32)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
 #if defined(__APPLE__) || defined(__ANDROID__) || defined(__OpenBSD__) \
     || (defined(__GLIBCXX__) && !defined(_GLIBCXX_HAVE_ALIGNED_ALLOC) && !defined(_WIN32))
     #define POSIXALIGNEDALLOC
@@ -334,6 +347,36 @@ NumaNodeId bindThisThread(size_t)
 
 #endif
 
+void copyOnNode(void *dst, const void *src, size_t size, NumaNodeId numaNodeId)
+{
+#ifdef MULTI_THREADING
+    // Split the copy into chunks of at least 4MB, one chunk for each helper thread
+    constexpr size_t MinChunkSize  = 4 << 20;
+    constexpr size_t MaxNumThreads = 8;
+    const size_t     numThreads    = std::clamp<size_t>(
+        std::min<size_t>(size / MinChunkSize, std::thread::hardware_concurrency()),
+        1,
+        MaxNumThreads);
+    const size_t chunkSize = (size + numThreads - 1) / numThreads;
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < numThreads; i++) {
+        size_t begin = i * chunkSize, end = std::min(begin + chunkSize, size);
+        threads.emplace_back([=]() {
+            bindThisThread(numaNodeId);
+            std::memcpy(static_cast<char *>(dst) + begin,
+                        static_cast<const char *>(src) + begin,
+                        end - begin);
+        });
+    }
+    for (auto &th : threads)
+        th.join();
+#else
+    (void)numaNodeId;  // suppress unused-parameter compiler warning
+    std::memcpy(dst, src, size);
+#endif
+}
+
 }  // namespace Numa
 
 // -------------------------------------------------
@@ -472,4 +515,197 @@ void alignedLargePageFree(void *ptr)
 #endif
 }
 
+void *mapFile(const std::filesystem::path &path, size_t &size)
+{
+#ifdef _WIN32
+    HANDLE hFile = CreateFileW(path.c_str(),
+                               GENERIC_READ,
+                               FILE_SHARE_READ,
+                               NULL,
+                               OPEN_EXISTING,
+                               FILE_ATTRIBUTE_NORMAL,
+                               NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+    LARGE_INTEGER fileSize;
+    void         *mem = nullptr;
+    if (GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart > 0) {
+        HANDLE hMapping = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (hMapping) {
+            mem = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(hMapping);  // The view keeps a reference to the mapping
+        }
+        size = static_cast<size_t>(fileSize.QuadPart);
+    }
+
+    CloseHandle(hFile);
+    return mem;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat st;
+    void       *mem = nullptr;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mem == MAP_FAILED)
+            mem = nullptr;
+        size = static_cast<size_t>(st.st_size);
+    }
+
+    close(fd);  // The mapping keeps a reference to the file
+    return mem;
+#endif
+}
+
+void *createMappedFile(const std::filesystem::path &path, size_t &size)
+{
+#ifdef _WIN32
+    HANDLE hFile = CreateFileW(path.c_str(),
+                               GENERIC_READ | GENERIC_WRITE,
+                               0,
+                               NULL,
+                               CREATE_NEW,
+                               FILE_ATTRIBUTE_NORMAL,
+                               NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+    uint64_t fileSize = size;
+    void    *mem      = nullptr;
+    HANDLE   hMapping = CreateFileMappingW(hFile,
+                                         NULL,
+                                         PAGE_READWRITE,
+                                         static_cast<DWORD>(fileSize >> 32),
+                                         static_cast<DWORD>(fileSize),
+                                         NULL);
+    if (hMapping) {
+        mem = MapViewOfFile(hMapping, FILE_MAP_WRITE, 0, 0, 0);
+        CloseHandle(hMapping);  // The view keeps a reference to the mapping
+    }
+
+    CloseHandle(hFile);
+    return mem;
+#else
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        return nullptr;
+
+    // Round up to the block size, which is the huge page size on hugetlbfs
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_blksize > 0)
+        size = (size + st.st_blksize - 1) / st.st_blksize * st.st_blksize;
+
+    void *mem = nullptr;
+    if (ftruncate(fd, size) == 0) {
+        mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mem == MAP_FAILED)
+            mem = nullptr;
+    }
+
+    close(fd);  // The mapping keeps a reference to the file
+    if (!mem)
+        unlink(path.c_str());
+    return mem;
+#endif
+}
+
+void *openSharedMemory(const std::string &name, size_t &size)
+{
+#if defined(_WIN32)
+    std::string mappingName = "Local\\" + name;
+    HANDLE      hMapping    = OpenFileMappingA(FILE_MAP_READ, FALSE, mappingName.c_str());
+    if (!hMapping)
+        return nullptr;
+
+    void *mem = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(hMapping);  // The view keeps a reference to the mapping
+
+    MEMORY_BASIC_INFORMATION info;
+    if (mem && VirtualQuery(mem, &info, sizeof(info)))
+        size = info.RegionSize;
+    return mem;
+#elif defined(__EMSCRIPTEN__) || defined(__ANDROID__)
+    return nullptr;
+#else
+    int fd = shm_open(("/" + name).c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat st;
+    void       *mem = nullptr;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mem == MAP_FAILED)
+            mem = nullptr;
+        size = static_cast<size_t>(st.st_size);
+    }
+
+    close(fd);  // The mapping keeps a reference to the object
+    return mem;
+#endif
+}
+
+void *createSharedMemory(const std::string &name, size_t size)
+{
+#if defined(_WIN32)
+    std::string mappingName = "Local\\" + name;
+    uint64_t    mappingSize = size;
+    HANDLE      hMapping    = CreateFileMappingA(INVALID_HANDLE_VALUE,
+                                         NULL,
+                                         PAGE_READWRITE,
+                                         static_cast<DWORD>(mappingSize >> 32),
+                                         static_cast<DWORD>(mappingSize),
+                                         mappingName.c_str());
+    if (!hMapping)
+        return nullptr;
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(hMapping);
+        return nullptr;
+    }
+
+    void *mem = MapViewOfFile(hMapping, FILE_MAP_WRITE, 0, 0, 0);
+    CloseHandle(hMapping);  // The view keeps a reference to the mapping
+    return mem;
+#elif defined(__EMSCRIPTEN__) || defined(__ANDROID__)
+    return nullptr;
+#else
+    std::string objectName = "/" + name;
+    int         fd         = shm_open(objectName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        return nullptr;
+
+    void *mem = nullptr;
+    if (ftruncate(fd, size) == 0) {
+        mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mem == MAP_FAILED)
+            mem = nullptr;
+    }
+
+    close(fd);  // The mapping keeps a reference to the object
+    if (!mem)
+        shm_unlink(objectName.c_str());
+    return mem;
+#endif
+}
+
+void removeSharedMemory(const std::string &name)
+{
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__) && !defined(__ANDROID__)
+    shm_unlink(("/" + name).c_str());
+#endif
+}
+
+void unmapFile(void *ptr, size_t size)
+{
+#ifdef _WIN32
+    (void)size;  // suppress unused-parameter compiler warning
+    UnmapViewOfFile(ptr);
+#else
+    munmap(ptr, size);
+#endif
+}
+
 }  // namespace MemAlloc
@@ -37,7 +37,9 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <filesystem>
 #include <memory>
+#include <string>
 #include <type_traits>
 
 // Define some macros for platform specific optimization hint
@@ -88,6 +90,29 @@ inline int popcount(uint64_t x)
 #endif
 }
 
+/// lsb(x) returns the index of the least significant set bit of a non-zero 64-bit word.
+inline int lsb(uint64_t x)
+{
+#if defined(__cpp_lib_bitops) && __cpp_lib_bitops >= 201907L
+    return std::countr_zero(x);
+#elif defined(__clang__) || defined(__GNUC__)
+    return __builtin_ctzll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long idx;
+    _BitScanForward64(&idx, x);
+    return static_cast<int>(idx);
+#else
+    // De Bruijn multiplication on the isolated lowest bit
+    constexpr int Index64[64] = {
+        0,  1,  48, 2,  57, 49, 28, 3,  61, 58, 50, 42, 38, 29, 17, 4,
+        62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12, 5,
+        63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+        46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19, 9,  13, 8,  7,  6,
+    };
+    return Index64[((x & -x) * 0x03f79d71b4cb0a89ULL) >> 58];
+#endif
+}
+
 /// A right logical shift function that supports negetive shamt.
 /// It might be implemented as rotr64 to avoid conditional branch.
 inline uint64_t rotr(uint64_t x, int shamt)
@@ -284,6 +309,11 @@ constexpr int BindGroupThreshold = 8;
 /// the thread, to allow NUMA-aware logics in the thread.
 NumaNodeId bindThisThread(size_t idx);
 
+/// Copy a block of memory with helper threads bound to the given NUMA node. As the
+/// destination pages are first touched by these threads, they are allocated on that
+/// node under the first-touch policy, if they have not been touched before.
+void copyOnNode(void *dst, const void *src, size_t size, NumaNodeId numaNodeId);
+
 }  // namespace Numa
 
 // -------------------------------------------------
@@ -310,11 +340,55 @@ void *alignedLargePageAlloc(size_t size);
 /// Free memory allocated by alignedLargePageAlloc().
 void alignedLargePageFree(void *ptr);
 
+/// Map a whole file into memory with read-only shared pages. The pages are backed
+/// by the file and shared with all other processes mapping it.
+/// @param path Path of the file to map.
+/// @param size [out] Size of the mapped memory, which is the size of the file.
+/// @return Pointer to the mapped memory (page aligned), or nullptr if mapping failed.
+void *mapFile(const std::filesystem::path &path, size_t &size);
+
+/// Create a new file of at least the given size and map it with writable shared pages.
+/// The file size is rounded up to the block size of the file system, so that files on
+/// a hugetlbfs mount (which can only be written through memory mapping) also work.
+/// @param path Path of the file to create. Fails if the file already exists.
+/// @param size [in,out] Minimal size of the file, and the size of the mapped memory.
+/// @return Pointer to the mapped memory (page aligned), or nullptr if creation failed.
+void *createMappedFile(const std::filesystem::path &path, size_t &size);
+
+/// Map an existing named shared memory object with read-only pages.
+/// @param name Name of the shared memory object, without the leading slash.
+/// @param size [out] Size of the mapped memory.
+/// @return Pointer to the mapped memory (page aligned), or nullptr if mapping failed.
+void *openSharedMemory(const std::string &name, size_t &size);
+
+/// Create a new named shared memory object of the given size and map it with writable
+/// pages. Under POSIX the object persists until it is removed from /dev/shm, while under
+/// Windows it lives as long as any process keeps a view of it.
+/// @param name Name of the shared memory object, without the leading slash.
+/// @param size Size of the shared memory object.
+/// @return Pointer to the mapped memory (page aligned), or nullptr if the object
+///     already exists or creation failed.
+void *createSharedMemory(const std::string &name, size_t size);
+
+/// Remove the name of a shared memory object, so that it can be created again. Processes
+/// that have mapped the object keep their mappings. Under Windows this does nothing, as
+/// the object is removed with the last view of it.
+/// @param name Name of the shared memory object, without the leading slash.
+void removeSharedMemory(const std::string &name);
+
+/// Unmap memory mapped by mapFile(), createMappedFile(), openSharedMemory()
+/// or createSharedMemory().
+void unmapFile(void *ptr, size_t size);
+
 }  // namespace MemAlloc
 
 template <typename T>
 struct LargePageDeleter
 {
+    /// Size of the file mapping that holds the object, or 0 if the
+    /// object is allocated with alignedLargePageAlloc().
+    size_t mappedSize = 0;
+
     void operator()(T *ptr) const
     {
         if (!ptr)
@@ -324,7 +398,10 @@ struct LargePageDeleter
         if constexpr (!std::is_trivially_destructible_v<T>)
             ptr->~T();
 
-        MemAlloc::alignedLargePageFree(ptr);
+        if (mappedSize)
+            MemAlloc::unmapFile(ptr, mappedSize);
+        else
+            MemAlloc::alignedLargePageFree(ptr);
     }
 };
 
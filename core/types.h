@@ -28,7 +28,28 @@ typedef uint16_t PatternCode;
 typedef int16_t  Score;
 typedef int16_t  Eval;
 typedef float    Depth;
+
+#ifdef WIDE_HASH_KEY
+/// HashKey is a 128-bit zobrist key composed of two independent 64-bit halves.
+/// The low half is the same key as the default 64-bit build, which is used for
+/// indexing tables, while the high half is used to verify entries.
+struct HashKey
+{
+    uint64_t lo, hi;
+
+    HashKey() = default;
+    constexpr HashKey(uint64_t lo, uint64_t hi) : lo(lo), hi(hi) {}
+    constexpr explicit HashKey(uint64_t k) : lo(k), hi(k) {}
+
+    constexpr HashKey operator^(HashKey k) const { return {lo ^ k.lo, hi ^ k.hi}; }
+    constexpr HashKey &operator^=(HashKey k) { return lo ^= k.lo, hi ^= k.hi, *this; }
+    constexpr bool     operator==(HashKey k) const { return lo == k.lo && hi == k.hi; }
+    constexpr bool     operator!=(HashKey k) const { return !(*this == k); }
+    constexpr bool operator<(HashKey k) const { return lo < k.lo || lo == k.lo && hi < k.hi; }
+};
+#else
 typedef uint64_t HashKey;
+#endif
 
 // -------------------------------------------------
 // Range of searching depth and bound
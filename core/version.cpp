@@ -86,6 +86,9 @@ std::string getBuildInfo()
 #elif defined(USE_NEON)
     ss << " NEON";
 #endif
+#if defined(RUNTIME_DISPATCH)
+    ss << " RUNTIME_DISPATCH";
+#endif
 #if defined(USE_WASM_SIMD_RELAXED)
     ss << " WASM_SIMD_RELAXED";
 #elif defined(USE_WASM_SIMD)
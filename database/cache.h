@@ -18,11 +18,17 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
 #include <functional>
+#include <iterator>
+#include <limits>
 #include <list>
 #include <optional>
+#include <type_traits>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 namespace Database {
 
@@ -132,4 +138,261 @@ private:
     size_t                                  maxCapacity;
 };
 
+/// A fixed-capacity cache implementation with CLOCK eviction. Items are stored in
+/// a slot array, and indexed by an open addressing hash table of slot indices with
+/// linear probing. Slots are allocated as the table fills up, so a large capacity
+/// costs little until it is used, and put/get/remove never allocate once the table
+/// is full. Each slot has a reference bit set on access, and the clock hand sweeps
+/// the slots to evict the first item without reference bit, clearing the bits it
+/// passes by.
+template <typename KeyT, typename ValueT, typename HashT = std::hash<KeyT>>
+class ClockCacheTable
+{
+public:
+    using KVType = std::pair<KeyT, ValueT>;
+
+    struct NullPopCollector
+    {
+        void operator()(KVType &&) {}
+    };
+
+    struct Slot
+    {
+        KVType kv;
+        bool   referenced;  // Whether the item is accessed since the clock hand passed
+        bool   occupied;
+    };
+
+    /// Iterates all cached items in slot order.
+    template <typename SlotIteratorT, typename ReferenceT>
+    class IteratorBase
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = KVType;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = std::remove_reference_t<ReferenceT> *;
+        using reference         = ReferenceT;
+
+        IteratorBase(SlotIteratorT it, SlotIteratorT end) : it(it), end(end) { skipEmpty(); }
+        reference     operator*() const { return it->kv; }
+        pointer       operator->() const { return &it->kv; }
+        IteratorBase &operator++()
+        {
+            ++it;
+            skipEmpty();
+            return *this;
+        }
+        bool operator==(const IteratorBase &other) const { return it == other.it; }
+        bool operator!=(const IteratorBase &other) const { return it != other.it; }
+
+    private:
+        SlotIteratorT it, end;
+        void          skipEmpty()
+        {
+            while (it != end && !it->occupied)
+                ++it;
+        }
+    };
+
+    ClockCacheTable(size_t maxCap) { allocate(maxCap); }
+
+    /// Put a new item into cache table.
+    /// @return Return the reference to the inserted value.
+    template <typename PopCollector = NullPopCollector>
+    ValueT &put(KeyT key, const ValueT &value, PopCollector collector = {})
+    {
+        size_t bucket = findBucket(key);
+        if (buckets[bucket] != EmptyBucket) {
+            Slot &slot      = slots[buckets[bucket]];
+            slot.kv.second  = value;
+            slot.referenced = true;
+            return slot.kv.second;
+        }
+
+        uint32_t slotIndex;
+        if (!freeSlots.empty()) {
+            slotIndex = freeSlots.back();
+            freeSlots.pop_back();
+            numItems++;
+        }
+        else if (slots.size() < maxCapacity) {
+            // Grow the slot array geometrically, but never beyond the capacity
+            if (slots.size() == slots.capacity())
+                slots.reserve(std::min(maxCapacity, std::max<size_t>(2 * slots.size(), 16)));
+            slotIndex = uint32_t(slots.size());
+            slots.emplace_back();
+            numItems++;
+        }
+        else {
+            slotIndex = evict();
+            collector(std::move(slots[slotIndex].kv));
+            // Bucket might be shifted by the erasure of the evicted item
+            bucket = findBucket(key);
+        }
+
+        Slot &slot      = slots[slotIndex];
+        slot.kv.first   = key;
+        slot.kv.second  = value;
+        slot.referenced = false;
+        slot.occupied   = true;
+        buckets[bucket] = slotIndex;
+        return slot.kv.second;
+    }
+
+    /// Try to get an item from cache table.
+    /// @return Pointer to the cached value, or nullptr if not found.
+    ValueT *get(KeyT key)
+    {
+        uint32_t slotIndex = buckets[findBucket(key)];
+        if (slotIndex != EmptyBucket) {
+            // Mark the item as recently used
+            slots[slotIndex].referenced = true;
+            return &slots[slotIndex].kv.second;
+        }
+
+        return nullptr;
+    }
+
+    /// Try to remove an item from cache table.
+    /// @return Whether the item is removed.
+    bool remove(KeyT key)
+    {
+        size_t bucket = findBucket(key);
+        if (buckets[bucket] != EmptyBucket) {
+            uint32_t slotIndex        = buckets[bucket];
+            slots[slotIndex].occupied = false;
+            freeSlots.push_back(slotIndex);
+            numItems--;
+            eraseBucket(bucket);
+            return true;
+        }
+
+        return false;
+    }
+
+    /// Clears all cached entries in the table.
+    void clear()
+    {
+        std::fill(buckets.begin(), buckets.end(), EmptyBucket);
+        slots.clear();
+        freeSlots.clear();
+        numItems  = 0;
+        clockHand = 0;
+    }
+
+    /// Checks if a key exists in the table.
+    bool exists(KeyT key) const { return buckets[findBucket(key)] != EmptyBucket; }
+
+    /// Return the number of items in the cache table.
+    size_t size() const { return numItems; }
+
+    /// Return the total capacity of the cache table.
+    size_t capacity() const { return maxCapacity; }
+
+    /// Adjust the total capacity of the cache table. Items are kept in the
+    /// order of clock hand until the new capacity is reached.
+    void setCapacity(size_t newCapacity)
+    {
+        ClockCacheTable newTable(newCapacity);
+        for (size_t i = 0; i < slots.size() && newTable.size() < newTable.capacity(); i++) {
+            Slot &slot = slots[(clockHand + i) % slots.size()];
+            if (slot.occupied)
+                newTable.put(slot.kv.first, slot.kv.second);
+        }
+        *this = std::move(newTable);
+    }
+
+    /// Give a view of all cached items in slot order.
+    using Iterator      = IteratorBase<typename std::vector<Slot>::iterator, KVType &>;
+    using ConstIterator = IteratorBase<typename std::vector<Slot>::const_iterator, const KVType &>;
+    Iterator      begin() { return Iterator(slots.begin(), slots.end()); }
+    Iterator      end() { return Iterator(slots.end(), slots.end()); }
+    ConstIterator begin() const { return ConstIterator(slots.begin(), slots.end()); }
+    ConstIterator end() const { return ConstIterator(slots.end(), slots.end()); }
+
+private:
+    static constexpr uint32_t EmptyBucket = std::numeric_limits<uint32_t>::max();
+
+    std::vector<Slot>     slots;      // Allocated slots, at most maxCapacity
+    std::vector<uint32_t> buckets;    // Slot index of each bucket, or EmptyBucket
+    std::vector<uint32_t> freeSlots;  // Stack of unoccupied slot indices
+    size_t                maxCapacity;
+    size_t                numItems;
+    size_t                clockHand;
+    size_t                bucketMask;
+
+    void allocate(size_t maxCap)
+    {
+        // Keep load factor of the index below 0.5 for short probe sequences
+        size_t numBuckets = 2;
+        while (numBuckets < 2 * maxCap)
+            numBuckets *= 2;
+
+        maxCapacity = std::max<size_t>(maxCap, 1);
+        buckets.resize(numBuckets);
+        bucketMask = numBuckets - 1;
+        clear();
+    }
+
+    size_t homeBucket(const KeyT &key) const
+    {
+        // Fibonacci hashing to spread the bits of hash value to the high bits
+        uint64_t h = uint64_t(HashT {}(key)) * 0x9E3779B97F4A7C15ULL;
+        return size_t(h >> 32) & bucketMask;
+    }
+
+    /// Returns the bucket containing the key, or the empty bucket to insert the key.
+    size_t findBucket(const KeyT &key) const
+    {
+        size_t bucket = homeBucket(key);
+        while (buckets[bucket] != EmptyBucket && !(slots[buckets[bucket]].kv.first == key))
+            bucket = (bucket + 1) & bucketMask;
+        return bucket;
+    }
+
+    /// Erases a bucket and shifts back the following buckets in the probe sequence.
+    void eraseBucket(size_t bucket)
+    {
+        size_t next = bucket;
+        for (;;) {
+            buckets[bucket] = EmptyBucket;
+            for (;;) {
+                next = (next + 1) & bucketMask;
+                if (buckets[next] == EmptyBucket)
+                    return;
+
+                // Move the item back if its home bucket is not in (bucket, next]
+                size_t home = homeBucket(slots[buckets[next]].kv.first);
+                if (((next - home) & bucketMask) >= ((next - bucket) & bucketMask))
+                    break;
+            }
+            buckets[bucket] = buckets[next];
+            bucket          = next;
+        }
+    }
+
+    /// Advances the clock hand to find a victim, and removes it from the index.
+    /// @return The slot index of the victim item.
+    uint32_t evict()
+    {
+        for (;;) {
+            size_t slotIndex = clockHand;
+            Slot  &slot      = slots[slotIndex];
+            clockHand        = clockHand + 1 == slots.size() ? 0 : clockHand + 1;
+
+            if (!slot.occupied)
+                continue;
+            if (slot.referenced) {
+                // Give the item a second chance
+                slot.referenced = false;
+                continue;
+            }
+
+            eraseBucket(findBucket(slot.kv.first));
+            return uint32_t(slotIndex);
+        }
+    }
+};
+
 }  // namespace Database
@@ -19,6 +19,7 @@
 #include "dbclient.h"
 
 #include "../game/board.h"
+#include "dbfilter.h"
 
 #include <algorithm>
 #include <functional>
@@ -389,6 +390,22 @@ DBKey constructDBKey(const Board &board, Rule rule, TransformType *transType)
     return key[smallestIndex];
 }
 
+HashKey canonicalHashKey(const Board &board)
+{
+    // Boards used in search keep their symmetry keys updated, so no replay is needed
+    if (board.isSymmetryKeysTracked())
+        return board.canonicalZobristKey();
+
+    return canonicalHashKey(board.size(), board.size(), board.sideToMove(), [&](auto &&f) {
+        for (int ply = 0; ply < board.ply(); ply++) {
+            Pos   move = board.getHistoryMove(ply);
+            Color c    = move == Pos::PASS ? EMPTY : board.cell(move).piece;
+            if (c == BLACK || c == WHITE)
+                f(move, c);
+        }
+    });
+}
+
 void toSmallestDBKey(DBKey &key, TransformType *transType)
 {
     DBKey  transformedKeys[TRANS_NB - 1];
@@ -493,20 +510,29 @@ DBClient ::~DBClient()
 
 bool DBClient::query(const Board &board, Rule rule, DBRecord &record)
 {
-    HashKey hashKey = board.zobristKey();
+    HashKey hashKey = canonicalHashKey(board);
 
     // Try find this record in dbRecordCache
     auto &[cachedHashKey, cachedRecord] = dbRecordCache[hashKey];
     if (cachedHashKey == hashKey)
         return record = cachedRecord, true;
+#ifdef WIDE_HASH_KEY
+    if (cachedHashKey != DBRecordCache::NullKey)
+        Hash::dbCacheCollisions.record(Hash::isNarrowCollision(cachedHashKey, hashKey));
+#endif
 
     // Try find this database entry in dbCache
     auto entryCache = dbCache.get(hashKey);
     if (entryCache)
         return record = entryCache->record, true;
 
+    // Reject missing positions by the lookup filter before constructing the key
+    if (!storage.mayContain(hashKey))
+        return lookupStats.numRejects++, false;
+
     // Read record from storage and save it in record cache
     DBKey dbKey = constructDBKey(board, rule);
+    lookupStats.numPasses++;
     if (storage.get(dbKey, record, mask)) {
         // Save a new entry cache in dbCache
         dbCache.put(hashKey,
@@ -523,6 +549,7 @@ bool DBClient::query(const Board &board, Rule rule, DBRecord &record)
         return true;
     }
 
+    lookupStats.numFalsePositives++;
     return false;
 }
 
@@ -642,7 +669,7 @@ void DBClient::setBoardText(const Board &board, Rule rule, Pos pos, std::string
 bool DBClient::save(const Board &board, Rule rule, const DBRecord &record, OverwriteRule owRule)
 {
     DBKey   dbKey;
-    HashKey hashKey   = board.zobristKey();
+    HashKey hashKey   = canonicalHashKey(board);
     bool    overwrite = owRule == OverwriteRule::Always
                      || owRule != OverwriteRule::Disabled && !(mask & RECORD_MASK_LVDB);
 
@@ -676,7 +703,7 @@ bool DBClient::save(const Board &board, Rule rule, const DBRecord &record, Overw
             DBRecord oldRecord;
 
             // Query record from dbStorage first
-            if (storage.get(dbKey, oldRecord))
+            if (storage.mayContain(hashKey) && storage.get(dbKey, oldRecord))
                 overwrite = checkOverwrite(oldRecord, record, owRule);
             else  // Always overwrite if record does not exist
                 overwrite = true;
@@ -700,7 +727,7 @@ bool DBClient::save(const Board &board, Rule rule, const DBRecord &record, Overw
 
 void DBClient::del(const Board &board, Rule rule)
 {
-    HashKey hashKey = board.zobristKey();
+    HashKey hashKey = canonicalHashKey(board);
 
     // First remove record cache from dbRecordCache if exists
     auto &[cachedHashKey, cachedRecord] = dbRecordCache[hashKey];
@@ -19,6 +19,7 @@
 #pragma once
 
 #include "../config.h"
+#include "../core/hash.h"
 #include "../core/utils.h"
 #include "cache.h"
 #include "dbstorage.h"
@@ -36,6 +37,12 @@ namespace Database {
 /// @param transType The pointer to acquire the applied transform type.
 DBKey constructDBKey(const Board &board, Rule rule, TransformType *transType = nullptr);
 
+/// Computes the canonical hash key of the board, which is the smallest zobrist key among
+/// all symmetry transforms. Boards equivalent under symmetry have the same key, which
+/// is also the canonicalHashKey() of the DBKey constructed from the board. It is read
+/// from the board in O(1) if the board tracks symmetry keys, or replays the moves otherwise.
+HashKey canonicalHashKey(const Board &board);
+
 /// Transform a DBKey to its smallest equivalent key.
 /// @param transType The pointer to acquire the applied transform type.
 void toSmallestDBKey(DBKey &key, TransformType *transType = nullptr);
@@ -84,6 +91,16 @@ public:
     /// Returns the underlying database storage instance.
     DBStorage &getStorage() const { return storage; }
 
+    /// LookupStats counts the queries that reach the lookup filter of the storage.
+    struct LookupStats
+    {
+        uint64_t numRejects        = 0;  /// Queries rejected by the filter
+        uint64_t numPasses         = 0;  /// Queries passed the filter and read from storage
+        uint64_t numFalsePositives = 0;  /// Passed queries that are not found in storage
+    };
+    /// Returns the stats of queries that reach the lookup filter.
+    const LookupStats &getLookupStats() const { return lookupStats; }
+
     /// Query db record of the current position.
     /// @return Whether current position exists in the database.
     bool query(const Board &board, Rule rule, DBRecord &record);
@@ -130,18 +147,21 @@ public:
 private:
     DBStorage   &storage;
     DBRecordMask mask;
+    LookupStats  lookupStats;
 
-    /// For speeding up frequent database operations on same db entries, we use a LRUCache
+    /// For speeding up frequent database operations on same db entries, we use a CLOCK cache
     /// to hold all recent visited DBKey and DBRecord. When a DBRecord is updated, it is
     /// marked as dirty and will be pushed to the dbStorage at the next sync or it is
-    /// poped out from cache list by other newer entries.
+    /// evicted from the cache by other newer entries. Both caches are indexed by the
+    /// canonical hash key of board, so positions equivalent under symmetry share
+    /// one entry, and the canonical DBKey is only constructed on a cache miss.
     struct EntryCache
     {
         DBKey    key;
         DBRecord record;
         bool     dirty;
     };
-    LRUCacheTable<HashKey, EntryCache> dbCache;
+    ClockCacheTable<HashKey, EntryCache> dbCache;
 
     /// For read-only operations on db entries, we use a fast lookup table to reduce
     /// redundent database query. This table is index only by hash key.
@@ -156,7 +176,10 @@ private:
             assert(isPowerOfTwo(size));
             clear();
         }
-        KVType &operator[](HashKey key) { return table[(uint32_t)key & (table.size() - 1)]; }
+        KVType &operator[](HashKey key)
+        {
+            return table[(uint32_t)Hash::indexBits(key) & (table.size() - 1)];
+        }
         void    clear()
         {
             for (auto &[k, v] : table)
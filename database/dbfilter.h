@@ -0,0 +1,255 @@
+/*
+ *  Rapfi, a Gomoku/Renju playing engine supporting piskvork protocol.
+ *  Copyright (C) 2022  Rapfi developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../core/hash.h"
+#include "../core/platform.h"
+#include "../core/pos.h"
+#include "dbstorage.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Database {
+
+/// SymmetryTable maps every cell of a square board size to its position under each of
+/// the eight symmetry transforms, so that canonical keys are computed by table lookups.
+class SymmetryTable
+{
+public:
+    /// Returns the table of the board size, which is built on the first use.
+    static const SymmetryTable &get(int boardSize)
+    {
+        static std::once_flag                 builtFlags[MAX_BOARD_SIZE + 1];
+        static std::unique_ptr<SymmetryTable> tables[MAX_BOARD_SIZE + 1];
+
+        assert(boardSize > 0 && boardSize <= MAX_BOARD_SIZE);
+        std::call_once(builtFlags[boardSize], [boardSize] {
+            tables[boardSize].reset(new SymmetryTable(boardSize));
+        });
+        return *tables[boardSize];
+    }
+
+    /// Returns the position of pos under the transform.
+    Pos transform(Pos pos, TransformType trans) const { return table[trans][pos]; }
+
+private:
+    Pos table[TRANS_NB][FULL_BOARD_CELL_COUNT];
+
+    explicit SymmetryTable(int boardSize)
+    {
+        for (int trans = 0; trans < TRANS_NB; trans++) {
+            std::fill_n(table[trans], FULL_BOARD_CELL_COUNT, Pos::NONE);
+            for (int y = 0; y < boardSize; y++)
+                for (int x = 0; x < boardSize; x++)
+                    table[trans][Pos {x, y}] =
+                        applyTransform(Pos {x, y}, boardSize, TransformType(trans));
+        }
+    }
+};
+
+/// Computes the canonical hash key of the stones, which is the smallest zobrist key
+/// among all symmetry transforms, xor-ed with the side to move. forEachStone(f) must
+/// call f(pos, color) for each stone. Only square boards have all eight transforms.
+template <typename ForEachStone>
+HashKey canonicalHashKey(int            boardWidth,
+                         int            boardHeight,
+                         Color          sideToMove,
+                         ForEachStone &&forEachStone)
+{
+    HashKey symKeys[TRANS_NB];
+    std::fill_n(symKeys, TRANS_NB, Hash::zobrist[BLACK][FULL_BOARD_CELL_COUNT - 1]);
+
+    if (boardWidth == boardHeight) {
+        const SymmetryTable &symTable = SymmetryTable::get(boardWidth);
+        forEachStone([&](Pos pos, Color c) {
+            for (int trans = IDENTITY; trans < TRANS_NB; trans++)
+                symKeys[trans] ^= Hash::zobrist[c][symTable.transform(pos, TransformType(trans))];
+        });
+    }
+    else
+        forEachStone([&](Pos pos, Color c) { symKeys[IDENTITY] ^= Hash::zobrist[c][pos]; });
+
+    int     numTrans     = boardWidth == boardHeight ? TRANS_NB : 1;
+    HashKey canonicalKey = *std::min_element(symKeys, symKeys + numTrans);
+    return canonicalKey ^ Hash::zobristSide[sideToMove];
+}
+
+/// Computes the canonical hash key of the position of a database key. It is the same
+/// key as canonicalHashKey() of any board equivalent to the database key.
+template <typename Key>
+HashKey canonicalHashKey(const Key &key)
+{
+    return canonicalHashKey(key.boardWidth, key.boardHeight, key.sideToMove, [&](auto &&f) {
+        for (int i = 0; i < key.numBlackStones + key.numWhiteStones; i++)
+            f(Pos {key.stones[i].x, key.stones[i].y},
+              i < key.numBlackStones ? BLACK : WHITE);
+    });
+}
+
+/// BlockedBloomFilter is a Bloom filter of 64-bit hashes, where all bits of one hash
+/// are set in one 64-byte block (one bit in each of its eight words), so a lookup only
+/// touches a single cache line. Insertions can run concurrently with lookups.
+class BlockedBloomFilter
+{
+public:
+    /// Number of filter bits per hash, giving a false positive rate about 0.06% when full.
+    static constexpr size_t BitsPerKey = 16;
+
+    explicit BlockedBloomFilter(size_t capacity)
+        : numBlocks((std::max<size_t>(capacity, 1) * BitsPerKey + 511) / 512)
+        , maxKeys(numBlocks * 512 / BitsPerKey)
+        , blocks(new Block[numBlocks] {})
+        , keyCount(0)
+    {}
+
+    /// Inserts a hash into the filter.
+    void insert(uint64_t hash) noexcept
+    {
+        Block &block = blocks[blockIndex(hash)];
+        for (int i = 0; i < 8; i++)
+            block.words[i].fetch_or(bitMask(hash, i), std::memory_order_relaxed);
+        keyCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// Checks if a hash might be inserted. False positives are possible, but a hash
+    /// inserted is never rejected.
+    bool mayContain(uint64_t hash) const noexcept
+    {
+        const Block &block = blocks[blockIndex(hash)];
+        for (int i = 0; i < 8; i++) {
+            uint64_t mask = bitMask(hash, i);
+            if ((block.words[i].load(std::memory_order_relaxed) & mask) != mask)
+                return false;
+        }
+        return true;
+    }
+
+    /// Returns the number of hashes inserted.
+    size_t size() const { return keyCount.load(std::memory_order_relaxed); }
+    /// Returns the number of hashes the filter is sized for.
+    size_t capacity() const { return maxKeys; }
+    /// Returns the number of bytes of the filter bits.
+    size_t memoryUsage() const { return numBlocks * sizeof(Block); }
+
+    /// Estimates the false positive rate with the current number of hashes. Each of
+    /// the eight words of a block is a Bloom filter of one hash function.
+    double estimatedFPR() const
+    {
+        double keysPerBlock = double(size()) / numBlocks;
+        return std::pow(1.0 - std::exp(-keysPerBlock / 64.0), 8.0);
+    }
+
+private:
+    struct alignas(64) Block
+    {
+        std::atomic<uint64_t> words[8];
+    };
+
+    size_t                   numBlocks;
+    size_t                   maxKeys;
+    std::unique_ptr<Block[]> blocks;
+    std::atomic<size_t>      keyCount;
+
+    size_t blockIndex(uint64_t hash) const { return mulhi64(hash, numBlocks); }
+    static uint64_t bitMask(uint64_t hash, int i)
+    {
+        // Block index takes the high bits, so derive the bit index in each word from
+        // the low 32 bits, multiplied by a different odd salt for each word.
+        constexpr uint32_t Salts[8] = {0x47b6137bU,
+                                       0x44974d91U,
+                                       0x8824ad5bU,
+                                       0xa2b7289dU,
+                                       0x705495c7U,
+                                       0x2df1424bU,
+                                       0x9efc4947U,
+                                       0x5c6bfb31U};
+        return uint64_t(1) << ((uint32_t(hash) * Salts[i]) >> 26);
+    }
+};
+
+/// DBKeyFilter rejects lookups of positions that are not in a database storage, using
+/// the canonical hash keys of positions. Deleted keys are kept in the filter. When the
+/// number of keys exceeds its capacity, the storage rebuilds a filter twice as large.
+/// Retired filters are kept alive until destruction, so lookups never take a lock.
+class DBKeyFilter
+{
+public:
+    DBKeyFilter() : current(nullptr) {}
+
+    /// Rebuilds the filter for numKeys keys, and inserts all keys by calling
+    /// enumerate(insert), where insert(key) inserts a database key.
+    /// @note Must not be called concurrently with insert() or another rebuild().
+    template <typename Enumerate>
+    void rebuild(size_t numKeys, Enumerate &&enumerate)
+    {
+        constexpr size_t MinCapacity = 1 << 16;
+
+        auto filter = std::make_unique<BlockedBloomFilter>(std::max(2 * numKeys, MinCapacity));
+        enumerate([&](const auto &key) {
+            filter->insert(filterHash(canonicalHashKey(key)));
+        });
+        current.store(filter.get(), std::memory_order_release);
+        filters.push_back(std::move(filter));
+    }
+
+    /// Inserts a database key new to the storage into the filter.
+    /// @return False if the filter is full and should be rebuilt.
+    template <typename Key>
+    bool insert(const Key &key) noexcept
+    {
+        BlockedBloomFilter *filter = current.load(std::memory_order_relaxed);
+        if (!filter)
+            return true;
+
+        filter->insert(filterHash(canonicalHashKey(key)));
+        return filter->size() <= filter->capacity();
+    }
+
+    /// Checks if a position of the canonical hash key might exist in the storage.
+    bool mayContain(HashKey canonicalKey) const noexcept
+    {
+        const BlockedBloomFilter *filter = current.load(std::memory_order_acquire);
+        return !filter || filter->mayContain(filterHash(canonicalKey));
+    }
+
+    /// Returns the current filter, or nullptr if the filter is not built.
+    const BlockedBloomFilter *get() const { return current.load(std::memory_order_acquire); }
+
+private:
+    std::atomic<BlockedBloomFilter *>                current;
+    std::vector<std::unique_ptr<BlockedBloomFilter>> filters;
+
+    /// Canonical keys are the minimum of symmetric keys, whose high bits are biased
+    /// towards zero, so they are remixed with the SplitMix64 finalizer before use.
+    static uint64_t filterHash(HashKey canonicalKey) noexcept
+    {
+        uint64_t z = Hash::indexBits(canonicalKey);
+        z          = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z          = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    }
+};
+
+}  // namespace Database
@@ -19,11 +19,13 @@
 #pragma once
 
 #include "../core/pos.h"
+#include "../core/types.h"
 #include "dbtypes.h"
 
 #include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <mutex>
 #include <ostream>
 #include <stdexcept>
 #include <string>
@@ -178,6 +180,8 @@ struct DBKey
     }
 };
 
+class BlockedBloomFilter;  // forward declaration
+
 /// DBStorage class defines the common interface to all database storages.
 /// Subclass of DBStorage should implement storage functionaility (read/write/flush).
 /// All operations on the db storage instance should be atmoic and thread-safe, so
@@ -229,8 +233,63 @@ public:
     ///     by comparaing the size before and after the scan.
     /// @return Cursor that can be used for the next incremental scan, or the zero
     ///     cursor which means all entries in the database have been iterated.
+    /// @note Storages resume a cursor they returned from the key after the last entry
+    ///     scanned (see ScanResumeKeys), so scanning the whole database is linear.
     virtual Cursor
     scan(Cursor cursor, size_t count, std::vector<std::pair<DBKey, DBRecord>> &out) noexcept = 0;
+
+    /// Check whether a position might exist in the database before reading it.
+    /// @param canonicalKey The canonical hash key of the position, which is the key
+    ///     returned by canonicalHashKey() of the board.
+    /// @return False if the position is surely not in the database. Storages without
+    ///     a lookup filter always return true.
+    virtual bool mayContain(HashKey canonicalKey) noexcept { return true; }
+
+    /// Return the lookup filter of the storage, or nullptr if it has no filter.
+    virtual const BlockedBloomFilter *lookupFilter() noexcept { return nullptr; }
+};
+
+/// ScanResumeKeys remembers the last key returned with the cursors of recent scans, so
+/// that a storage can resume a scan by seeking to the key, instead of skipping all the
+/// entries before the cursor. Cursors that are not remembered should be skipped to.
+class ScanResumeKeys
+{
+public:
+    /// Remembers the last key returned with the cursor for the next scan.
+    void save(DBStorage::Cursor cursor, const DBKey &lastKey)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = std::find_if(entries.begin(), entries.end(), [=](const auto &e) {
+            return e.first == cursor;
+        });
+        if (it == entries.end()) {
+            if (entries.size() >= MaxEntries)
+                entries.erase(entries.begin());
+            it = entries.emplace(entries.end(), cursor, lastKey);
+        }
+        else
+            it->second = lastKey;
+    }
+
+    /// Finds the last key returned with the cursor.
+    /// @return False if the cursor is not from a recent scan.
+    bool find(DBStorage::Cursor cursor, DBKey &lastKey)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto &[entryCursor, entryKey] : entries) {
+            if (entryCursor == cursor) {
+                lastKey = entryKey;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    static constexpr size_t MaxEntries = 16;
+
+    std::mutex                                       mutex;
+    std::vector<std::pair<DBStorage::Cursor, DBKey>> entries;
 };
 
 /// The base exception class for a db storage error.
@@ -27,6 +27,9 @@
 #include <sstream>
 #include <vector>
 #ifdef MULTI_THREADING
+    #include <condition_variable>
+    #include <deque>
+    #include <mutex>
     #include <thread>
 #endif
 
@@ -101,6 +104,193 @@ void copyDatabaseBranch(DBStorage &dbSrc,
     }
 }
 
+constexpr size_t DatabaseScanBatchSize = 2000;
+constexpr char   CSVSeparator          = ',';
+
+/// Writes all fields of a record after the index column as a csv row.
+void writeCSVRow(std::ostream &csvStream, const DBKey &dbKey, const DBRecord &dbRecord)
+{
+    constexpr char Sep = CSVSeparator;
+
+    csvStream << dbKey << Sep;
+
+    if (dbRecord.isNull())
+        csvStream << "(null)";
+    else if (dbRecord.label == LABEL_NONE)
+        csvStream << "(none)";
+    else if (std::isprint(dbRecord.label) && !std::isspace(dbRecord.label))
+        csvStream << (char)dbRecord.label;
+    else
+        csvStream << '(' << (int)dbRecord.label << ')';
+
+    csvStream << Sep << dbRecord.value << Sep << dbRecord.depth() << Sep;
+
+    switch (dbRecord.bound()) {
+    case BOUND_EXACT: csvStream << "exact"; break;
+    case BOUND_LOWER: csvStream << "lower"; break;
+    case BOUND_UPPER: csvStream << "upper"; break;
+    default: csvStream << "none"; break;
+    }
+
+    std::stringstream ss;
+    ss << std::quoted(dbRecord.text);
+    std::string escapedText = ss.str();
+    // Esacpe all '\n' with "\\n" in text
+    // (\n is used to seperate different board texts and may appear in comments)
+    replaceAll(escapedText, "\n", "\\n");
+    // Esacpe all '\b' with "\\b" in text
+    // (\b is used to seperate sub-sections in the text)
+    replaceAll(escapedText, "\b", "\\b");
+    // Remove all '\0' in text that may exist due to bug in early implementation
+    replaceAll(escapedText, std::string_view {"\0", 1}, "");
+    csvStream << Sep << escapedText << '\n';
+}
+
+/// Merges a record of the source database with the record of the same key in dbDst.
+/// The merged record to write is stored back into dbRecord.
+/// @return The mask of the merged record to write, which is RECORD_MASK_ALL if the
+///     source record overwrites, or RECORD_MASK_TEXT if only texts are merged.
+DBRecordMask
+mergeRecord(DBStorage &dbDst, const DBKey &dbKey, DBRecord &dbRecord, OverwriteRule owRule)
+{
+    DBRecord oldRecord;
+    if (!dbDst.get(dbKey, oldRecord, RECORD_MASK_ALL)
+        || checkOverwrite(oldRecord, dbRecord, owRule, Config::DatabaseOverwriteExactBias, 0)) {
+        // Merge board texts.
+        dbRecord.copyBoardTextFrom(oldRecord, false);
+
+        // Merge comment if the newRecord does not have them.
+        if (!oldRecord.comment().empty() && dbRecord.comment().empty())
+            dbRecord.setComment(oldRecord.comment());
+
+        return RECORD_MASK_ALL;
+    }
+    else {
+        // Merge board texts.
+        oldRecord.copyBoardTextFrom(dbRecord, false);
+
+        // Merge comment if the oldRecord does not have them.
+        if (oldRecord.comment().empty() && !dbRecord.comment().empty())
+            oldRecord.setComment(dbRecord.comment());
+
+        dbRecord = std::move(oldRecord);
+        return RECORD_MASK_TEXT;
+    }
+}
+
+/// Returns the number of worker threads to use, where 0 means all hardware threads.
+size_t numPipelineThreads(size_t numThreads)
+{
+#ifdef MULTI_THREADING
+    return numThreads ? numThreads : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+#else
+    return 1;
+#endif
+}
+
+#ifdef MULTI_THREADING
+
+/// BatchQueue is a bounded blocking queue that passes batches of records between
+/// the stages of a database pipeline. A stage blocks when its next stage falls
+/// behind, so the memory of batches in flight is bounded.
+template <typename Batch>
+class BatchQueue
+{
+public:
+    explicit BatchQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+    /// Pushes a batch into the queue, blocking while the queue is full.
+    void push(Batch &&batch)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&] { return queue.size() < capacity; });
+        queue.push_back(std::move(batch));
+        notEmpty.notify_one();
+    }
+
+    /// Pops a batch from the queue, blocking while the queue is empty and not closed.
+    /// @return False if the queue is closed and all batches have been popped.
+    bool pop(Batch &batch)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&] { return !queue.empty() || closed; });
+        if (queue.empty())
+            return false;
+
+        batch = std::move(queue.front());
+        queue.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    /// Closes the queue after all batches are pushed.
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    std::deque<Batch>       queue;
+    std::mutex              mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    size_t                  capacity;
+    bool                    closed;
+};
+
+/// Runs a database pipeline: the calling thread scans dbSrc in batches, numWorkers
+/// threads transform the scanned batches with work(seq, scanBatch, outBatch), and a
+/// writer thread consumes the transformed batches with write(seq, outBatch).
+/// The sequence number of a batch is its order in the scan.
+template <typename OutBatch, typename Work, typename Write>
+void runDatabasePipeline(DBStorage &dbSrc, size_t numWorkers, Work &&work, Write &&write)
+{
+    using ScanBatch = std::pair<size_t, std::vector<std::pair<DBKey, DBRecord>>>;
+    using OutItem   = std::pair<size_t, OutBatch>;
+
+    BatchQueue<ScanBatch> scanQueue(2 * numWorkers);
+    BatchQueue<OutItem>   outQueue(2 * numWorkers);
+
+    std::vector<std::thread> workers;
+    workers.reserve(numWorkers);
+    for (size_t i = 0; i < numWorkers; i++) {
+        workers.emplace_back([&] {
+            ScanBatch scanBatch;
+            while (scanQueue.pop(scanBatch)) {
+                OutBatch outBatch;
+                work(scanBatch.first, scanBatch.second, outBatch);
+                outQueue.push(OutItem(scanBatch.first, std::move(outBatch)));
+            }
+        });
+    }
+
+    std::thread writer([&] {
+        OutItem outItem;
+        while (outQueue.pop(outItem))
+            write(outItem.first, outItem.second);
+    });
+
+    DBStorage::Cursor cursor {0};
+    size_t            seq = 0;
+    do {
+        ScanBatch scanBatch;
+        scanBatch.first = seq++;
+        scanBatch.second.reserve(DatabaseScanBatchSize);
+        cursor = dbSrc.scan(cursor, DatabaseScanBatchSize, scanBatch.second);
+        scanQueue.push(std::move(scanBatch));
+    } while (cursor);
+
+    scanQueue.close();
+    for (auto &th : workers)
+        th.join();
+    outQueue.close();
+    writer.join();
+}
+
+#endif
+
 }  // namespace
 
 namespace Renlib {
@@ -221,108 +411,123 @@ private:
 
 namespace Database {
 
-void databaseToCSVFile(::Database::DBStorage                               &dbStorage,
-                       std::ostream                                        &csvStream,
-                       std::function<bool(const DBKey &, const DBRecord &)> filter)
+size_t databaseToCSVFile(::Database::DBStorage                               &dbStorage,
+                         std::ostream                                        &csvStream,
+                         std::function<bool(const DBKey &, const DBRecord &)> filter,
+                         size_t                                               numThreads)
 {
-    constexpr size_t BatchSize = 2000;
-    constexpr char   Sep       = ',';
-
-    DBStorage::Cursor                       cursor {0};
-    std::vector<std::pair<DBKey, DBRecord>> dbKeyRecords;
-    dbKeyRecords.reserve(BatchSize);
+    constexpr char Sep = CSVSeparator;
 
     csvStream << "index" << Sep << "key" << Sep << "label" << Sep << "value" << Sep << "depth"
               << Sep << "bound" << Sep << "text" << '\n';
 
-    size_t            count = 0;
-    std::stringstream ss;
+    size_t count = 0;
+    numThreads   = numPipelineThreads(numThreads);
+
+#ifdef MULTI_THREADING
+    if (numThreads > 1) {
+        // Rows are formatted by workers, and written in the order of scan with indices
+        using Rows = std::vector<std::string>;
+
+        std::map<size_t, Rows> pendingRows;
+        size_t                 nextSeq = 0;
+        runDatabasePipeline<Rows>(
+            dbStorage,
+            numThreads,
+            [&](size_t seq, std::vector<std::pair<DBKey, DBRecord>> &dbKeyRecords, Rows &rows) {
+                std::ostringstream oss;
+                for (const auto &[dbKey, dbRecord] : dbKeyRecords) {
+                    if (filter && !filter(dbKey, dbRecord))
+                        continue;
+
+                    oss.str({});
+                    writeCSVRow(oss, dbKey, dbRecord);
+                    rows.push_back(oss.str());
+                }
+            },
+            [&](size_t seq, Rows &rows) {
+                pendingRows.emplace(seq, std::move(rows));
+                for (auto it = pendingRows.begin();
+                     it != pendingRows.end() && it->first == nextSeq;
+                     it = pendingRows.erase(it), nextSeq++) {
+                    for (const std::string &row : it->second)
+                        csvStream << count++ << Sep << row;
+                }
+            });
+
+        return count;
+    }
+#endif
+
+    DBStorage::Cursor                       cursor {0};
+    std::vector<std::pair<DBKey, DBRecord>> dbKeyRecords;
+    dbKeyRecords.reserve(DatabaseScanBatchSize);
     do {
         dbKeyRecords.clear();
-        cursor = dbStorage.scan(cursor, BatchSize, dbKeyRecords);
+        cursor = dbStorage.scan(cursor, DatabaseScanBatchSize, dbKeyRecords);
 
         for (const auto &[dbKey, dbRecord] : dbKeyRecords) {
             if (filter && !filter(dbKey, dbRecord))
                 continue;
 
-            csvStream << count << Sep << dbKey << Sep;
-
-            if (dbRecord.isNull())
-                csvStream << "(null)";
-            else if (dbRecord.label == LABEL_NONE)
-                csvStream << "(none)";
-            else if (std::isprint(dbRecord.label) && !std::isspace(dbRecord.label))
-                csvStream << (char)dbRecord.label;
-            else
-                csvStream << '(' << (int)dbRecord.label << ')';
-
-            csvStream << Sep << dbRecord.value << Sep << dbRecord.depth() << Sep;
-
-            switch (dbRecord.bound()) {
-            case BOUND_EXACT: csvStream << "exact"; break;
-            case BOUND_LOWER: csvStream << "lower"; break;
-            case BOUND_UPPER: csvStream << "upper"; break;
-            default: csvStream << "none"; break;
-            }
-
-            std::stringstream ss;
-            ss << std::quoted(dbRecord.text);
-            std::string escapedText = ss.str();
-            // Esacpe all '\n' with "\\n" in text
-            // (\n is used to seperate different board texts and may appear in comments)
-            replaceAll(escapedText, "\n", "\\n");
-            // Esacpe all '\b' with "\\b" in text
-            // (\b is used to seperate sub-sections in the text)
-            replaceAll(escapedText, "\b", "\\b");
-            // Remove all '\0' in text that may exist due to bug in early implementation
-            replaceAll(escapedText, std::string_view {"\0", 1}, "");
-            csvStream << Sep << escapedText << '\n';
+            csvStream << count << Sep;
+            writeCSVRow(csvStream, dbKey, dbRecord);
             count++;
         }
 
     } while (cursor);
+
+    return count;
 }
 
-size_t mergeDatabase(DBStorage &dbDst, DBStorage &dbSrc, OverwriteRule owRule)
+size_t mergeDatabase(DBStorage &dbDst, DBStorage &dbSrc, OverwriteRule owRule, size_t numThreads)
 {
-    constexpr size_t BatchSize = 2000;
+    size_t writeCount = 0;
+    numThreads        = numPipelineThreads(numThreads);
+
+#ifdef MULTI_THREADING
+    if (numThreads > 1) {
+        // Workers decide the merged records, and a single writer applies them to dbDst.
+        // Keys are unique in a scan, so a key is never decided and written concurrently.
+        struct DBWrite
+        {
+            DBKey        key;
+            DBRecord     record;
+            DBRecordMask mask;
+        };
+        using Writes = std::vector<DBWrite>;
+
+        runDatabasePipeline<Writes>(
+            dbSrc,
+            numThreads,
+            [&](size_t seq, std::vector<std::pair<DBKey, DBRecord>> &dbRecords, Writes &writes) {
+                writes.reserve(dbRecords.size());
+                for (auto &[dbKey, dbRecord] : dbRecords) {
+                    DBRecordMask mask = mergeRecord(dbDst, dbKey, dbRecord, owRule);
+                    writes.push_back({std::move(dbKey), std::move(dbRecord), mask});
+                }
+            },
+            [&](size_t seq, Writes &writes) {
+                for (const DBWrite &w : writes) {
+                    dbDst.set(w.key, w.record, w.mask);
+                    writeCount += w.mask == RECORD_MASK_ALL;
+                }
+            });
+
+        return writeCount;
+    }
+#endif
 
     DBStorage::Cursor                       cursor {0};
     std::vector<std::pair<DBKey, DBRecord>> dbRecords;
-
-    size_t   writeCount = 0;
-    DBRecord oldRecord;
     do {
         dbRecords.clear();
-        cursor = dbSrc.scan(cursor, BatchSize, dbRecords);
+        cursor = dbSrc.scan(cursor, DatabaseScanBatchSize, dbRecords);
 
         for (auto &[dbKey, dbRecord] : dbRecords) {
-            if (!dbDst.get(dbKey, oldRecord, RECORD_MASK_ALL)
-                || checkOverwrite(oldRecord,
-                                  dbRecord,
-                                  owRule,
-                                  Config::DatabaseOverwriteExactBias,
-                                  0)) {
-                // Merge board texts.
-                dbRecord.copyBoardTextFrom(oldRecord, false);
-
-                // Merge comment if the newRecord does not have them.
-                if (!oldRecord.comment().empty() && dbRecord.comment().empty())
-                    dbRecord.setComment(oldRecord.comment());
-
-                dbDst.set(dbKey, dbRecord, RECORD_MASK_ALL);
-                writeCount++;
-            }
-            else {
-                // Merge board texts.
-                oldRecord.copyBoardTextFrom(dbRecord, false);
-
-                // Merge comment if the oldRecord does not have them.
-                if (oldRecord.comment().empty() && !dbRecord.comment().empty())
-                    oldRecord.setComment(dbRecord.comment());
-
-                dbDst.set(dbKey, oldRecord, RECORD_MASK_TEXT);
-            }
+            DBRecordMask mask = mergeRecord(dbDst, dbKey, dbRecord, owRule);
+            dbDst.set(dbKey, dbRecord, mask);
+            writeCount += mask == RECORD_MASK_ALL;
         }
 
     } while (cursor);
@@ -330,28 +535,34 @@ size_t mergeDatabase(DBStorage &dbDst, DBStorage &dbSrc, OverwriteRule owRule)
     return writeCount;
 }
 
-size_t splitDatabase(DBStorage &dbSrc, DBStorage &dbDst, const Board &board, Rule rule)
+size_t splitDatabase(DBStorage   &dbSrc,
+                     DBStorage   &dbDst,
+                     const Board &board,
+                     Rule         rule,
+                     size_t       numThreads)
 {
     size_t sizeBeforeSplit = dbDst.size();
 
+    numThreads = numPipelineThreads(numThreads);
+    if (numThreads > 1) {
 #if defined(MULTI_THREADING)
-    const size_t             numDeleteThreads = std::thread::hardware_concurrency();
-    std::vector<std::thread> threads;
-    threads.reserve(numDeleteThreads);
-
-    for (int i = 0; i < numDeleteThreads; i++) {
-        threads.emplace_back(
-            [&, rule, id = i](std::unique_ptr<Board> board) {
-                copyDatabaseBranch(dbSrc, dbDst, *board, rule, id, 0);
-            },
-            std::make_unique<Board>(board, nullptr));
-    }
+        std::vector<std::thread> threads;
+        threads.reserve(numThreads);
+
+        for (int i = 0; i < int(numThreads); i++) {
+            threads.emplace_back(
+                [&, rule, id = i](std::unique_ptr<Board> board) {
+                    copyDatabaseBranch(dbSrc, dbDst, *board, rule, id, 0);
+                },
+                std::make_unique<Board>(board, nullptr));
+        }
 
-    for (auto &th : threads)
-        th.join();
-#else
-    copyDatabaseBranch(dbSrc, dbDst, const_cast<Board &>(board), rule, 0, 0);
+        for (auto &th : threads)
+            th.join();
 #endif
+    }
+    else
+        copyDatabaseBranch(dbSrc, dbDst, const_cast<Board &>(board), rule, 0, 0);
     copyDatabasePathToRoot(dbSrc, dbDst, const_cast<Board &>(board), rule);
 
     size_t sizeAfterSplit = dbDst.size();
@@ -33,17 +33,31 @@ namespace Database {
 /// Serialize all records in the database to the output stream.
 /// A filter function can be used to select records to be serialized.
 /// Only the records with the filter returning true will be serialized.
-void databaseToCSVFile(DBStorage                                           &dbStorage,
-                       std::ostream                                        &csvStream,
-                       std::function<bool(const DBKey &, const DBRecord &)> filter = nullptr);
+/// @param numThreads Number of threads to format records, 0 for all hardware threads.
+///     The filter is called concurrently if more than one thread is used.
+/// @return The number of records serialized.
+size_t databaseToCSVFile(DBStorage                                           &dbStorage,
+                         std::ostream                                        &csvStream,
+                         std::function<bool(const DBKey &, const DBRecord &)> filter     = nullptr,
+                         size_t                                               numThreads = 1);
 
 /// Merge two dbStorage from dbSrc to dbDst with the overwrite rule.
+/// @param numThreads Number of threads to decide overwrites, 0 for all hardware threads.
+///     Records are scanned and written by two extra threads when more than one is used.
 /// @return The number of records (over)written.
-size_t mergeDatabase(DBStorage &dbDst, DBStorage &dbSrc, OverwriteRule owRule);
+size_t
+mergeDatabase(DBStorage &dbDst, DBStorage &dbSrc, OverwriteRule owRule, size_t numThreads = 1);
 
 /// Split a database branch from dbSrc to dbDst.
+/// @param numThreads Number of threads to copy the branch, 0 for all hardware threads.
+///     Each thread walks the branch in a different order of children, and skips the
+///     records already copied by other threads.
 /// @return The number of records spilted to dbDst.
-size_t splitDatabase(DBStorage &dbSrc, DBStorage &dbDst, const Board &board, Rule rule);
+size_t splitDatabase(DBStorage   &dbSrc,
+                     DBStorage   &dbDst,
+                     const Board &board,
+                     Rule         rule,
+                     size_t       numThreads = 0);
 
 /// Import a lib file into the database.
 /// @return The number of records (over)written.
@@ -0,0 +1,680 @@
+/*
+ *  Rapfi, a Gomoku/Renju playing engine supporting piskvork protocol.
+ *  Copyright (C) 2022  Rapfi developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sorteddbstorage.h"
+
+#include "../core/iohelper.h"
+#include "../core/platform.h"
+#include "../core/utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+
+namespace {
+
+constexpr uint64_t BaseFileMagic   = 0x3130424453495052;  // "RPISDB01"
+constexpr uint32_t BaseFileVersion = 1;
+
+/// Serializes a database key and a record to the end of buffer.
+template <typename Key>
+void serializeRecord(std::string &buffer, const Key &key, const Database::DBRecord &record)
+{
+    uint32_t textLen = record.text.size();
+    size_t   offset  = buffer.size();
+    size_t   numKeyStoneBytes =
+        sizeof(Database::StonePos) * (key.numBlackStones + key.numWhiteStones);
+    buffer.resize(offset + 8 + numKeyStoneBytes + 9 + textLen);
+
+    char *p = buffer.data() + offset;
+    p[0]    = static_cast<char>(key.rule);
+    p[1]    = static_cast<char>(key.boardWidth);
+    p[2]    = static_cast<char>(key.boardHeight);
+    p[3]    = static_cast<char>(key.sideToMove);
+    std::memcpy(p + 4, &key.numBlackStones, sizeof(uint16_t));
+    std::memcpy(p + 6, &key.numWhiteStones, sizeof(uint16_t));
+    std::memcpy(p + 8, key.stones, numKeyStoneBytes);
+
+    p += 8 + numKeyStoneBytes;
+    p[0] = static_cast<char>(record.label);
+    std::memcpy(p + 1, &record.value, sizeof(Database::DBValue));
+    std::memcpy(p + 3, &record.depthbound, sizeof(Database::DBDepthBound));
+    std::memcpy(p + 5, &textLen, sizeof(uint32_t));
+    std::memcpy(p + 9, record.text.data(), textLen);
+}
+
+}  // namespace
+
+namespace Database {
+
+SortedDBStorage::SortedDBStorage(std::filesystem::path filePath, bool saveOnClose)
+    : filePath(filePath)
+    , saveOnClose(saveOnClose)
+    , numRecords(0)
+    , mapped(nullptr)
+    , mappedSize(0)
+    , header {}
+    , blockIndices(nullptr)
+{
+    mapBaseFile();
+    numRecords = header.numRecords;
+
+    try {
+        rebuildKeyFilter();
+    }
+    catch (const DBStorageError &) {
+        unmapBaseFile();
+        throw;
+    }
+}
+
+SortedDBStorage::~SortedDBStorage()
+{
+    if (saveOnClose)
+        flush();
+    unmapBaseFile();
+}
+
+bool SortedDBStorage::get(const DBKey &key, DBRecord &record, DBRecordMask mask) noexcept
+{
+    std::shared_lock<std::shared_mutex> readerLock(mutex);
+
+    if (auto it = delta.records.find(key); it != delta.records.end()) {
+        record.update(it->second, mask);
+        return true;
+    }
+    if (delta.deletedKeys.find(key) != delta.deletedKeys.end())
+        return false;
+
+    DBRecord baseRecord;
+    if (!findBelowDelta(key, &baseRecord))
+        return false;
+    record.update(baseRecord, mask);
+    return true;
+}
+
+void SortedDBStorage::set(const DBKey &key, const DBRecord &record, DBRecordMask mask) noexcept
+{
+    std::unique_lock<std::shared_mutex> writerLock(mutex);
+
+    if (auto it = delta.records.find(key); it != delta.records.end()) {
+        it->second.update(record, mask);
+        return;
+    }
+
+    DBRecord baseRecord;
+    if (auto it = delta.deletedKeys.find(key); it != delta.deletedKeys.end()) {
+        delta.deletedKeys.erase(it);
+        delta.records.insert(std::make_pair(key, record));
+        numRecords++;
+    }
+    else if (findBelowDelta(key, &baseRecord)) {
+        baseRecord.update(record, mask);
+        delta.records.insert(std::make_pair(key, std::move(baseRecord)));
+    }
+    else {
+        delta.records.insert(std::make_pair(key, record));
+        numRecords++;
+        insertKeyFilter(key);
+    }
+}
+
+void SortedDBStorage::del(const DBKey &key) noexcept
+{
+    std::unique_lock<std::shared_mutex> writerLock(mutex);
+
+    if (auto it = delta.records.find(key); it != delta.records.end()) {
+        delta.records.erase(it);
+        numRecords--;
+        if (findBelowDelta(key, nullptr))
+            delta.deletedKeys.emplace(key);
+    }
+    else if (delta.deletedKeys.find(key) == delta.deletedKeys.end()
+             && findBelowDelta(key, nullptr)) {
+        delta.deletedKeys.emplace(key);
+        numRecords--;
+    }
+}
+
+bool SortedDBStorage::flush() noexcept
+{
+    std::lock_guard<std::mutex> flushLock(flushMutex);
+
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+
+        if (delta.empty() && std::filesystem::exists(filePath))
+            return true;
+
+        // Freeze current delta for writing, and put new changes in an empty delta on top
+        std::swap(delta, flushingDelta);
+    }
+
+    MESSAGEL("DATABASE SAVE START " + pathToConsoleString(filePath));
+
+    std::filesystem::path tempFilePath = filePath;
+    tempFilePath += ".tmp";
+
+    // Base file and the flushing delta are only changed under flushMutex, so the new base
+    // file can be written without holding the lock.
+    std::error_code ec;
+    bool            success = writeBaseFile(tempFilePath);
+    if (!success) {
+        ERRORL("Failed to write sorted database file at " + pathToConsoleString(tempFilePath));
+        std::filesystem::remove(tempFilePath, ec);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+
+    // Replace the base file with the compacted one and map it again
+    if (success) {
+        unmapBaseFile();
+        std::filesystem::rename(tempFilePath, filePath, ec);
+        if (ec) {
+            ERRORL("Failed to replace sorted database file at " + pathToConsoleString(filePath));
+            std::filesystem::remove(tempFilePath, ec);
+            success = false;
+        }
+    }
+
+    // Map the new base file, or the old one again if it is not replaced
+    try {
+        if (!mapped)
+            mapBaseFile();
+    }
+    catch (const DBStorageError &e) {
+        ERRORL(e.what());
+        success = false;
+    }
+
+    // Changes in the flushing delta are now in base file, or have to be kept in memory
+    if (success) {
+        flushingDelta = {};
+        MESSAGEL("DATABASE SAVE DONE");
+    }
+    else
+        mergeFlushingDelta();
+    return success;
+}
+
+size_t SortedDBStorage::size() noexcept
+{
+    std::shared_lock<std::shared_mutex> readerLock(mutex);
+    return numRecords;
+}
+
+SortedDBStorage::Cursor SortedDBStorage::scan(Cursor                                   cursor,
+                                              size_t                                   count,
+                                              std::vector<std::pair<DBKey, DBRecord>> &out) noexcept
+{
+    std::shared_lock<std::shared_mutex> readerLock(mutex);
+
+    // Resume after the last key of the previous scan, or skip to cursor from the beginning
+    DBKey  lastKey;
+    bool   resumed    = cursor && scanResumeKeys.find(cursor, lastKey);
+    size_t numScanned = 0;
+
+    auto scanRecord = [&](const auto &key, const DBRecord &record) {
+        if (numScanned == count)
+            return false;
+
+        DBKey dbKey;
+        dbKey.rule           = key.rule;
+        dbKey.boardWidth     = key.boardWidth;
+        dbKey.boardHeight    = key.boardHeight;
+        dbKey.sideToMove     = key.sideToMove;
+        dbKey.numBlackStones = key.numBlackStones;
+        dbKey.numWhiteStones = key.numWhiteStones;
+        std::copy(key.stones, key.stones + key.numBlackStones + key.numWhiteStones, dbKey.stones);
+        out.emplace_back(dbKey, record);
+        numScanned++;
+        return true;
+    };
+
+    try {
+        Cursor nextCursor =
+            iterate(cursor, resumed ? &lastKey : nullptr, delta, flushingDelta, scanRecord);
+        if (nextCursor && numScanned > 0)
+            scanResumeKeys.save(nextCursor, out.back().first);
+        return nextCursor;
+    }
+    catch (const DBStorageError &e) {
+        ERRORL(e.what());
+        return 0;
+    }
+}
+
+bool SortedDBStorage::mayContain(HashKey canonicalKey) noexcept
+{
+    return keyFilter.mayContain(canonicalKey);
+}
+
+const BlockedBloomFilter *SortedDBStorage::lookupFilter() noexcept
+{
+    return keyFilter.get();
+}
+
+void SortedDBStorage::mapBaseFile()
+{
+    mapped       = nullptr;
+    mappedSize   = 0;
+    header       = {};
+    blockIndices = nullptr;
+
+    if (!std::filesystem::exists(filePath))
+        return;
+
+    mapped = static_cast<char *>(MemAlloc::mapFile(filePath, mappedSize));
+    if (!mapped)
+        throw DBStorageError("Failed to map sorted database file at "
+                             + pathToConsoleString(filePath));
+
+    if (mappedSize >= sizeof(BaseHeader))
+        std::memcpy(&header, mapped, sizeof(BaseHeader));
+
+    bool valid = mappedSize >= sizeof(BaseHeader) && header.magic == BaseFileMagic
+                 && header.version == BaseFileVersion && header.blockSize == BlockSize
+                 && header.indexOffset % alignof(BlockIndex) == 0
+                 && header.indexOffset <= mappedSize
+                 && (mappedSize - header.indexOffset) / sizeof(BlockIndex) > header.numBlocks
+                 && (header.numBlocks > 0 || header.numRecords == 0);
+
+    // Blocks must be in order after the header and each hold at least one record, and the
+    // sentinel entry must end the last block at the index, so that every block is in the file.
+    if (valid) {
+        blockIndices = reinterpret_cast<const BlockIndex *>(mapped + header.indexOffset);
+        valid        = blockIndices[header.numBlocks].offset == header.indexOffset
+                && blockIndices[header.numBlocks].firstRecordIndex == header.numRecords;
+        for (uint64_t i = 0; valid && i < header.numBlocks; i++) {
+            const BlockIndex &block = blockIndices[i];
+            const BlockIndex &next  = blockIndices[i + 1];
+            valid = block.offset >= BlockSize && block.offset % BlockSize == 0
+                    && block.offset < next.offset
+                    && block.firstRecordIndex < next.firstRecordIndex;
+        }
+        valid = valid && (header.numBlocks == 0 || blockIndices[0].firstRecordIndex == 0);
+    }
+
+    if (!valid) {
+        unmapBaseFile();
+        throw DBStorageError("Invalid sorted database file at " + pathToConsoleString(filePath));
+    }
+}
+
+void SortedDBStorage::unmapBaseFile() noexcept
+{
+    if (mapped)
+        MemAlloc::unmapFile(mapped, mappedSize);
+
+    mapped       = nullptr;
+    mappedSize   = 0;
+    header       = {};
+    blockIndices = nullptr;
+}
+
+uint64_t SortedDBStorage::findBaseBlock(const DBKey &key) const
+{
+    // Binary search for the last block whose first key is not greater than the key
+    uint64_t lo = 0, hi = header.numBlocks;
+    while (lo < hi) {
+        uint64_t     mid = (lo + hi) / 2;
+        BaseIterator it {mid, blockIndices[mid].firstRecordIndex, mapped + blockIndices[mid].offset};
+        BaseKey      firstKey;
+        readBaseRecord(it, firstKey, nullptr);
+        if (databaseKeyCompare(key, firstKey) < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo == 0 ? header.numBlocks : lo - 1;
+}
+
+bool SortedDBStorage::findBelowDelta(const DBKey &key, DBRecord *record) const
+{
+    if (auto it = flushingDelta.records.find(key); it != flushingDelta.records.end()) {
+        if (record)
+            *record = it->second;
+        return true;
+    }
+    if (flushingDelta.deletedKeys.find(key) != flushingDelta.deletedKeys.end())
+        return false;
+
+    return findInBase(key, record);
+}
+
+bool SortedDBStorage::findInBase(const DBKey &key, DBRecord *record) const
+{
+    uint64_t blockIndex = findBaseBlock(key);
+    if (blockIndex == header.numBlocks)
+        return false;
+
+    // Scan records in the block linearly
+    uint64_t     blockEnd = blockIndices[blockIndex + 1].firstRecordIndex;
+    BaseIterator it {blockIndex,
+                     blockIndices[blockIndex].firstRecordIndex,
+                     mapped + blockIndices[blockIndex].offset};
+    while (it.recordIndex < blockEnd) {
+        BaseIterator recordIt = it;
+        BaseKey      baseKey;
+        readBaseRecord(it, baseKey, nullptr);
+
+        int cmp = databaseKeyCompare(key, baseKey);
+        if (cmp < 0)
+            break;
+        else if (cmp == 0) {
+            if (record)
+                readBaseRecord(recordIt, baseKey, record);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+SortedDBStorage::BaseIterator SortedDBStorage::baseIteratorAfter(const DBKey &key) const
+{
+    uint64_t blockIndex = findBaseBlock(key);
+    if (blockIndex == header.numBlocks)
+        return baseIteratorAt(0);
+
+    // Skip records in the block that are not greater than the key
+    uint64_t     blockEnd = blockIndices[blockIndex + 1].firstRecordIndex;
+    BaseIterator it {blockIndex,
+                     blockIndices[blockIndex].firstRecordIndex,
+                     mapped + blockIndices[blockIndex].offset};
+    while (it.recordIndex < blockEnd) {
+        BaseIterator recordIt = it;
+        BaseKey      baseKey;
+        readBaseRecord(it, baseKey, nullptr);
+        if (databaseKeyCompare(key, baseKey) < 0)
+            return recordIt;
+    }
+    return baseIteratorAt(it.recordIndex);
+}
+
+SortedDBStorage::BaseIterator SortedDBStorage::baseIteratorAt(uint64_t recordIndex) const
+{
+    if (recordIndex >= header.numRecords)
+        return {header.numBlocks, header.numRecords, nullptr};
+
+    // Find the block containing the record, and skip records before it in the block
+    const BlockIndex *block = std::upper_bound(blockIndices,
+                                               blockIndices + header.numBlocks,
+                                               recordIndex,
+                                               [](uint64_t index, const BlockIndex &b) {
+                                                   return index < b.firstRecordIndex;
+                                               })
+                              - 1;
+    BaseIterator it {uint64_t(block - blockIndices), block->firstRecordIndex, mapped + block->offset};
+    BaseKey      key;
+    while (it.recordIndex < recordIndex)
+        readBaseRecord(it, key, nullptr);
+    return it;
+}
+
+void SortedDBStorage::readBaseRecord(BaseIterator &it, BaseKey &key, DBRecord *record) const
+{
+    const char *p        = it.ptr;
+    const char *blockEnd = mapped + blockIndices[it.blockIndex + 1].offset;
+    auto        checkRecordSize = [&](size_t size) {
+        if (size_t(blockEnd - it.ptr) < size)
+            throw DBStorageCorruptedRecordError(pathToConsoleString(filePath),
+                                                "record " + std::to_string(it.recordIndex)
+                                                    + " exceeds its block");
+    };
+
+    checkRecordSize(8);
+    key.rule        = static_cast<Rule>(p[0]);
+    key.boardWidth  = static_cast<int8_t>(p[1]);
+    key.boardHeight = static_cast<int8_t>(p[2]);
+    key.sideToMove  = static_cast<Color>(p[3]);
+    std::memcpy(&key.numBlackStones, p + 4, sizeof(uint16_t));
+    std::memcpy(&key.numWhiteStones, p + 6, sizeof(uint16_t));
+    key.stones = reinterpret_cast<const StonePos *>(p + 8);
+    p += 8 + sizeof(StonePos) * (key.numBlackStones + key.numWhiteStones);
+
+    uint32_t textLen;
+    checkRecordSize(p - it.ptr + 9);
+    std::memcpy(&textLen, p + 5, sizeof(uint32_t));
+    checkRecordSize(p - it.ptr + 9 + size_t(textLen));
+    if (record) {
+        record->label = static_cast<DBLabel>(p[0]);
+        std::memcpy(&record->value, p + 1, sizeof(DBValue));
+        std::memcpy(&record->depthbound, p + 3, sizeof(DBDepthBound));
+        record->text.assign(p + 9, textLen);
+    }
+    p += 9 + textLen;
+
+    // Move to the next block if we reach the end of current block
+    it.recordIndex++;
+    if (it.recordIndex == blockIndices[it.blockIndex + 1].firstRecordIndex) {
+        it.blockIndex++;
+        it.ptr = mapped + blockIndices[it.blockIndex].offset;
+    }
+    else
+        it.ptr = p;
+}
+
+template <typename F>
+SortedDBStorage::Cursor SortedDBStorage::iterate(Cursor            cursor,
+                                                 const DBKey      *lastKey,
+                                                 const DeltaLayer &upper,
+                                                 const DeltaLayer &lower,
+                                                 F               &&f) const
+{
+    // Seek directly after the last key if given, or in base file if there is no delta,
+    // otherwise skip from the beginning
+    bool         hasDelta  = !upper.empty() || !lower.empty();
+    Cursor       position  = lastKey    ? cursor
+                             : hasDelta ? 0
+                                        : std::min<Cursor>(cursor, header.numRecords);
+    BaseIterator baseIt    = lastKey ? baseIteratorAfter(*lastKey) : baseIteratorAt(position);
+    auto         upperIt   = lastKey ? upper.records.upper_bound(*lastKey) : upper.records.begin();
+    auto         lowerIt   = lastKey ? lower.records.upper_bound(*lastKey) : lower.records.begin();
+    auto         upperDeletedIt = lastKey ? upper.deletedKeys.upper_bound(*lastKey)
+                                          : upper.deletedKeys.begin();
+    auto         lowerDeletedIt = lastKey ? lower.deletedKeys.upper_bound(*lastKey)
+                                          : lower.deletedKeys.begin();
+    bool         hasBaseRecord = false;
+    BaseKey      baseKey;
+    DBRecord     baseRecord;
+
+    // Checks if a key is deleted in a layer. Keys are checked in increasing order,
+    // so the iterator of deleted keys only moves forward.
+    auto isDeleted = [](auto &deletedIt, const auto &deletedKeys, const auto &key) {
+        while (deletedIt != deletedKeys.end() && databaseKeyCompare(*deletedIt, key) < 0)
+            deletedIt++;
+        return deletedIt != deletedKeys.end() && databaseKeyCompare(*deletedIt, key) == 0;
+    };
+
+    for (;;) {
+        if (!hasBaseRecord && baseIt.recordIndex < header.numRecords) {
+            readBaseRecord(baseIt, baseKey, &baseRecord);
+            hasBaseRecord = true;
+        }
+
+        // Upper delta record overrides the lower delta record with the same key
+        bool hasUpperRecord = upperIt != upper.records.end();
+        bool hasLowerRecord = lowerIt != lower.records.end();
+        int  cmpDelta       = !hasLowerRecord   ? 1
+                              : !hasUpperRecord ? -1
+                                                : databaseKeyCompare(lowerIt->first, upperIt->first);
+        bool fromUpper      = hasUpperRecord && cmpDelta >= 0;
+        auto deltaIt        = fromUpper ? upperIt : lowerIt;
+        if (!hasBaseRecord && !hasUpperRecord && !hasLowerRecord)
+            return 0;
+
+        int cmp = !hasBaseRecord                        ? 1
+                  : !hasUpperRecord && !hasLowerRecord ? -1
+                                                        : databaseKeyCompare(baseKey, deltaIt->first);
+        if (cmp < 0) {
+            hasBaseRecord = false;
+
+            // Skip base records that have been deleted
+            if (isDeleted(upperDeletedIt, upper.deletedKeys, baseKey)
+                || isDeleted(lowerDeletedIt, lower.deletedKeys, baseKey))
+                continue;
+
+            if (position >= cursor && !f(baseKey, baseRecord))
+                return position;
+        }
+        else {
+            // Delta record overrides the base record with the same key
+            if (cmp == 0)
+                hasBaseRecord = false;
+
+            if (fromUpper) {
+                upperIt++;
+                if (cmpDelta == 0)
+                    lowerIt++;
+            }
+            else {
+                lowerIt++;
+                // Skip lower delta records that have been deleted in the upper delta
+                if (isDeleted(upperDeletedIt, upper.deletedKeys, deltaIt->first))
+                    continue;
+            }
+
+            if (position >= cursor && !f(deltaIt->first, deltaIt->second))
+                return position;
+        }
+
+        position++;
+    }
+}
+
+bool SortedDBStorage::writeBaseFile(const std::filesystem::path &path) const noexcept
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        return false;
+
+    // Reserve the first block for header, which is written at last
+    const std::string       padding(BlockSize, '\0');
+    std::vector<BlockIndex> indices;
+    std::string             buffer;
+    uint64_t                offset     = BlockSize;
+    uint64_t                blockUsed  = 0;
+    uint64_t                numWritten = 0;
+    file.write(padding.data(), BlockSize);
+
+    auto writeRecord = [&](const auto &key, const DBRecord &record) {
+        buffer.clear();
+        serializeRecord(buffer, key, record);
+
+        // Start a new block at aligned offset if the record does not fit in current block
+        if (indices.empty() || blockUsed + buffer.size() > BlockSize) {
+            uint64_t alignedOffset = (offset + BlockSize - 1) / BlockSize * BlockSize;
+            file.write(padding.data(), alignedOffset - offset);
+            offset    = alignedOffset;
+            blockUsed = 0;
+            indices.push_back({offset, numWritten});
+        }
+
+        file.write(buffer.data(), buffer.size());
+        offset += buffer.size();
+        blockUsed += buffer.size();
+        numWritten++;
+        return true;
+    };
+
+    try {
+        static const DeltaLayer EmptyDelta;
+        iterate(0, nullptr, EmptyDelta, flushingDelta, writeRecord);
+    }
+    catch (const DBStorageError &e) {
+        ERRORL(e.what());
+        return false;
+    }
+
+    // Write block index with a sentinel entry after all records
+    uint64_t indexOffset = (offset + alignof(BlockIndex) - 1) / alignof(BlockIndex)
+                           * alignof(BlockIndex);
+    file.write(padding.data(), indexOffset - offset);
+    indices.push_back({indexOffset, numWritten});
+    file.write(reinterpret_cast<const char *>(indices.data()),
+               indices.size() * sizeof(BlockIndex));
+
+    BaseHeader newHeader {BaseFileMagic,
+                          BaseFileVersion,
+                          BlockSize,
+                          numWritten,
+                          indices.size() - 1,
+                          indexOffset};
+    file.seekp(0);
+    file.write(reinterpret_cast<const char *>(&newHeader), sizeof(BaseHeader));
+    file.close();
+    return bool(file);
+}
+
+void SortedDBStorage::mergeFlushingDelta()
+{
+    while (!flushingDelta.records.empty()) {
+        auto node = flushingDelta.records.extract(flushingDelta.records.begin());
+        if (delta.records.find(node.key()) != delta.records.end())
+            continue;
+
+        // A record deleted from the flushing delta only stays deleted if it is in base file
+        if (auto it = delta.deletedKeys.find(node.key()); it != delta.deletedKeys.end()) {
+            if (!findInBase(DBKey(node.key()), nullptr))
+                delta.deletedKeys.erase(it);
+            continue;
+        }
+
+        delta.records.insert(std::move(node));
+    }
+
+    while (!flushingDelta.deletedKeys.empty()) {
+        auto node = flushingDelta.deletedKeys.extract(flushingDelta.deletedKeys.begin());
+        if (delta.records.find(node.value()) == delta.records.end())
+            delta.deletedKeys.insert(std::move(node));
+    }
+}
+
+void SortedDBStorage::insertKeyFilter(const DBKey &key) noexcept
+{
+    if (keyFilter.insert(key))
+        return;
+
+    try {
+        rebuildKeyFilter();
+    }
+    catch (const DBStorageError &e) {
+        // Current filter still contains all keys, so it can be kept
+        ERRORL(e.what());
+    }
+}
+
+void SortedDBStorage::rebuildKeyFilter()
+{
+    keyFilter.rebuild(numRecords, [&](auto &&insert) {
+        BaseIterator it = baseIteratorAt(0);
+        while (it.recordIndex < header.numRecords) {
+            BaseKey key;
+            readBaseRecord(it, key, nullptr);
+            insert(key);
+        }
+        for (const auto &[key, record] : flushingDelta.records)
+            insert(key);
+        for (const auto &[key, record] : delta.records)
+            insert(key);
+    });
+}
+
+}  // namespace Database
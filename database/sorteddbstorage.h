@@ -0,0 +1,183 @@
+/*
+ *  Rapfi, a Gomoku/Renju playing engine supporting piskvork protocol.
+ *  Copyright (C) 2022  Rapfi developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "dbfilter.h"
+#include "dbstorage.h"
+#include "yxdbstorage.h"
+
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+
+namespace Database {
+
+/// SortedDBStorage implements DBStorage interface with an immutable base file of records
+/// sorted by key, plus an in-memory delta of changed records. The base file is memory mapped
+/// and binary searched, so records are not parsed into memory. Keys are only read once at
+/// opening to build the lookup filter, which also checks every record is within the file.
+/// Flushing compacts the delta and base file into a new base file. The delta is frozen while
+/// the new file is written without holding the lock, and changes made meanwhile go to a new
+/// delta on top of it, so readers and writers are only blocked when the new file is swapped in.
+///
+/// Base file layout (native byte order):
+///     1. Header of the file (see BaseHeader).
+///     2. Blocks of records starting at BlockSize aligned offsets. Records in one block
+///        are packed together, and a record only exceeds a block when it is the first one.
+///     3. Index of blocks (see BlockIndex), with an extra sentinel entry at the end.
+class SortedDBStorage : public DBStorage
+{
+public:
+    /// Creates a sorted database storage instance by mapping the base file.
+    /// If the file does not exist, it will be created on the first flush.
+    /// @param filePath The path of the base file.
+    /// @param saveOnClose Whether to compact changed records into base file when closed.
+    /// @note Throws DBStorageError if failed to map the file or the file is invalid.
+    SortedDBStorage(std::filesystem::path filePath, bool saveOnClose);
+    /// Close the sorted database. All unsaved records will be flushed if saveOnClose is set.
+    virtual ~SortedDBStorage();
+
+    /// Returns the current file path.
+    std::filesystem::path getOpenedFilePath() const { return filePath; }
+
+    // -------------------------------------------------------------------
+    // Implements the DBStorage interface
+    bool   get(const DBKey &key, DBRecord &record, DBRecordMask mask) noexcept override;
+    void   set(const DBKey &key, const DBRecord &record, DBRecordMask mask) noexcept override;
+    void   del(const DBKey &key) noexcept override;
+    bool   flush() noexcept override;
+    size_t size() noexcept override;
+    Cursor scan(Cursor                                   cursor,
+                size_t                                   count,
+                std::vector<std::pair<DBKey, DBRecord>> &out) noexcept override;
+    // -------------------------------------------------------------------
+
+    /// Rejects lookups of missing positions with a Bloom filter of all keys,
+    /// which is built on opening and updated on adding new keys.
+    bool                      mayContain(HashKey canonicalKey) noexcept override;
+    const BlockedBloomFilter *lookupFilter() noexcept override;
+
+    /// Size of blocks in base file, which is also the alignment of blocks.
+    static constexpr size_t BlockSize = 4096;
+
+private:
+    struct BaseHeader
+    {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t blockSize;
+        uint64_t numRecords;
+        uint64_t numBlocks;
+        uint64_t indexOffset;
+    };
+
+    struct BlockIndex
+    {
+        uint64_t offset;            // Offset of the block in base file
+        uint64_t firstRecordIndex;  // Index of the first record in the block
+    };
+
+    /// BaseKey is a view of a database key stored in the mapped base file.
+    struct BaseKey
+    {
+        Rule            rule;
+        int8_t          boardWidth;
+        int8_t          boardHeight;
+        Color           sideToMove;
+        uint16_t        numBlackStones;
+        uint16_t        numWhiteStones;
+        const StonePos *stones;
+    };
+
+    /// BaseIterator iterates records in base file in the order of keys.
+    struct BaseIterator
+    {
+        uint64_t    blockIndex;
+        uint64_t    recordIndex;
+        const char *ptr;
+    };
+
+    using RecordsMap = std::map<CompactDBKey, DBRecord, CompactDBKeyCmp>;
+
+    /// DeltaLayer is a layer of changes on top of the layers below it.
+    struct DeltaLayer
+    {
+        RecordsMap                              records;      // Changed records
+        std::set<CompactDBKey, CompactDBKeyCmp> deletedKeys;  // Records deleted from below
+
+        bool empty() const { return records.empty() && deletedKeys.empty(); }
+    };
+
+    std::filesystem::path filePath;
+    DeltaLayer            delta;          // Changes since last flush
+    DeltaLayer            flushingDelta;  // Changes being compacted by the flush in progress
+    DBKeyFilter           keyFilter;      // Filter of all keys ever stored
+    ScanResumeKeys        scanResumeKeys;
+    std::shared_mutex     mutex;
+    std::mutex            flushMutex;
+    bool                  saveOnClose;
+    size_t                numRecords;
+
+    char             *mapped;
+    size_t            mappedSize;
+    BaseHeader        header;
+    const BlockIndex *blockIndices;
+
+    /// Maps the base file, or resets to an empty base if the file does not exist.
+    void mapBaseFile();
+    /// Unmaps the base file.
+    void unmapBaseFile() noexcept;
+    /// Returns the last block whose first key is not greater than the key, or the number
+    /// of blocks if the key is less than all keys in base file.
+    uint64_t findBaseBlock(const DBKey &key) const;
+    /// Finds the record of the key in base file, regardless of the deleted keys.
+    bool findInBase(const DBKey &key, DBRecord *record) const;
+    /// Finds the record of the key in the flushing delta and base file below current delta.
+    bool findBelowDelta(const DBKey &key, DBRecord *record) const;
+    /// Returns an iterator pointing to the record at index in base file.
+    BaseIterator baseIteratorAt(uint64_t recordIndex) const;
+    /// Returns an iterator pointing to the first record greater than the key in base file.
+    BaseIterator baseIteratorAfter(const DBKey &key) const;
+    /// Reads the record at the iterator and advances the iterator.
+    /// @note Throws DBStorageCorruptedRecordError if the record exceeds its block.
+    void readBaseRecord(BaseIterator &it, BaseKey &key, DBRecord *record) const;
+    /// Iterates base file and two delta layers from the record at cursor in the order of
+    /// keys, and calls f(key, record) for each alive record until it returns false.
+    /// @param lastKey If not null, the record at cursor is the first one after lastKey.
+    /// @param upper The delta layer on top of the lower one.
+    /// @return The cursor of the record that f returns false, or 0 if reaches the end.
+    template <typename F>
+    Cursor iterate(Cursor            cursor,
+                   const DBKey      *lastKey,
+                   const DeltaLayer &upper,
+                   const DeltaLayer &lower,
+                   F               &&f) const;
+    /// Writes all alive records of base file and the flushing delta to a new base file.
+    bool writeBaseFile(const std::filesystem::path &path) const noexcept;
+    /// Merges the flushing delta back under current delta after a failed flush.
+    void mergeFlushingDelta();
+    /// Inserts a new key into the key filter, and rebuilds the filter if it is full.
+    void insertKeyFilter(const DBKey &key) noexcept;
+    /// Rebuilds the key filter from base file and delta layers.
+    void rebuildKeyFilter();
+};
+
+}  // namespace Database
@@ -22,9 +22,33 @@
 #include "../core/utils.h"
 #include "dbtypes.h"
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <mutex>
 #include <string>
+#include <system_error>
+
+namespace {
+
+/// Operations recorded in write-ahead log entries.
+enum WALOperation : uint8_t { WAL_SET = 1, WAL_DEL = 2 };
+
+/// Size of the header (payload size and checksum) of a write-ahead log entry.
+constexpr size_t WALEntryHeaderSize = 2 * sizeof(uint32_t);
+/// Minimal write-ahead log size to start a checkpoint on flush.
+constexpr uint64_t MinCheckpointWALSize = 16 << 20;
+
+/// FNV-1a hash as the checksum of a write-ahead log entry.
+uint32_t walChecksum(const char *data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ static_cast<uint8_t>(data[i])) * 16777619u;
+    return hash;
+}
+
+}  // namespace
 
 namespace Database {
 
@@ -62,52 +86,87 @@ YXDBStorage::YXDBStorage(std::filesystem::path filePath,
                          bool                  compressedSave,
                          bool                  saveOnClose,
                          int                   numBackupsOnSave,
-                         bool                  ignoreCorrupted)
+                         bool                  ignoreCorrupted,
+                         bool                  writeAheadLog)
     : filePath(filePath)
+    , walFilePath(std::filesystem::path(filePath) += ".wal")
+    , checkpointWALFilePath(std::filesystem::path(filePath) += ".wal.ckpt")
+    , walSize(0)
+    , checkpointWALSize(MinCheckpointWALSize)
     , numBackupsOnSave(numBackupsOnSave)
     , compressedSave(compressedSave)
     , saveOnClose(saveOnClose)
+    , writeAheadLog(writeAheadLog)
     , dirty(false)
+    , snapshotting(false)
 {
-    if (!std::filesystem::exists(filePath))
-        return;
+    if (std::filesystem::exists(filePath)) {
+        std::ifstream file(filePath, std::ios::binary);
+        if (!file.is_open() || !file)
+            throw DBStorageError("Failed to open YXDB file at " + pathToConsoleString(filePath));
+
+        MESSAGEL("DATABASE LOAD START " + pathToConsoleString(filePath));
+
+        // Check LZ4 file magic to choose a compress type
+        int magic;
+        file.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+        file.seekg(0);
+
+        {
+            Compressor    compressor(static_cast<std::istream &>(file),
+                                  magic == 0x184D2204 ? Compressor::Type::LZ4_DEFAULT
+                                                         : Compressor::Type::NO_COMPRESS);
+            std::istream *istreamPtr = compressor.openInputStream();
+            if (!istreamPtr || !*istreamPtr)
+                throw DBStorageError("Failed to open LZ4 compressed YXDB file "
+                                     + pathToConsoleString(filePath));
+
+            load(*istreamPtr, ignoreCorrupted);
+        }
 
-    std::ifstream file(filePath, std::ios::binary);
-    if (!file.is_open() || !file)
-        throw DBStorageError("Failed to open YXDB file at " + pathToConsoleString(filePath));
+        MESSAGEL("DATABASE LOAD DONE");
 
-    MESSAGEL("DATABASE LOAD START " + pathToConsoleString(filePath));
+        std::error_code ec;
+        checkpointWALSize = std::max<uint64_t>(checkpointWALSize,
+                                               std::filesystem::file_size(filePath, ec));
+    }
 
-    // Check LZ4 file magic to choose a compress type
-    int magic;
-    file.read(reinterpret_cast<char *>(&magic), sizeof(magic));
-    file.seekg(0);
+    // Replay changes not yet checkpointed into the database file, including the ones
+    // from an unfinished checkpoint, which are older than the ones in current log.
+    if (std::filesystem::exists(checkpointWALFilePath))
+        replayWAL(checkpointWALFilePath);
+    if (std::filesystem::exists(walFilePath))
+        replayWAL(walFilePath);
 
-    {
-        Compressor    compressor(static_cast<std::istream &>(file),
-                              magic == 0x184D2204 ? Compressor::Type::LZ4_DEFAULT
-                                                     : Compressor::Type::NO_COMPRESS);
-        std::istream *istreamPtr = compressor.openInputStream();
-        if (!istreamPtr || !*istreamPtr)
-            throw DBStorageError("Failed to open LZ4 compressed YXDB file "
-                                 + pathToConsoleString(filePath));
-
-        load(*istreamPtr, ignoreCorrupted);
-    }
+    if (writeAheadLog && !openWAL())
+        throw DBStorageError("Failed to open YXDB write-ahead log at "
+                             + pathToConsoleString(walFilePath));
 
-    MESSAGEL("DATABASE LOAD DONE");
+    rebuildKeyFilter();
 }
 
 YXDBStorage::~YXDBStorage()
 {
     if (saveOnClose)
-        flush();
+        flushRecords(true);
+
+    std::lock_guard<std::mutex> flushLock(flushMutex);
+    waitForFlush();
 }
 
 bool YXDBStorage::get(const DBKey &key, DBRecord &record, DBRecordMask mask) noexcept
 {
     std::shared_lock<std::shared_mutex> readerLock(mutex);
 
+    if (snapshotting) {
+        if (deletedKeys.find(key) != deletedKeys.end())
+            return false;
+        if (auto it = pendingMap.find(key); it != pendingMap.end()) {
+            record.update(it->second, mask);
+            return true;
+        }
+    }
+
     if (auto it = recordsMap.find(key); it != recordsMap.end()) {
         record.update(it->second, mask);
         return true;
@@ -119,31 +178,187 @@ bool YXDBStorage::get(const DBKey &key, DBRecord &record, DBRecordMask mask) noe
 void YXDBStorage::set(const DBKey &key, const DBRecord &record, DBRecordMask mask) noexcept
 {
     std::unique_lock<std::shared_mutex> writerLock(mutex);
+    dirty = true;
 
-    if (auto it = recordsMap.find(key); it != recordsMap.end())
-        it->second.update(record, mask);
-    else
-        recordsMap.insert(std::make_pair(key, record));
+    if (snapshotting) {
+        // Records map is being written, so put the updated record in the overlay
+        if (auto it = pendingMap.find(key); it != pendingMap.end())
+            it->second.update(record, mask);
+        else if (auto it = deletedKeys.find(key); it != deletedKeys.end()) {
+            deletedKeys.erase(it);
+            pendingMap.insert(std::make_pair(key, record));
+        }
+        else if (auto it = recordsMap.find(key); it != recordsMap.end()) {
+            DBRecord newRecord = it->second;
+            newRecord.update(record, mask);
+            pendingMap.insert(std::make_pair(key, newRecord));
+        }
+        else {
+            pendingMap.insert(std::make_pair(key, record));
+            insertKeyFilter(key);
+        }
+        appendWAL(key, &pendingMap.find(key)->second);
+        return;
+    }
 
-    dirty = true;
+    auto it = recordsMap.find(key);
+    if (it != recordsMap.end())
+        it->second.update(record, mask);
+    else {
+        it = recordsMap.insert(std::make_pair(key, record)).first;
+        insertKeyFilter(key);
+    }
+    appendWAL(key, &it->second);
 }
 
 void YXDBStorage::del(const DBKey &key) noexcept
 {
     std::unique_lock<std::shared_mutex> writerLock(mutex);
 
+    if (snapshotting) {
+        // Records map is being written, so mark the record as deleted in the overlay
+        bool deleted = false;
+        if (auto it = pendingMap.find(key); it != pendingMap.end()) {
+            pendingMap.erase(it);
+            deleted = true;
+        }
+        if (deletedKeys.find(key) == deletedKeys.end()
+            && recordsMap.find(key) != recordsMap.end()) {
+            deletedKeys.emplace(key);
+            deleted = true;
+        }
+        if (deleted) {
+            dirty = true;
+            appendWAL(key, nullptr);
+        }
+        return;
+    }
+
     if (auto it = recordsMap.find(key); it != recordsMap.end()) {
         recordsMap.erase(it);
         dirty = true;
+        appendWAL(key, nullptr);
     }
 }
 
 bool YXDBStorage::flush() noexcept
 {
-    std::unique_lock<std::shared_mutex> lock(mutex);
+    return flushRecords(false);
+}
+
+bool YXDBStorage::flushRecords(bool forceCheckpoint) noexcept
+{
+    std::lock_guard<std::mutex> flushLock(flushMutex);
+    waitForFlush();
 
-    if (!dirty && std::filesystem::exists(filePath))
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+
+        if (walFile.is_open()) {
+            if (!walFile.flush())
+                ERRORL("Failed to write YXDB write-ahead log at "
+                       + pathToConsoleString(walFilePath));
+            // Changes are already persisted in the log, unless they are made before the
+            // log is opened, so only checkpoint when the log has grown large enough.
+            else if (!forceCheckpoint && walSize > 0 && walSize < checkpointWALSize)
+                return true;
+        }
+
+        if (!dirty && std::filesystem::exists(filePath))
+            return true;
+
+        // Take a snapshot by freezing the records map until it is written
+        dirty        = false;
+        snapshotting = true;
+        rotateWAL();
+    }
+
+#ifdef MULTI_THREADING
+    try {
+        flushThread = std::thread(&YXDBStorage::writeSnapshot, this);
         return true;
+    }
+    catch (const std::system_error &) {
+        // Write in current thread if we can not create a new thread
+    }
+#endif
+
+    writeSnapshot();
+    return true;
+}
+
+void YXDBStorage::waitForFlush() noexcept
+{
+#ifdef MULTI_THREADING
+    if (flushThread.joinable())
+        flushThread.join();
+#endif
+}
+
+void YXDBStorage::writeSnapshot() noexcept
+{
+    bool success = saveToFile();
+
+    // Changes in the checkpoint log are all written into the database file now
+    std::error_code ec;
+    if (success)
+        std::filesystem::remove(checkpointWALFilePath, ec);
+
+    // Merge overlay into records map
+    std::unique_lock<std::shared_mutex> lock(mutex);
+
+    if (success)
+        checkpointWALSize = std::max<uint64_t>(MinCheckpointWALSize,
+                                               std::filesystem::file_size(filePath, ec));
+
+    for (const CompactDBKey &key : deletedKeys)
+        recordsMap.erase(key);
+    deletedKeys.clear();
+
+    while (!pendingMap.empty()) {
+        auto node = pendingMap.extract(pendingMap.begin());
+        if (auto it = recordsMap.find(node.key()); it != recordsMap.end())
+            it->second = std::move(node.mapped());
+        else
+            recordsMap.insert(std::move(node));
+    }
+
+    snapshotting = false;
+    if (!success)
+        dirty = true;
+}
+
+bool YXDBStorage::saveToFile() noexcept
+{
+    std::filesystem::path tempFilePath = filePath;
+    tempFilePath += ".tmp";
+
+    MESSAGEL("DATABASE SAVE START " + pathToConsoleString(filePath));
+    {
+        std::ofstream file(tempFilePath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            ERRORL("Failed to open YXDB file at " + pathToConsoleString(tempFilePath));
+            return false;
+        }
+
+        {
+            Compressor    compressor(static_cast<std::ostream &>(file),
+                                  compressedSave ? Compressor::Type::LZ4_DEFAULT
+                                                    : Compressor::Type::NO_COMPRESS);
+            std::ostream *ostreamPtr = compressor.openOutputStream();
+            if (!ostreamPtr || !*ostreamPtr) {
+                ERRORL("Failed to open YXDB file at " + pathToConsoleString(tempFilePath));
+                return false;
+            }
+            save(*ostreamPtr);
+        }
+
+        file.close();
+        if (!file) {
+            ERRORL("Failed to write YXDB file at " + pathToConsoleString(tempFilePath));
+            return false;
+        }
+    }
 
     // Backup previous file first
     if (numBackupsOnSave && std::filesystem::exists(filePath)) {
@@ -164,34 +379,218 @@ bool YXDBStorage::flush() noexcept
             std::error_code ec;
             // Remove previous backup file
             std::filesystem::remove(backupPath, ec);
-            // Move current file to be cleared to the previous backup file
-            std::filesystem::rename(toClearPath, backupPath, ec);
+            if (i > 1) {
+                // Move current file to be cleared to the previous backup file
+                std::filesystem::rename(toClearPath, backupPath, ec);
+            }
+            else {
+                // Database file is linked (or copied) instead of moved, so that it always
+                // exists until it is atomically replaced by the temporary file below.
+                std::filesystem::create_hard_link(toClearPath, backupPath, ec);
+                if (ec)
+                    std::filesystem::copy_file(toClearPath, backupPath, ec);
+            }
         }
     }
 
-    std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
-    if (file.is_open()) {
-        Compressor    compressor(static_cast<std::ostream &>(file),
-                              compressedSave ? Compressor::Type::LZ4_DEFAULT
-                                                : Compressor::Type::NO_COMPRESS);
-        std::ostream *ostreamPtr = compressor.openOutputStream();
-        if (ostreamPtr && *ostreamPtr) {
-            MESSAGEL("DATABASE SAVE START " + pathToConsoleString(filePath));
-            save(*ostreamPtr);
-            dirty = false;
-            MESSAGEL("DATABASE SAVE DONE");
-            return true;
+    // Replace the database file with the fully written temporary file
+    std::error_code ec;
+    std::filesystem::rename(tempFilePath, filePath, ec);
+    if (ec) {
+        ERRORL("Failed to replace YXDB file at " + pathToConsoleString(filePath));
+        std::filesystem::remove(tempFilePath, ec);
+        return false;
+    }
+
+    MESSAGEL("DATABASE SAVE DONE");
+    return true;
+}
+
+bool YXDBStorage::mayContain(HashKey canonicalKey) noexcept
+{
+    return keyFilter.mayContain(canonicalKey);
+}
+
+const BlockedBloomFilter *YXDBStorage::lookupFilter() noexcept
+{
+    return keyFilter.get();
+}
+
+void YXDBStorage::insertKeyFilter(const DBKey &key) noexcept
+{
+    if (!keyFilter.insert(key))
+        rebuildKeyFilter();
+}
+
+void YXDBStorage::rebuildKeyFilter() noexcept
+{
+    keyFilter.rebuild(recordsMap.size() + pendingMap.size(), [&](auto &&insert) {
+        for (const auto &[key, record] : recordsMap)
+            insert(key);
+        for (const auto &[key, record] : pendingMap)
+            insert(key);
+    });
+}
+
+bool YXDBStorage::openWAL() noexcept
+{
+    walFile.open(walFilePath, std::ios::binary | std::ios::app);
+    if (!walFile.is_open())
+        return false;
+
+    std::error_code ec;
+    walSize = std::filesystem::file_size(walFilePath, ec);
+    return !ec;
+}
+
+void YXDBStorage::appendWAL(const DBKey &key, const DBRecord *record) noexcept
+{
+    if (!walFile.is_open())
+        return;
+
+    // Serialize the operation, key and the full record after the change
+    size_t      numStoneBytes = sizeof(StonePos) * (key.numBlackStones + key.numWhiteStones);
+    std::string entry(WALEntryHeaderSize + 9 + numStoneBytes, '\0');
+    char       *p = entry.data() + WALEntryHeaderSize;
+    p[0]          = record ? WAL_SET : WAL_DEL;
+    p[1]          = static_cast<char>(key.rule);
+    p[2]          = static_cast<char>(key.boardWidth);
+    p[3]          = static_cast<char>(key.boardHeight);
+    p[4]          = static_cast<char>(key.sideToMove);
+    std::memcpy(p + 5, &key.numBlackStones, sizeof(uint16_t));
+    std::memcpy(p + 7, &key.numWhiteStones, sizeof(uint16_t));
+    std::memcpy(p + 9, key.stones, numStoneBytes);
+    if (record) {
+        entry.push_back(static_cast<char>(record->label));
+        entry.append(reinterpret_cast<const char *>(&record->value), sizeof(DBValue));
+        entry.append(reinterpret_cast<const char *>(&record->depthbound), sizeof(DBDepthBound));
+        entry.append(record->text);
+    }
+
+    uint32_t payloadSize = entry.size() - WALEntryHeaderSize;
+    uint32_t checksum    = walChecksum(entry.data() + WALEntryHeaderSize, payloadSize);
+    std::memcpy(entry.data(), &payloadSize, sizeof(uint32_t));
+    std::memcpy(entry.data() + sizeof(uint32_t), &checksum, sizeof(uint32_t));
+
+    // Hand the entry to the OS at once, so that it survives a crash of the engine
+    walFile.write(entry.data(), entry.size());
+    walFile.flush();
+    walSize += entry.size();
+}
+
+void YXDBStorage::replayWAL(const std::filesystem::path &walPath)
+{
+    std::ifstream file(walPath, std::ios::binary);
+    if (!file.is_open())
+        throw DBStorageError("Failed to open YXDB write-ahead log at "
+                             + pathToConsoleString(walPath));
+
+    std::string data {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+    file.close();
+
+    size_t offset = 0, numEntries = 0;
+    while (data.size() - offset >= WALEntryHeaderSize) {
+        uint32_t payloadSize, checksum;
+        std::memcpy(&payloadSize, data.data() + offset, sizeof(uint32_t));
+        std::memcpy(&checksum, data.data() + offset + sizeof(uint32_t), sizeof(uint32_t));
+        if (payloadSize < 9 || data.size() - offset - WALEntryHeaderSize < payloadSize)
+            break;
+
+        const char *p = data.data() + offset + WALEntryHeaderSize;
+        if (walChecksum(p, payloadSize) != checksum)
+            break;
+
+        // Parse the key of the entry
+        DBKey key;
+        key.rule        = static_cast<Rule>(p[1]);
+        key.boardWidth  = static_cast<int8_t>(p[2]);
+        key.boardHeight = static_cast<int8_t>(p[3]);
+        key.sideToMove  = static_cast<Color>(p[4]);
+        std::memcpy(&key.numBlackStones, p + 5, sizeof(uint16_t));
+        std::memcpy(&key.numWhiteStones, p + 7, sizeof(uint16_t));
+        size_t numStones     = key.numBlackStones + key.numWhiteStones;
+        size_t numStoneBytes = sizeof(StonePos) * numStones;
+        size_t numKeyBytes   = 9 + numStoneBytes;
+        if (key.rule >= RULE_NB || numStones > MAX_MOVES || payloadSize < numKeyBytes)
+            break;
+        std::memcpy(key.stones, p + 9, numStoneBytes);
+
+        // Apply the change to records map
+        if (p[0] == WAL_SET && payloadSize >= numKeyBytes + 5) {
+            p += numKeyBytes;
+            DBRecord record;
+            record.label = static_cast<DBLabel>(p[0]);
+            std::memcpy(&record.value, p + 1, sizeof(DBValue));
+            std::memcpy(&record.depthbound, p + 3, sizeof(DBDepthBound));
+            record.text.assign(p + 5, payloadSize - numKeyBytes - 5);
+
+            if (auto it = recordsMap.find(key); it != recordsMap.end())
+                it->second = std::move(record);
+            else
+                recordsMap.insert(std::make_pair(key, std::move(record)));
+        }
+        else if (p[0] == WAL_DEL) {
+            if (auto it = recordsMap.find(key); it != recordsMap.end())
+                recordsMap.erase(it);
+        }
+        else
+            break;
+
+        offset += WALEntryHeaderSize + payloadSize;
+        numEntries++;
+    }
+
+    // Cut off the entries that are not completely written, so new entries can be appended
+    if (offset < data.size()) {
+        MESSAGEL("Discarded " << data.size() - offset << " bytes of incomplete entries in "
+                              << pathToConsoleString(walPath));
+        std::error_code ec;
+        std::filesystem::resize_file(walPath, offset, ec);
+        if (ec)
+            throw DBStorageError("Failed to truncate YXDB write-ahead log at "
+                                 + pathToConsoleString(walPath));
+    }
+
+    if (numEntries > 0) {
+        MESSAGEL("Replayed " << numEntries << " changes from " << pathToConsoleString(walPath));
+        dirty = true;
+    }
+}
+
+void YXDBStorage::rotateWAL() noexcept
+{
+    walFile.close();
+    walSize = 0;
+
+    std::error_code ec;
+    if (std::filesystem::file_size(walFilePath, ec) > 0 && !ec) {
+        if (!std::filesystem::exists(checkpointWALFilePath, ec))
+            std::filesystem::rename(walFilePath, checkpointWALFilePath, ec);
+        else {
+            // The last checkpoint has failed, so its log is still needed
+            std::ifstream src(walFilePath, std::ios::binary);
+            std::ofstream dst(checkpointWALFilePath, std::ios::binary | std::ios::app);
+            dst << src.rdbuf();
+            dst.close();
+            if (dst)
+                std::filesystem::remove(walFilePath, ec);
         }
     }
 
-    ERRORL("Failed to open YXDB file at " + pathToConsoleString(filePath));
-    return false;
+    // Entries left in current log (if rotation failed) are replayed after the checkpoint
+    // log, so they are kept appending to.
+    if (writeAheadLog && !openWAL())
+        ERRORL("Failed to open YXDB write-ahead log at " + pathToConsoleString(walFilePath));
 }
 
 size_t YXDBStorage::size() noexcept
 {
     std::shared_lock<std::shared_mutex> readerLock(mutex);
-    return recordsMap.size();
+
+    size_t numRecords = recordsMap.size() - deletedKeys.size();
+    for (const auto &[key, record] : pendingMap)
+        numRecords += recordsMap.find(key) == recordsMap.end();
+    return numRecords;
 }
 
 YXDBStorage::Cursor YXDBStorage::scan(Cursor                                   cursor,
@@ -200,23 +599,51 @@ YXDBStorage::Cursor YXDBStorage::scan(Cursor                                   c
 {
     std::shared_lock<std::shared_mutex> readerLock(mutex);
 
-    // Find the starting iterator at the cursor
-    auto it = recordsMap.begin();
-    for (size_t i = 0; i < cursor; i++) {
-        it++;
-
-        if (it == recordsMap.end())
-            break;
-    }
-
-    while (count > 0 && it != recordsMap.end()) {
-        out.emplace_back(DBKey(it->first), it->second);
-        it++;
+    // Resume after the last key of the previous scan, or skip to cursor from the beginning
+    DBKey lastKey;
+    bool  resumed = cursor && scanResumeKeys.find(cursor, lastKey);
+
+    // Iterate records map merged with the overlay in key order
+    auto it        = resumed ? recordsMap.upper_bound(lastKey) : recordsMap.begin();
+    auto pendingIt = resumed ? pendingMap.upper_bound(lastKey) : pendingMap.begin();
+    auto keyLess   = recordsMap.key_comp();
+    auto next      = [&]() -> const RecordsMap::value_type * {
+        for (;;) {
+            bool hasRecord  = it != recordsMap.end();
+            bool hasPending = pendingIt != pendingMap.end();
+            if (hasPending && (!hasRecord || !keyLess(it->first, pendingIt->first))) {
+                // Pending record overrides the one with the same key in records map
+                if (hasRecord && !keyLess(pendingIt->first, it->first))
+                    it++;
+                return &*pendingIt++;
+            }
+            if (!hasRecord)
+                return nullptr;
+            if (deletedKeys.find(it->first) == deletedKeys.end())
+                return &*it++;
+            it++;
+        }
+    };
+
+    // Find the starting entry at the cursor
+    const RecordsMap::value_type *entry = next();
+    for (size_t i = 0; i < cursor && entry && !resumed; i++)
+        entry = next();
+
+    const RecordsMap::value_type *lastEntry = nullptr;
+    while (count > 0 && entry) {
+        out.emplace_back(DBKey(entry->first), entry->second);
+        lastEntry = entry;
+        entry     = next();
         count--;
         cursor++;
     }
 
-    return it == recordsMap.end() ? Cursor(0) : cursor;
+    if (!entry)
+        return Cursor(0);
+    if (lastEntry)
+        scanResumeKeys.save(cursor, DBKey(lastEntry->first));
+    return cursor;
 }
 
 void YXDBStorage::load(std::istream &is, bool ignoreCorrupted)
@@ -18,12 +18,20 @@
 
 #pragma once
 
+#include "dbfilter.h"
 #include "dbstorage.h"
 
 #include <filesystem>
+#include <fstream>
 #include <map>
+#include <mutex>
+#include <set>
 #include <shared_mutex>
 
+#ifdef MULTI_THREADING
+    #include <thread>
+#endif
+
 namespace Database {
 
 /// CompactDBKey is a compact version of database key, which requires less memory
@@ -91,6 +99,16 @@ struct CompactDBKeyCmp
 };
 
 /// YXDBStorage implements DBStorage interface for the Yixin-Database file format.
+/// Flushing returns once a snapshot of the records is taken, and the snapshot is written
+/// on a background thread. While the snapshot is being written, the records map is kept
+/// unchanged, and all changes are recorded in an overlay of pending records and deleted
+/// keys, which is merged back after writing. A new flush waits for the previous one.
+///
+/// With write-ahead log enabled, every change is appended to a log file next to the database
+/// file as soon as it is made, and flushing only writes the whole records map as a checkpoint
+/// when the log grows larger than the database file. The log is renamed to a checkpoint log
+/// when a checkpoint starts, which is removed after the database file is replaced. On opening,
+/// both logs left behind are replayed on top of the loaded records.
 class YXDBStorage : public DBStorage
 {
 public:
@@ -101,13 +119,17 @@ public:
     /// @param saveOnClose Whether to save when YXDB is destroyed.
     /// @param backupOnSave When saving the file, copy previous file with the
     ///     same name to a new file with '_bak' postfix.
+    /// @param writeAheadLog Appends changes to a write-ahead log, so that they are persisted
+    ///     without saving the whole database, and survive a crash before saving.
     /// @note Throws DBStorageError if failed to open the file.
     YXDBStorage(std::filesystem::path filePath,
                 bool                  compressedSave,
                 bool                  saveOnClose,
                 int                   numBackupsOnSave = 1,
-                bool                  ignoreCorrupted  = false);
-    /// Close the yixin database. All unsaved records will be flushed to file.
+                bool                  ignoreCorrupted  = false,
+                bool                  writeAheadLog    = false);
+    /// Close the yixin database. All unsaved records will be flushed to file, and
+    /// the in-progress flush is waited to finish.
     virtual ~YXDBStorage();
 
     /// Returns the current file path.
@@ -125,19 +147,65 @@ public:
                 std::vector<std::pair<DBKey, DBRecord>> &out) noexcept override;
     // -------------------------------------------------------------------
 
+    /// Rejects lookups of missing positions with a Bloom filter of all keys,
+    /// which is built on loading and updated on adding new keys.
+    bool                      mayContain(HashKey canonicalKey) noexcept override;
+    const BlockedBloomFilter *lookupFilter() noexcept override;
+
 private:
-    std::filesystem::path                             filePath;
-    std::map<CompactDBKey, DBRecord, CompactDBKeyCmp> recordsMap;
-    std::shared_mutex                                 mutex;
-    int                                               numBackupsOnSave;
-    bool                                              compressedSave;
-    bool                                              saveOnClose;
-    bool                                              dirty;
+    using RecordsMap = std::map<CompactDBKey, DBRecord, CompactDBKeyCmp>;
+
+    std::filesystem::path                   filePath;
+    std::filesystem::path                   walFilePath;
+    std::filesystem::path                   checkpointWALFilePath;
+    RecordsMap                              recordsMap;
+    RecordsMap                              pendingMap;   // Overlay of changed records
+    std::set<CompactDBKey, CompactDBKeyCmp> deletedKeys;  // Overlay of deleted records
+    DBKeyFilter                             keyFilter;    // Filter of all keys ever stored
+    ScanResumeKeys                          scanResumeKeys;
+    std::shared_mutex                       mutex;
+    std::mutex                              flushMutex;
+#ifdef MULTI_THREADING
+    std::thread flushThread;
+#endif
+    std::ofstream walFile;
+    uint64_t      walSize;            // Number of bytes in the write-ahead log
+    uint64_t      checkpointWALSize;  // Log size that triggers a checkpoint on flush
+    int           numBackupsOnSave;
+    bool          compressedSave;
+    bool          saveOnClose;
+    bool          writeAheadLog;
+    bool          dirty;
+    bool          snapshotting;  // Whether records map is being written and changes go to overlay
 
     /// Loads all data from current stream into memory.
     void load(std::istream &is, bool ignoreCorrupted);
     /// Save the current in-memory data to the opened file.
     void save(std::ostream &os) noexcept;
+    /// Writes records map to file, and then merges the overlay into records map.
+    void writeSnapshot() noexcept;
+    /// Writes records map to a temporary file, then replaces the database file with it.
+    /// @return Whether the file is written successfully.
+    bool saveToFile() noexcept;
+    /// Waits for the in-progress flush to finish. Must be called with flushMutex locked.
+    void waitForFlush() noexcept;
+    /// Flushes the write-ahead log, and writes a snapshot of records map if the log is
+    /// large enough or a checkpoint is forced.
+    bool flushRecords(bool forceCheckpoint) noexcept;
+    /// Opens the write-ahead log for appending.
+    /// @return Whether the log is opened successfully.
+    bool openWAL() noexcept;
+    /// Appends a change of the key to the write-ahead log. A null record means deletion.
+    void appendWAL(const DBKey &key, const DBRecord *record) noexcept;
+    /// Replays all changes in the log file onto records map, and truncates the incomplete
+    /// entries left by a crash at the end of the file.
+    void replayWAL(const std::filesystem::path &walPath);
+    /// Moves the write-ahead log to the checkpoint log, and starts a new one if enabled.
+    void rotateWAL() noexcept;
+    /// Inserts a new key into the key filter, and rebuilds the filter if it is full.
+    void insertKeyFilter(const DBKey &key) noexcept;
+    /// Rebuilds the key filter from records map and the overlay.
+    void rebuildKeyFilter() noexcept;
 };
 
 }  // namespace Database
@@ -0,0 +1,188 @@
+/*
+ *  Rapfi, a Gomoku/Renju playing engine supporting piskvork protocol.
+ *  Copyright (C) 2022  Rapfi developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dispatch.h"
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+
+#if !defined(__GNUC__) && !defined(__clang__)
+    #error "runtime dispatch is only supported with GNU or Clang compiler"
+#endif
+
+/// Declare the evaluator factory of one kernel variant, which is defined
+/// in the evaluator source compiled with EVAL_ISA set to the variant name.
+#define DECLARE_KERNEL_FACTORY(Arch, ISA)                                                      \
+    namespace Evaluation::Arch {                                                               \
+    inline namespace ISA {                                                                     \
+        std::unique_ptr<Evaluation::Evaluator> createEvaluator(int                   boardSize, \
+                                                               Rule                  rule,      \
+                                                               Numa::NumaNodeId      numaNodeId, \
+                                                               std::filesystem::path blackPath, \
+                                                               std::filesystem::path whitePath); \
+    }                                                                                          \
+    }
+
+#define DECLARE_ALL_KERNEL_FACTORIES(Arch)  \
+    DECLARE_KERNEL_FACTORY(Arch, sse)       \
+    DECLARE_KERNEL_FACTORY(Arch, avx2)      \
+    DECLARE_KERNEL_FACTORY(Arch, avx512)    \
+    DECLARE_KERNEL_FACTORY(Arch, avx512vnni)
+
+DECLARE_ALL_KERNEL_FACTORIES(mix9svq)
+DECLARE_ALL_KERNEL_FACTORIES(mix10)
+
+namespace {
+
+using namespace Evaluation::dispatch;
+
+/// Detect the best kernel variant from cpuid. Besides the cpuid feature bits,
+/// __builtin_cpu_supports() also checks that the OS has enabled the AVX/AVX512
+/// register states, so the selected kernel is always safe to execute.
+KernelISA detectKernelISA()
+{
+    __builtin_cpu_init();
+
+    bool hasAVX512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")
+                     && __builtin_cpu_supports("avx512bw");
+    if (hasAVX512 && __builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512vl"))
+        return KernelISA::AVX512VNNI;
+    if (hasAVX512)
+        return KernelISA::AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return KernelISA::AVX2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return KernelISA::SSE;
+    return KernelISA::NONE;
+}
+
+/// Kernel variant set by overrideKernelISA(), NONE if not overridden.
+std::atomic<KernelISA> overriddenISA {KernelISA::NONE};
+
+}  // namespace
+
+namespace Evaluation::dispatch {
+
+KernelISA supportedKernelISA()
+{
+    static const KernelISA isa = detectKernelISA();
+    return isa;
+}
+
+KernelISA selectedKernelISA()
+{
+    KernelISA isa = overriddenISA.load(std::memory_order_relaxed);
+    return isa != KernelISA::NONE ? isa : supportedKernelISA();
+}
+
+void overrideKernelISA(KernelISA isa)
+{
+    if (isa > supportedKernelISA())
+        throw std::runtime_error(std::string("kernel ") + kernelISAName(isa)
+                                 + " is not supported by the CPU");
+    overriddenISA.store(isa, std::memory_order_relaxed);
+}
+
+const char *kernelISAName(KernelISA isa)
+{
+    switch (isa) {
+    default:
+    case KernelISA::NONE: return "none";
+    case KernelISA::SSE: return "sse41";
+    case KernelISA::AVX2: return "avx2";
+    case KernelISA::AVX512: return "avx512";
+    case KernelISA::AVX512VNNI: return "avx512vnni";
+    }
+}
+
+std::unique_ptr<Evaluator> createMix9svqEvaluator(int                   boardSize,
+                                                  Rule                  rule,
+                                                  Numa::NumaNodeId      numaNodeId,
+                                                  std::filesystem::path blackWeightPath,
+                                                  std::filesystem::path whiteWeightPath)
+{
+    switch (selectedKernelISA()) {
+    default:
+    case KernelISA::NONE:
+        throw std::runtime_error("evaluator kernels require at least SSE4.1 instruction set");
+    case KernelISA::SSE:
+        return mix9svq::sse::createEvaluator(boardSize,
+                                             rule,
+                                             numaNodeId,
+                                             blackWeightPath,
+                                             whiteWeightPath);
+    case KernelISA::AVX2:
+        return mix9svq::avx2::createEvaluator(boardSize,
+                                              rule,
+                                              numaNodeId,
+                                              blackWeightPath,
+                                              whiteWeightPath);
+    case KernelISA::AVX512:
+        return mix9svq::avx512::createEvaluator(boardSize,
+                                                rule,
+                                                numaNodeId,
+                                                blackWeightPath,
+                                                whiteWeightPath);
+    case KernelISA::AVX512VNNI:
+        return mix9svq::avx512vnni::createEvaluator(boardSize,
+                                                    rule,
+                                                    numaNodeId,
+                                                    blackWeightPath,
+                                                    whiteWeightPath);
+    }
+}
+
+std::unique_ptr<Evaluator> createMix10Evaluator(int                   boardSize,
+                                                Rule                  rule,
+                                                Numa::NumaNodeId      numaNodeId,
+                                                std::filesystem::path blackWeightPath,
+                                                std::filesystem::path whiteWeightPath)
+{
+    switch (selectedKernelISA()) {
+    default:
+    case KernelISA::NONE:
+        throw std::runtime_error("evaluator kernels require at least SSE4.1 instruction set");
+    case KernelISA::SSE:
+        return mix10::sse::createEvaluator(boardSize,
+                                           rule,
+                                           numaNodeId,
+                                           blackWeightPath,
+                                           whiteWeightPath);
+    case KernelISA::AVX2:
+        return mix10::avx2::createEvaluator(boardSize,
+                                            rule,
+                                            numaNodeId,
+                                            blackWeightPath,
+                                            whiteWeightPath);
+    case KernelISA::AVX512:
+        return mix10::avx512::createEvaluator(boardSize,
+                                              rule,
+                                              numaNodeId,
+                                              blackWeightPath,
+                                              whiteWeightPath);
+    case KernelISA::AVX512VNNI:
+        return mix10::avx512vnni::createEvaluator(boardSize,
+                                                  rule,
+                                                  numaNodeId,
+                                                  blackWeightPath,
+                                                  whiteWeightPath);
+    }
+}
+
+}  // namespace Evaluation::dispatch
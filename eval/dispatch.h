@@ -0,0 +1,67 @@
+/*
+ *  Rapfi, a Gomoku/Renju playing engine supporting piskvork protocol.
+ *  Copyright (C) 2022  Rapfi developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../core/platform.h"
+#include "evaluator.h"
+
+#include <filesystem>
+#include <memory>
+
+namespace Evaluation::dispatch {
+
+/// KernelISA is the instruction set variant of evaluator kernels that is
+/// compiled into a runtime dispatch build, in ascending order of preference.
+/// NONE means the CPU does not meet the minimum requirement (SSE4.1).
+enum class KernelISA { NONE, SSE, AVX2, AVX512, AVX512VNNI };
+
+/// Get the best kernel instruction set supported by the running CPU.
+/// The detection is done only once at the first call.
+KernelISA supportedKernelISA();
+
+/// Get the kernel instruction set used by evaluators created afterwards,
+/// which is the supported one unless it has been overridden.
+KernelISA selectedKernelISA();
+
+/// Override the kernel instruction set of evaluators created afterwards, so
+/// that kernel variants can be cross checked in one process. Passing NONE
+/// restores the default selection.
+/// @throw std::runtime_error If the kernel variant is not supported by the CPU.
+void overrideKernelISA(KernelISA isa);
+
+/// Get the display name of a kernel instruction set.
+const char *kernelISAName(KernelISA isa);
+
+/// Create a mix9svq evaluator with kernels of the selected instruction set.
+/// @throw std::runtime_error If no kernel variant is supported by the CPU.
+std::unique_ptr<Evaluator> createMix9svqEvaluator(int                   boardSize,
+                                                  Rule                  rule,
+                                                  Numa::NumaNodeId      numaNodeId,
+                                                  std::filesystem::path blackWeightPath,
+                                                  std::filesystem::path whiteWeightPath);
+
+/// Create a mix10 evaluator with kernels of the selected instruction set.
+/// @throw std::runtime_error If no kernel variant is supported by the CPU.
+std::unique_ptr<Evaluator> createMix10Evaluator(int                   boardSize,
+                                                Rule                  rule,
+                                                Numa::NumaNodeId      numaNodeId,
+                                                std::filesystem::path blackWeightPath,
+                                                std::filesystem::path whiteWeightPath);
+
+}  // namespace Evaluation::dispatch
@@ -27,46 +27,18 @@
 
 namespace {
 
-/// Makes threat mask according current pattern4 counts on board.
-int makeThreatMask(const StateInfo &st, Color self)
-{
-    Color oppo = ~self;
-
-    bool oppoFive      = st.p4Count[oppo][A_FIVE];
-    bool selfFlexFour  = st.p4Count[self][B_FLEX4];
-    bool oppoFlexFour  = st.p4Count[oppo][B_FLEX4];
-    bool selfFourPlus  = st.p4Count[self][D_BLOCK4_PLUS] + st.p4Count[self][C_BLOCK4_FLEX3];
-    bool selfFour      = st.p4Count[self][E_BLOCK4];
-    bool selfThreePlus = st.p4Count[self][G_FLEX3_PLUS] + st.p4Count[self][F_FLEX3_2X];
-    bool selfThree     = st.p4Count[self][H_FLEX3];
-    bool oppoFourPlus  = st.p4Count[oppo][D_BLOCK4_PLUS] + st.p4Count[oppo][C_BLOCK4_FLEX3];
-    bool oppoFour      = st.p4Count[oppo][E_BLOCK4];
-    bool oppoThreePlus = st.p4Count[oppo][G_FLEX3_PLUS] + st.p4Count[oppo][F_FLEX3_2X];
-    bool oppoThree     = st.p4Count[oppo][H_FLEX3];
-
-    int mask = 0;
-    mask |= 0b1 & -int(oppoFive);
-    mask |= 0b10 & -int(selfFlexFour);
-    mask |= 0b100 & -int(oppoFlexFour);
-    mask |= 0b1000 & -int(selfFourPlus);
-    mask |= 0b10000 & -int(selfFour);
-    mask |= 0b100000 & -int(selfThreePlus);
-    mask |= 0b1000000 & -int(selfThree);
-    mask |= 0b10000000 & -int(oppoFourPlus);
-    mask |= 0b100000000 & -int(oppoFour);
-    mask |= 0b1000000000 & -int(oppoThreePlus);
-    mask |= 0b10000000000 & -int(oppoThree);
-
-    assert(0 <= mask && mask < THREAT_NB);
-    return mask;
-}
-
 /// Evaluates threats.
 /// Threat indicates dynamic first-move status which causes highly non-linear eval changes.
 template <Rule R>
 inline Value evaluateThreat(const StateInfo &st, Color self)
 {
-    return (Value)Config::EVALS_THREAT[Config::tableIndex(R, self)][makeThreatMask(st, self)];
+    // Threat mask is not updated by NO_EVAL moves, which must never be evaluated
+    assert([&] {
+        StateInfo current = st;
+        current.updateThreatMask();
+        return current.threatMask[self] == st.threatMask[self];
+    }());
+    return (Value)Config::EVALS_THREAT[Config::tableIndex(R, self)][st.threatMask[self]];
 }
 
 /// Evaluates basic patterns on board.
@@ -109,7 +81,7 @@ Value evaluate(const Board &board, Value alpha, Value beta)
         // Use evaluator eval if classical eval are in alpha-beta window margin
         int margin = classicalEvalMargin(eval);
         if (eval >= alpha - margin && eval <= beta + margin)
-            return computeEvaluatorValue(board).value();
+            return computeEvaluatorValue(board, alpha, beta).value();
     }
 
     return eval;
@@ -150,12 +122,11 @@ Value evaluate(const Board &board, Rule rule)
     }
 }
 
-ValueType computeEvaluatorValue(const Board &board)
-{
-    Color     self = board.sideToMove();
-    ValueType v    = board.evaluator()->evaluateValue(board);
+namespace {
 
-    // Adjust draw rate according to draw ratio and draw black win rate
+/// Adjust draw rate according to draw ratio and draw black win rate.
+ValueType adjustDrawRate(ValueType v, Color self)
+{
     if (Config::EvaluatorDrawRatio < 1.0) {
         float newDrawRate = Config::EvaluatorDrawRatio * v.draw();
         float drawWinRate = Config::EvaluatorDrawBlackWinRate;
@@ -166,35 +137,89 @@ ValueType computeEvaluatorValue(const Board &board)
     return v;
 }
 
+/// Evaluates value with the cheapest accuracy level of the evaluator first if cascade is
+/// enabled, and only escalates to the best level when the cheap value is uncertain or
+/// it lies near the alpha-beta window (if there is one).
+ValueType cascadeEvaluatorValue(const Board &board, bool hasWindow, Value alpha, Value beta)
+{
+    Color      self      = board.sideToMove();
+    Evaluator *evaluator = board.evaluator();
+    int        numLevels = evaluator->getNumValueAccLevel();
+    if (!Config::EvaluatorCascade || numLevels <= 1)
+        return adjustDrawRate(evaluator->evaluateValue(board, ACC_LEVEL_BEST), self);
+
+    ValueType v = evaluator->evaluateValue(board, AccLevel(numLevels - 1));
+    evaluator->cascadeStats.numEvals++;
+
+    bool uncertain = v.hasUncertainty() && v.uncertainty() > Config::EvaluatorCascadeUncertainty;
+    v              = adjustDrawRate(v, self);
+    bool nearWindow =
+        hasWindow && v.value() > alpha - Config::EvaluatorCascadeMargin
+        && v.value() < beta + Config::EvaluatorCascadeMargin;
+    if (!uncertain && !nearWindow)
+        return v;
+
+    evaluator->cascadeStats.numEscalations++;
+    return adjustDrawRate(evaluator->evaluateValue(board, ACC_LEVEL_BEST), self);
+}
+
+}  // namespace
+
+ValueType computeEvaluatorValue(const Board &board)
+{
+    return cascadeEvaluatorValue(board, false, -VALUE_INFINITE, VALUE_INFINITE);
+}
+
+ValueType computeEvaluatorValue(const Board &board, Value alpha, Value beta)
+{
+    return cascadeEvaluatorValue(board, true, alpha, beta);
+}
+
 /// Trace all evaluation info from a board state with rule.
+/// Pattern codes of the previous ply are counted by replacing only the cells around the
+/// last move, as all other cells are not changed by the last move.
 EvalInfo::EvalInfo(const Board &board, Rule rule)
     : plyBack {0}
     , self(board.sideToMove())
-    , threatMask(makeThreatMask(board.stateInfo(), self))
+    , threatMask(board.stateInfo().threatMask[self])
 {
-    Board &b = const_cast<Board &>(board);
-    Pos    undoHistory[2];
-    int    undoCount = 0;
-
-    for (size_t backIndex = 0; backIndex < arraySize(plyBack); backIndex++) {
-        auto &info = plyBack[backIndex];
-        if (backIndex > 0 && b.ply() > 0) {
-            undoHistory[undoCount++] = b.getLastMove();
-            b.undo(rule);
-        }
+    auto countCell = [](auto &info, const Cell &c, int delta) {
+        info.pcodeCount[BLACK][c.pcode<BLACK>()] += delta;
+        info.pcodeCount[WHITE][c.pcode<WHITE>()] += delta;
+    };
+
+    // Empty cells are exactly the cells having a pattern4 of one side
+    Bitboard emptyCells {};
+    for (int p4 = 0; p4 < PATTERN4_NB; p4++)
+        emptyCells |= board.p4Bitboard(BLACK, Pattern4(p4));
+    FOR_EVERY_BITBOARD_POS(emptyCells, pos)
+    {
+        countCell(plyBack[0], board.cell(pos), 1);
+    }
 
-        FOR_EVERY_EMPTY_POS(&b, pos)
-        {
-            const Cell &c = b.cell(pos);
-            info.pcodeCount[BLACK][c.pcode<BLACK>()]++;
-            info.pcodeCount[WHITE][c.pcode<WHITE>()]++;
+    plyBack[1] = plyBack[0];
+
+    Pos lastMove = board.getLastMove();
+    if (board.ply() == 0 || lastMove == Pos::PASS)
+        return;
+
+    // Cells within the longest half line length of the last move cover all changed cells
+    auto countCellsAroundLastMove = [&](const Board &b, int delta) {
+        constexpr int L = PatternConfig::HalfLineLen<RENJU>;
+        for (int dir = 0; dir < 4; dir++) {
+            for (int i = -L; i <= L; i++) {
+                Pos pos = lastMove + DIRECTION[dir] * i;
+                if ((i != 0 || dir == 0) && b.isEmpty(pos))
+                    countCell(plyBack[1], b.cell(pos), delta);
+            }
         }
-    }
+    };
 
-    // Recover board state
-    while (undoCount > 0) {
-        b.move(rule, undoHistory[--undoCount]);
-    }
+    Board &b = const_cast<Board &>(board);
+    countCellsAroundLastMove(b, -1);
+    b.undo(rule);
+    countCellsAroundLastMove(b, 1);
+    b.move(rule, lastMove);
 }
 
 }  // namespace Evaluation
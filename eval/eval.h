@@ -30,7 +30,12 @@ Value evaluate(const Board &board, Value alpha = -VALUE_INFINITE, Value beta = V
 Value evaluate(const Board &board, Rule rule);
 
 class ValueType;
+/// Computes evaluator value of the side to move. When cascade evaluation is enabled, the
+/// best accuracy level is only evaluated if the cheapest level is uncertain about the value.
 ValueType computeEvaluatorValue(const Board &board);
+/// Computes evaluator value of the side to move. When cascade evaluation is enabled, the
+/// best accuracy level is also evaluated if the cheap value is near the alpha-beta window.
+ValueType computeEvaluatorValue(const Board &board, Value alpha, Value beta);
 
 /// EvalInfo struct contains all information needed to evaluate a position.
 struct EvalInfo
@@ -31,6 +31,7 @@ namespace Evaluation {
 
 /// ValueType is a container for value (and a optional draw rate).
 /// Draw rate value less than 0.0 means no draw rate is contained.
+/// Some evaluators also output an (relative) uncertainty of the value.
 class ValueType
 {
 public:
@@ -46,6 +47,8 @@ public:
     float draw() const { return drawProb; }
     float winLossRate() const { return winProb - lossProb; }
     float winningRate() const { return (winLossRate() + 1) * 0.5f; }
+    bool  hasUncertainty() const { return hasUncert; }
+    float uncertainty() const { return uncert; }
     Value value() const
     {
         assert(val != VALUE_NONE);
@@ -57,12 +60,22 @@ public:
     /// @param newdrawProb The draw probability of new value. (default is 0)
     ///     This value should not be greater than current draw rate.
     ValueType valueOfDrawWinRate(float drawWinRate, float newdrawProb = 0.0f);
+    /// Construct a copy of this value with the uncertainty output of the evaluator.
+    ValueType withUncertainty(float uncertainty) const
+    {
+        ValueType v = *this;
+        v.uncert    = uncertainty;
+        v.hasUncert = true;
+        return v;
+    }
 
 private:
-    Value val      = VALUE_NONE;
-    float winProb  = -1.0f;
-    float lossProb = -1.0f;
-    float drawProb = -1.0f;
+    Value val       = VALUE_NONE;
+    float winProb   = -1.0f;
+    float lossProb  = -1.0f;
+    float drawProb  = -1.0f;
+    float uncert    = 0.0f;
+    bool  hasUncert = false;
 };
 
 /// AccLevel represents the accuracy level of the model's evaluation.
@@ -124,6 +137,23 @@ private:
     PolicyType policy[MAX_MOVES];
 };
 
+/// UpdateStats is the statistics of lazy incremental updates of an evaluator.
+struct UpdateStats
+{
+    uint64_t numSyncs;             /// Number of times that pending updates are applied
+    uint64_t numPendingMoves;      /// Number of pending moves to replay without snapshots
+    uint64_t numReplayedMoves;     /// Number of moves that are actually replayed
+    uint64_t numSnapshotRestores;  /// Number of states that are restored from snapshots
+};
+
+/// CascadeStats is the statistics of cascade value evaluations of an evaluator, where
+/// the best accuracy level is only evaluated when the cheapest level is not decisive.
+struct CascadeStats
+{
+    uint64_t numEvals;        /// Number of values evaluated with the cheapest level first
+    uint64_t numEscalations;  /// Number of values escalated to the best accuracy level
+};
+
 /// Evaluator is the base class for evaluation plugins.
 /// It provides overridable hook over board move/undo update, and interface for doing value
 /// evaluation and policy evaluation. Different evaluation implementation may inherit from
@@ -156,6 +186,9 @@ public:
     /// This is implemented as initEmptyBoard() as well as a sequence of beforeMove()
     /// and afterMove() by default.
     virtual void syncWithBoard(const Board &board);
+    /// Applies all pending updates to the incremental state without evaluating.
+    /// Default behaviour does nothing for evaluators that do not defer updates.
+    virtual void applyPendingUpdates(const Board &board) {}
 
     /// Evaluates value for current side to move with the specified level of accuracy.
     virtual ValueType evaluateValue(const Board &board, AccLevel level = ACC_LEVEL_BEST) = 0;
@@ -167,9 +200,14 @@ public:
     virtual int getNumValueAccLevel() const { return 1; }
     /// Gets the supported number of policy's accuracy levels.
     virtual int getNumPolicyAccLevel() const { return 1; }
+    /// Gets the statistics of incremental updates. Default behaviour returns all zeros
+    /// for evaluators that do not keep any incremental state.
+    virtual UpdateStats getUpdateStats() const { return {}; }
 
     const int  boardSize;
     const Rule rule;
+    /// Cascade evaluation statistics, which is updated by computeEvaluatorValue().
+    CascadeStats cascadeStats {};
 };
 
 /// Helper base class for reporting unsupported evaluator config.
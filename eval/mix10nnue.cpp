@@ -18,6 +18,8 @@
 
 #include "mix10nnue.h"
 
+#include "../config.h"
+#include "../core/hash.h"
 #include "../core/iohelper.h"
 #include "../core/platform.h"
 #include "../core/utils.h"
@@ -144,6 +146,12 @@ struct Mix10WeightLoader : WeightLoader<mix10::Weight>
             simd::preprocessLinear<4, ValueDim>(b.value_small_l3.weight);
 
             simd::preprocessLinear<FeatureDim * 2, ValueDim>(b.value_gate.weight);
+            simd::preprocessLinearSignedInputBias<ValueDim, FeatureDim>(b.value_corner.weight,
+                                                                        b.value_corner.bias);
+            simd::preprocessLinearSignedInputBias<ValueDim, FeatureDim>(b.value_edge.weight,
+                                                                        b.value_edge.bias);
+            simd::preprocessLinearSignedInputBias<ValueDim, FeatureDim>(b.value_center.weight,
+                                                                        b.value_center.bias);
             simd::preprocessLinear<ValueDim, FeatureDim>(b.value_corner.weight);
             simd::preprocessLinear<ValueDim, FeatureDim>(b.value_edge.weight);
             simd::preprocessLinear<ValueDim, FeatureDim>(b.value_center.weight);
@@ -156,7 +164,13 @@ struct Mix10WeightLoader : WeightLoader<mix10::Weight>
     }
 };
 
-static Evaluation::WeightRegistry<StandardHeaderLoader<Mix10WeightLoader>> WeightReg;
+/// Weight registry is constructed on first use, so that nothing of a kernel variant
+/// not supported by the CPU is executed at startup in runtime dispatch builds.
+auto &weightRegistry()
+{
+    static Evaluation::WeightRegistry<StandardHeaderLoader<Mix10WeightLoader>> WeightReg;
+    return WeightReg;
+}
 
 constexpr int                   Alignment = simd::NativeAlignment;
 constexpr simd::InstructionType IT        = simd::NativeInstType;
@@ -196,6 +210,7 @@ linearBlock(int8_t output[], const int8_t input[], const FCWeight<OutSize, InSiz
 }  // namespace
 
 namespace Evaluation::mix10 {
+EVAL_ISA_NAMESPACE_BEGIN
 
 Accumulator::Accumulator(int boardSize)
     : boardSize(boardSize)
@@ -203,8 +218,9 @@ Accumulator::Accumulator(int boardSize)
     , currentVersion(-1)
 {
     int nCells        = boardSize * boardSize;
-    int nInnerChanges = MaxInnerChanges[boardSize];
-    int nOuterChanges = MaxOuterChanges[boardSize];
+    int nOuterCells   = outerBoardSize * outerBoardSize;
+    int nInnerChanges = MaxInnerChanges[boardSize] + MaxRestoredVersions * nCells;
+    int nOuterChanges = MaxOuterChanges[boardSize] + MaxRestoredVersions * nOuterCells;
 
     valueSumTable          = MemAlloc::alignedArrayAlloc<ValueSumType, Alignment>(nCells + 1);
     versionChangeNumTable  = new ChangeNum[nCells + 1];
@@ -214,6 +230,24 @@ Accumulator::Accumulator(int boardSize)
     mapSum = MemAlloc::alignedArrayAlloc<std::array<int16_t, FeatureDim>, Alignment>(nInnerChanges);
     mapConv =
         MemAlloc::alignedArrayAlloc<std::array<int16_t, FeatDWConvDim>, Alignment>(nOuterChanges);
+    versionValid    = new bool[nCells + 1];
+    versionRestored = new bool[nCells + 1];
+
+    snapshotKey        = new HashKey[NumSnapshots];
+    snapshotStoneHash  = new uint64_t[NumSnapshots];
+    snapshotVersion    = new int[NumSnapshots];
+    snapshotValueSum   = MemAlloc::alignedArrayAlloc<ValueSumType, Alignment>(NumSnapshots);
+    snapshotIndexTable = new std::array<uint32_t, 4>[NumSnapshots * nCells];
+    snapshotMapSum     = MemAlloc::alignedArrayAlloc<std::array<int16_t, FeatureDim>, Alignment>(
+        NumSnapshots * nCells);
+    snapshotMapConv = MemAlloc::alignedArrayAlloc<std::array<int16_t, FeatDWConvDim>, Alignment>(
+        NumSnapshots * nOuterCells);
+
+    // Only version 0 is valid before any move, and all snapshot slots are empty
+    std::fill_n(versionValid, nCells + 1, false);
+    std::fill_n(versionRestored, nCells + 1, false);
+    std::fill_n(snapshotVersion, NumSnapshots, -1);
+    versionValid[0] = true;
 
     // Compute group index based on board pos
     std::fill_n(groupIndex, arraySize(groupIndex), 0);
@@ -243,6 +277,15 @@ Accumulator::~Accumulator()
     delete[] indexTable;
     MemAlloc::alignedFree(mapSum);
     MemAlloc::alignedFree(mapConv);
+    delete[] versionValid;
+    delete[] versionRestored;
+    delete[] snapshotKey;
+    delete[] snapshotStoneHash;
+    delete[] snapshotVersion;
+    MemAlloc::alignedFree(snapshotValueSum);
+    delete[] snapshotIndexTable;
+    MemAlloc::alignedFree(snapshotMapSum);
+    MemAlloc::alignedFree(snapshotMapConv);
 }
 
 void Accumulator::initIndexTable()
@@ -602,6 +645,8 @@ void Accumulator::move(const Weight &w, Color pieceColor, int x, int y)
     // Move to next version
     currentVersion++;
     versionChangeNumTable[currentVersion] = {uint16_t(newMapIdx), uint16_t(newMapConvIdx)};
+    versionValid[currentVersion]          = true;
+    versionRestored[currentVersion]       = false;
 
     // Store value sum
     auto &valueSumOld = valueSumTable[currentVersion - 1];
@@ -622,6 +667,76 @@ void Accumulator::move(const Weight &w, Color pieceColor, int x, int y)
     valueSumNew.large_value_feature_valid = false;
 }
 
+int Accumulator::lastValidVersion(int version) const
+{
+    while (!versionValid[version])
+        version--;
+    return version;
+}
+
+void Accumulator::saveSnapshot(HashKey key, uint64_t stoneHash)
+{
+    const int nCells      = boardSize * boardSize;
+    const int nOuterCells = outerBoardSize * outerBoardSize;
+    const int slot        = Hash::indexBits(key) % NumSnapshots;
+    const int innerBase   = currentVersion * nCells;
+    const int outerBase   = currentVersion * nOuterCells;
+
+    snapshotKey[slot]       = key;
+    snapshotStoneHash[slot] = stoneHash;
+    snapshotVersion[slot]   = currentVersion;
+    snapshotValueSum[slot]  = valueSumTable[currentVersion];
+    for (int i = 0; i < nCells; i++) {
+        int mapIdx                            = versionInnerIndexTable[innerBase + i];
+        snapshotIndexTable[slot * nCells + i] = indexTable[mapIdx];
+        snapshotMapSum[slot * nCells + i]     = mapSum[mapIdx];
+    }
+    for (int i = 0; i < nOuterCells; i++)
+        snapshotMapConv[slot * nOuterCells + i] = mapConv[versionOuterIndexTable[outerBase + i]];
+}
+
+bool Accumulator::restoreSnapshot(HashKey key, uint64_t stoneHash, int version)
+{
+    const int slot = Hash::indexBits(key) % NumSnapshots;
+    if (snapshotVersion[slot] != version || snapshotKey[slot] != key
+        || snapshotStoneHash[slot] != stoneHash)
+        return false;
+
+    // Make sure the full copy of state still fits in the change tables
+    if (std::count(versionRestored, versionRestored + currentVersion + 1, true)
+        >= MaxRestoredVersions)
+        return false;
+
+    const int       nCells      = boardSize * boardSize;
+    const int       nOuterCells = outerBoardSize * outerBoardSize;
+    const int       innerBase   = version * nCells;
+    const int       outerBase   = version * nOuterCells;
+    const ChangeNum changeNum   = versionChangeNumTable[currentVersion];
+
+    for (int i = 0; i < nCells; i++) {
+        int mapIdx                            = changeNum.inner + i;
+        indexTable[mapIdx]                    = snapshotIndexTable[slot * nCells + i];
+        mapSum[mapIdx]                        = snapshotMapSum[slot * nCells + i];
+        versionInnerIndexTable[innerBase + i] = mapIdx;
+    }
+    for (int i = 0; i < nOuterCells; i++) {
+        int mapConvIdx                        = changeNum.outer + i;
+        mapConv[mapConvIdx]                   = snapshotMapConv[slot * nOuterCells + i];
+        versionOuterIndexTable[outerBase + i] = mapConvIdx;
+    }
+    valueSumTable[version]         = snapshotValueSum[slot];
+    versionChangeNumTable[version] = {uint16_t(changeNum.inner + nCells),
+                                      uint16_t(changeNum.outer + nOuterCells)};
+
+    // Versions skipped by the restored version have no valid state
+    std::fill(versionValid + currentVersion + 1, versionValid + version, false);
+    std::fill(versionRestored + currentVersion + 1, versionRestored + version, false);
+    versionValid[version]    = true;
+    versionRestored[version] = true;
+    currentVersion           = version;
+    return true;
+}
+
 void Accumulator::updateSharedSmallHead(const Weight &w)
 {
     auto       &valueSum = valueSumTable[currentVersion];
@@ -653,6 +768,20 @@ void Accumulator::updateSharedLargeHead(const Weight &w)
 
     updateSharedSmallHead(w);
 
+    alignas(Alignment) int8_t layer0[ValueDim * 5];
+    evaluateLargeValueFeature(bucket, layer0);
+
+    // linear 1, 2
+    alignas(Alignment) int8_t layer1[ValueDim];
+    linearBlock(layer1, layer0, bucket.value_l1);
+    linearBlock(valueSum.large_value_feature.data(), layer1, bucket.value_l2);
+    valueSum.large_value_feature_valid = true;
+}
+
+void Accumulator::evaluateLargeValueFeature(const Weight::HeadBucket &bucket, int8_t layer0[])
+{
+    const auto &valueSum = valueSumTable[currentVersion];
+
     // group feature sum
     alignas(Alignment) int8_t group0_in[ValueSumType::NGroup][ValueSumType::NGroup][FeatureDim];
     for (int i = 0; i < ValueSumType::NGroup; i++)
@@ -711,18 +840,11 @@ void Accumulator::updateSharedLargeHead(const Weight &w)
     }
 
     // quadrant linear layer
-    alignas(Alignment) int8_t layer0[ValueDim * 5];
     simd::copy<ValueDim>(layer0, valueSum.small_value_feature.data());
     linearBlock(layer0 + 1 * ValueDim, group2[0][0], bucket.value_quad);
     linearBlock(layer0 + 2 * ValueDim, group2[0][1], bucket.value_quad);
     linearBlock(layer0 + 3 * ValueDim, group2[1][0], bucket.value_quad);
     linearBlock(layer0 + 4 * ValueDim, group2[1][1], bucket.value_quad);
-
-    // linear 1, 2
-    alignas(Alignment) int8_t layer1[ValueDim];
-    linearBlock(layer1, layer0, bucket.value_l1);
-    linearBlock(valueSum.large_value_feature.data(), layer1, bucket.value_l2);
-    valueSum.large_value_feature_valid = true;
 }
 
 std::tuple<float, float, float, float> Accumulator::evaluateValueSmall(const Weight &w)
@@ -801,7 +923,11 @@ void Accumulator::evaluatePolicySmall(const Weight &w, PolicyBuffer &policyBuffe
         }
     }
 
-    const int outerVersionIdxBase = currentVersion * outerBoardSize * outerBoardSize;
+    // Gather cells to compute, so that they can be processed in groups of four
+    int            numCells = 0;
+    uint16_t       cellInnerIdx[MAX_MOVES];
+    const int16_t *cellMapConv[MAX_MOVES];
+    const int      outerVersionIdxBase = currentVersion * outerBoardSize * outerBoardSize;
     for (int y = 0, innerIdx = 0, outerIdx = outerBoardSize + 1; y < boardSize;
          y++, outerIdx += 2) {
         for (int x = 0; x < boardSize; x++, innerIdx++, outerIdx++) {
@@ -809,30 +935,53 @@ void Accumulator::evaluatePolicySmall(const Weight &w, PolicyBuffer &policyBuffe
                 continue;
 
             // Get mapConv index of current version at this point
-            int mapConvIdx = versionOuterIndexTable[outerVersionIdxBase + outerIdx];
-
-            // Compute dynamic point-wise policy conv
-            alignas(Alignment) int32_t policyLayer1i32[PolicySOutDim];
-            simd::linear<PolicySOutDim, PolicySInDim, false, true, true>(policyLayer1i32,
-                                                                         mapConv[mapConvIdx].data(),
-                                                                         pwconvWeighti16,
-                                                                         pwconvBiasi32);
-
-            // Apply relu, convert to float and accumulate all channels of pwconv feature
-            typedef Batch<PolicySOutDim, float> PWConvB;
-            auto                                policyAccum = F32Op::setzero();
-            for (int i = 0; i < PWConvB::NumBatch; i++) {
-                auto featI32 = I32LS::load(policyLayer1i32 + i * PWConvB::RegWidth);
-                featI32      = I32Op::max(featI32, I32Op::setzero());
-                auto featF32 = Convert<int32_t, float>::convert1(featI32);
-                auto outputW =
-                    F32LS::load(bucket.policy_small_output_weight + i * PWConvB::RegWidth);
-                policyAccum = F32Op::fmadd(featF32, outputW, policyAccum);
-            }
+            int mapConvIdx         = versionOuterIndexTable[outerVersionIdxBase + outerIdx];
+            cellInnerIdx[numCells] = innerIdx;
+            cellMapConv[numCells]  = mapConv[mapConvIdx].data();
+            numCells++;
+        }
+    }
 
-            float policy = F32Op::reduceadd(policyAccum) + bucket.policy_small_output_bias;
-            policyBuffer(innerIdx) = policy;
+    // Apply relu, convert to float and accumulate all channels of pwconv feature
+    auto policyOutput = [&](const int32_t policyLayer1i32[PolicySOutDim]) {
+        typedef Batch<PolicySOutDim, float> PWConvB;
+        auto                                policyAccum = F32Op::setzero();
+        for (int i = 0; i < PWConvB::NumBatch; i++) {
+            auto featI32 = I32LS::load(policyLayer1i32 + i * PWConvB::RegWidth);
+            featI32      = I32Op::max(featI32, I32Op::setzero());
+            auto featF32 = Convert<int32_t, float>::convert1(featI32);
+            auto outputW = F32LS::load(bucket.policy_small_output_weight + i * PWConvB::RegWidth);
+            policyAccum  = F32Op::fmadd(featF32, outputW, policyAccum);
         }
+        return F32Op::reduceadd(policyAccum) + bucket.policy_small_output_bias;
+    };
+
+    // Compute dynamic point-wise policy conv for four cells at once
+    int i = 0;
+    for (; i + 4 <= numCells; i += 4) {
+        alignas(Alignment) int32_t policyLayer1i32[4][PolicySOutDim];
+        simd::linear4<PolicySOutDim, PolicySInDim, false, true>(policyLayer1i32[0],
+                                                                policyLayer1i32[1],
+                                                                policyLayer1i32[2],
+                                                                policyLayer1i32[3],
+                                                                cellMapConv[i + 0],
+                                                                cellMapConv[i + 1],
+                                                                cellMapConv[i + 2],
+                                                                cellMapConv[i + 3],
+                                                                pwconvWeighti16,
+                                                                pwconvBiasi32);
+        for (int k = 0; k < 4; k++)
+            policyBuffer(cellInnerIdx[i + k]) = policyOutput(policyLayer1i32[k]);
+    }
+
+    // Compute the remaining cells one by one
+    for (; i < numCells; i++) {
+        alignas(Alignment) int32_t policyLayer1i32[PolicySOutDim];
+        simd::linear<PolicySOutDim, PolicySInDim, false, true, true>(policyLayer1i32,
+                                                                     cellMapConv[i],
+                                                                     pwconvWeighti16,
+                                                                     pwconvBiasi32);
+        policyBuffer(cellInnerIdx[i]) = policyOutput(policyLayer1i32);
     }
 }
 
@@ -848,13 +997,29 @@ void Accumulator::evaluatePolicyLarge(const Weight &w, PolicyBuffer &policyBuffe
     linearBlock(layer1, valueSum.large_value_feature.data(), bucket.policy_large_pwconv_weight_0);
 
     alignas(Alignment) int32_t layer2i32[PolicyLMidDim * (PolicyLInDim + 1)];
-    alignas(Alignment) int16_t pwconv1Weighti16[PolicyLMidDim * PolicyLInDim];
-    alignas(Alignment) int32_t pwconv1Biasi32[PolicyLMidDim];
     simd::linear<PolicyLMidDim *(PolicyLInDim + 1), ValueDim>(
         layer2i32,
         layer1,
         bucket.policy_large_pwconv_weight_1.weight,
         bucket.policy_large_pwconv_weight_1.bias);
+
+    alignas(Alignment) int32_t layer3i32[PolicyLOutDim * (PolicyLMidDim + 1)];
+    simd::linear<PolicyLOutDim *(PolicyLMidDim + 1), ValueDim>(
+        layer3i32,
+        layer1,
+        bucket.policy_large_pwconv_weight_2.weight,
+        bucket.policy_large_pwconv_weight_2.bias);
+
+    evaluatePolicyLargeOutput(bucket, layer2i32, layer3i32, policyBuffer);
+}
+
+void Accumulator::evaluatePolicyLargeOutput(const Weight::HeadBucket &bucket,
+                                            const int32_t             layer2i32[],
+                                            const int32_t             layer3i32[],
+                                            PolicyBuffer             &policyBuffer)
+{
+    alignas(Alignment) int16_t pwconv1Weighti16[PolicyLMidDim * PolicyLInDim];
+    alignas(Alignment) int32_t pwconv1Biasi32[PolicyLMidDim];
     simd::crelu<PolicyLMidDim * PolicyLInDim, 1, true>(pwconv1Weighti16, layer2i32);
     // To get pwconv bias, we need to scale the output of layer2 by 128
     {
@@ -866,14 +1031,8 @@ void Accumulator::evaluatePolicyLarge(const Weight &w, PolicyBuffer &policyBuffe
         }
     }
 
-    alignas(Alignment) int32_t layer3i32[PolicyLOutDim * (PolicyLMidDim + 1)];
     alignas(Alignment) int16_t pwconv2Weighti16[PolicyLOutDim * PolicyLMidDim];
     alignas(Alignment) int32_t pwconv2Biasi32[PolicyLOutDim];
-    simd::linear<PolicyLOutDim *(PolicyLMidDim + 1), ValueDim>(
-        layer3i32,
-        layer1,
-        bucket.policy_large_pwconv_weight_2.weight,
-        bucket.policy_large_pwconv_weight_2.bias);
     simd::crelu<PolicyLOutDim * PolicyLMidDim, 1, true>(pwconv2Weighti16, layer3i32);
     // To get pwconv bias, we need to scale the output of layer3 by 128
     {
@@ -885,7 +1044,11 @@ void Accumulator::evaluatePolicyLarge(const Weight &w, PolicyBuffer &policyBuffe
         }
     }
 
-    const int outerVersionIdxBase = currentVersion * outerBoardSize * outerBoardSize;
+    // Gather cells to compute, so that they can be processed in groups of four
+    int            numCells = 0;
+    uint16_t       cellInnerIdx[MAX_MOVES];
+    const int16_t *cellMapConv[MAX_MOVES];
+    const int      outerVersionIdxBase = currentVersion * outerBoardSize * outerBoardSize;
     for (int y = 0, innerIdx = 0, outerIdx = outerBoardSize + 1; y < boardSize;
          y++, outerIdx += 2) {
         for (int x = 0; x < boardSize; x++, innerIdx++, outerIdx++) {
@@ -893,43 +1056,85 @@ void Accumulator::evaluatePolicyLarge(const Weight &w, PolicyBuffer &policyBuffe
                 continue;
 
             // Get mapConv index of current version at this point
-            int mapConvIdx = versionOuterIndexTable[outerVersionIdxBase + outerIdx];
-
-            // Compute dynamic point-wise policy conv
-            alignas(Alignment) int32_t policyLayer1i32[PolicyLMidDim];
-            alignas(Alignment) int16_t policyLayer1i16[PolicyLMidDim];
-            simd::linear<PolicyLMidDim, PolicyLInDim, false, true, true>(policyLayer1i32,
-                                                                         mapConv[mapConvIdx].data(),
-                                                                         pwconv1Weighti16,
-                                                                         pwconv1Biasi32);
-            // Size of policyLayer1i16 may be less than 512bit width when PolicyLMidDim is only 16,
-            // so we choose the maximum available instruction here for AVX512 platforms.
-            constexpr auto ITPolicyLMid =
-                simd::getInstTypeOfWidth(IT, PolicyLMidDim * sizeof(int16_t) * 8);
-            simd::crelu<PolicyLMidDim, 128 * 128, false, Alignment, ITPolicyLMid>(policyLayer1i16,
-                                                                                  policyLayer1i32);
-
-            alignas(Alignment) int32_t policyLayer2i32[PolicyLOutDim];
-            simd::linear<PolicyLOutDim, PolicyLMidDim>(policyLayer2i32,
-                                                       policyLayer1i16,
-                                                       pwconv2Weighti16,
-                                                       pwconv2Biasi32);
-
-            // Apply relu, convert to float and accumulate all channels of pwconv feature
-            typedef Batch<PolicyLOutDim, float> PWConvB;
-            auto                                policyAccum = F32Op::setzero();
-            for (int i = 0; i < PWConvB::NumBatch; i++) {
-                auto featI32 = I32LS::load(policyLayer2i32 + i * PWConvB::RegWidth);
-                featI32      = I32Op::max(featI32, I32Op::setzero());
-                auto featF32 = Convert<int32_t, float>::convert1(featI32);
-                auto outputW =
-                    F32LS::load(bucket.policy_large_output_weight + i * PWConvB::RegWidth);
-                policyAccum = F32Op::fmadd(featF32, outputW, policyAccum);
-            }
+            int mapConvIdx         = versionOuterIndexTable[outerVersionIdxBase + outerIdx];
+            cellInnerIdx[numCells] = innerIdx;
+            cellMapConv[numCells]  = mapConv[mapConvIdx].data();
+            numCells++;
+        }
+    }
 
-            float policy = F32Op::reduceadd(policyAccum) + bucket.policy_large_output_bias;
-            policyBuffer(innerIdx) = policy;
+    // Size of policyLayer1i16 may be less than 512bit width when PolicyLMidDim is only 16,
+    // so we choose the maximum available instruction here for AVX512 platforms.
+    constexpr auto ITPolicyLMid = simd::getInstTypeOfWidth(IT, PolicyLMidDim * sizeof(int16_t) * 8);
+
+    // Apply relu, convert to float and accumulate all channels of pwconv feature
+    auto policyOutput = [&](const int32_t policyLayer2i32[PolicyLOutDim]) {
+        typedef Batch<PolicyLOutDim, float> PWConvB;
+        auto                                policyAccum = F32Op::setzero();
+        for (int i = 0; i < PWConvB::NumBatch; i++) {
+            auto featI32 = I32LS::load(policyLayer2i32 + i * PWConvB::RegWidth);
+            featI32      = I32Op::max(featI32, I32Op::setzero());
+            auto featF32 = Convert<int32_t, float>::convert1(featI32);
+            auto outputW = F32LS::load(bucket.policy_large_output_weight + i * PWConvB::RegWidth);
+            policyAccum  = F32Op::fmadd(featF32, outputW, policyAccum);
         }
+        return F32Op::reduceadd(policyAccum) + bucket.policy_large_output_bias;
+    };
+
+    // Compute dynamic point-wise policy conv for four cells at once. Rows of int16
+    // features are padded, so that each of them is aligned for simd operations.
+    constexpr size_t PolicyLMidStride = simd::alignDimSize<Alignment, int16_t>(PolicyLMidDim);
+    int              i                = 0;
+    for (; i + 4 <= numCells; i += 4) {
+        alignas(Alignment) int32_t policyLayer1i32[4][PolicyLMidDim];
+        alignas(Alignment) int16_t policyLayer1i16[4][PolicyLMidStride];
+        simd::linear4<PolicyLMidDim, PolicyLInDim, false, true>(policyLayer1i32[0],
+                                                                policyLayer1i32[1],
+                                                                policyLayer1i32[2],
+                                                                policyLayer1i32[3],
+                                                                cellMapConv[i + 0],
+                                                                cellMapConv[i + 1],
+                                                                cellMapConv[i + 2],
+                                                                cellMapConv[i + 3],
+                                                                pwconv1Weighti16,
+                                                                pwconv1Biasi32);
+        for (int k = 0; k < 4; k++)
+            simd::crelu<PolicyLMidDim, 128 * 128, false, Alignment, ITPolicyLMid>(
+                policyLayer1i16[k],
+                policyLayer1i32[k]);
+
+        alignas(Alignment) int32_t policyLayer2i32[4][PolicyLOutDim];
+        simd::linear4<PolicyLOutDim, PolicyLMidDim>(policyLayer2i32[0],
+                                                    policyLayer2i32[1],
+                                                    policyLayer2i32[2],
+                                                    policyLayer2i32[3],
+                                                    policyLayer1i16[0],
+                                                    policyLayer1i16[1],
+                                                    policyLayer1i16[2],
+                                                    policyLayer1i16[3],
+                                                    pwconv2Weighti16,
+                                                    pwconv2Biasi32);
+        for (int k = 0; k < 4; k++)
+            policyBuffer(cellInnerIdx[i + k]) = policyOutput(policyLayer2i32[k]);
+    }
+
+    // Compute the remaining cells one by one
+    for (; i < numCells; i++) {
+        alignas(Alignment) int32_t policyLayer1i32[PolicyLMidDim];
+        alignas(Alignment) int16_t policyLayer1i16[PolicyLMidDim];
+        simd::linear<PolicyLMidDim, PolicyLInDim, false, true, true>(policyLayer1i32,
+                                                                     cellMapConv[i],
+                                                                     pwconv1Weighti16,
+                                                                     pwconv1Biasi32);
+        simd::crelu<PolicyLMidDim, 128 * 128, false, Alignment, ITPolicyLMid>(policyLayer1i16,
+                                                                              policyLayer1i32);
+
+        alignas(Alignment) int32_t policyLayer2i32[PolicyLOutDim];
+        simd::linear<PolicyLOutDim, PolicyLMidDim>(policyLayer2i32,
+                                                   policyLayer1i16,
+                                                   pwconv2Weighti16,
+                                                   pwconv2Biasi32);
+        policyBuffer(cellInnerIdx[i]) = policyOutput(policyLayer2i32);
     }
 }
 
@@ -941,14 +1146,19 @@ Evaluator::Evaluator(int                   boardSize,
     : Evaluation::Evaluator(boardSize, rule)
     , weight {nullptr, nullptr}
 {
-    CompressedWrapper<StandardHeaderLoader<Mix10WeightLoader>> loader(
+    PreprocessedCacheWrapper<CompressedWrapper<StandardHeaderLoader<Mix10WeightLoader>>> loader(
         Compressor::Type::LZ4_DEFAULT);
+    loader.setCacheDirectory(Config::WeightCacheDirectory);
+    loader.setSharedMemory(Config::WeightSharedMemory);
+    // Signed input offset changes the preprocessed bias, so it is part of the layout
+    loader.setCacheTag(std::string("mix10-") + simd::instTypeName(simd::NativeInstType)
+                       + (simd::SignedInputOffset ? "-vnni" : ""));
 
     if (boardSize > 22)
         throw UnsupportedBoardSizeError(boardSize);
 
-    Time startTime     = now();
-    bool printLoadInfo = false;
+    Time              startTime = now();
+    std::atomic<bool> printLoadInfo {false};
     loader.setHeaderValidator([&](StandardHeader header, auto &args) -> bool {
         constexpr uint32_t ArchHash =
             ArchHashBase ^ (((ValueDim / 8) << 16) | ((FeatDWConvDim / 8) << 8) | (FeatureDim / 8));
@@ -968,17 +1178,27 @@ Evaluator::Evaluator(int                   boardSize,
         return true;
     });
 
+    // Weights of both sides are independent, so they are loaded in parallel
+    auto weights = weightRegistry().loadWeightsFromFiles(
+        loader,
+        {
+            {blackWeightPath, {{}, boardSize, rule, blackWeightPath}},
+            {whiteWeightPath, {{}, boardSize, rule, whiteWeightPath}},
+        },
+        numaNodeId);
+    weight[BLACK] = weights[0];
+    weight[WHITE] = weights[1];
     for (const auto &[weightSide, weightPath] : {
              std::make_pair(BLACK, blackWeightPath),
              std::make_pair(WHITE, whiteWeightPath),
          }) {
-        weight[weightSide] = WeightReg.loadWeightFromFile(loader,
-                                                          weightPath,
-                                                          numaNodeId,
-                                                          {{}, boardSize, rule, weightPath});
-        if (!weight[weightSide])
+        if (!weight[weightSide]) {
+            for (Color side : {BLACK, WHITE})
+                if (weight[side])
+                    weightRegistry().unloadWeight(weight[side]);
             throw std::runtime_error("failed to load nnue weight from "
                                      + pathToConsoleString(weightPath));
+        }
     }
 
     if (printLoadInfo)
@@ -995,9 +1215,9 @@ Evaluator::Evaluator(int                   boardSize,
 Evaluator::~Evaluator()
 {
     if (weight[BLACK])
-        WeightReg.unloadWeight(weight[BLACK]);
+        weightRegistry().unloadWeight(weight[BLACK]);
     if (weight[WHITE])
-        WeightReg.unloadWeight(weight[WHITE]);
+        weightRegistry().unloadWeight(weight[WHITE]);
 }
 
 void Evaluator::initEmptyBoard()
@@ -1018,15 +1238,24 @@ void Evaluator::afterUndo(const Board &board, Pos pos)
     addCache(board.sideToMove(), pos.x(), pos.y(), true);
 }
 
+void Evaluator::applyPendingUpdates(const Board &board)
+{
+    clearCache(BLACK, board);
+    clearCache(WHITE, board);
+}
+
 ValueType Evaluator::evaluateValue(const Board &board, AccLevel level)
 {
     Color self = board.sideToMove(), oppo = ~self;
 
     // Apply all incremental update for both sides and calculate value
-    clearCache(self);
-    auto [win, loss, draw, _] = accumulator[self]->evaluateValueLarge(*weight[self]);
+    clearCache(self, board);
+    // Only the best level uses the large head, other levels use the small head
+    auto [win, loss, draw, uncertainty] =
+        level == ACC_LEVEL_BEST ? accumulator[self]->evaluateValueLarge(*weight[self])
+                                : accumulator[self]->evaluateValueSmall(*weight[self]);
 
-    return ValueType(win, loss, draw, true);
+    return ValueType(win, loss, draw, true).withUncertainty(uncertainty);
 }
 
 void Evaluator::evaluatePolicy(const Board &board, PolicyBuffer &policyBuffer, AccLevel level)
@@ -1034,26 +1263,64 @@ void Evaluator::evaluatePolicy(const Board &board, PolicyBuffer &policyBuffer, A
     Color self = board.sideToMove();
 
     // Apply all incremental update and calculate policy
-    clearCache(self);
-    accumulator[self]->evaluatePolicyLarge(*weight[self], policyBuffer);
+    clearCache(self, board);
+    if (level == ACC_LEVEL_BEST)
+        accumulator[self]->evaluatePolicyLarge(*weight[self], policyBuffer);
+    else
+        accumulator[self]->evaluatePolicySmall(*weight[self], policyBuffer);
 }
 
-void Evaluator::clearCache(Color side)
+void Evaluator::clearCache(Color side, const Board &board)
 {
-    constexpr Color opponentMap[4] = {WHITE, BLACK, WALL, EMPTY};
+    Accumulator &acc   = *accumulator[side];
+    auto        &cache = moveCache[side];
+
+    // Pending updates are always some undos followed by some moves, as
+    // contrary updates cancel out each other when they are added.
+    int numUndo = 0;
+    while (numUndo < int(cache.size()) && cache[numUndo].oldColor != EMPTY)
+        numUndo++;
+    int numMove       = int(cache.size()) - numUndo;
+    int targetVersion = acc.version() - numUndo + numMove;
+    int baseVersion   = acc.lastValidVersion(acc.version() - numUndo);
+    int numReplay     = targetVersion - baseVersion;
+    assert(targetVersion == board.nonPassMoveCount());
+
+    cache.clear();
+    acc.rollback(baseVersion);
+    updateStats.numSyncs++;
+    updateStats.numPendingMoves += numMove;
+    if (numReplay == 0)
+        return;
 
-    for (MoveCache &mc : moveCache[side]) {
-        if (side == WHITE) {
-            mc.oldColor = opponentMap[mc.oldColor];
-            mc.newColor = opponentMap[mc.newColor];
-        }
+    // Restore the state from snapshot table to skip a long replay
+    const int  minReplay   = Config::EvaluatorSnapshotMinReplay;
+    const bool useSnapshot = minReplay > 0 && numReplay >= minReplay;
+    HashKey    key         = board.zobristKey();
+    uint64_t   stoneHash   = useSnapshot ? board.stoneHash() : 0;
+    if (useSnapshot && acc.restoreSnapshot(key, stoneHash, targetVersion)) {
+        updateStats.numSnapshotRestores++;
+        return;
+    }
 
-        if (mc.oldColor == EMPTY)
-            accumulator[side]->move(*weight[side], mc.newColor, mc.x, mc.y);
-        else
-            accumulator[side]->undo();
+    // Replay the last moves on board from the base version. This might include more
+    // moves than the cache if the versions skipped by a restored version are undone.
+    int startPly = board.ply();
+    for (int n = numReplay; n > 0;)
+        if (board.getHistoryMove(--startPly) != Pos::PASS)
+            n--;
+    for (int i = startPly; i < board.ply(); i++) {
+        Pos pos = board.getHistoryMove(i);
+        if (pos == Pos::PASS)
+            continue;
+
+        Color pieceColor = side == WHITE ? ~board.get(pos) : board.get(pos);
+        acc.move(*weight[side], pieceColor, pos.x(), pos.y());
     }
-    moveCache[side].clear();
+    updateStats.numReplayedMoves += numReplay;
+
+    if (useSnapshot)
+        acc.saveSnapshot(key, stoneHash);
 }
 
 void Evaluator::addCache(Color side, int x, int y, bool isUndo)
@@ -1075,4 +1342,20 @@ void Evaluator::addCache(Color side, int x, int y, bool isUndo)
     }
 }
 
+#ifdef EVAL_ISA
+std::unique_ptr<Evaluation::Evaluator> createEvaluator(int                   boardSize,
+                                                       Rule                  rule,
+                                                       Numa::NumaNodeId      numaNodeId,
+                                                       std::filesystem::path blackWeightPath,
+                                                       std::filesystem::path whiteWeightPath)
+{
+    return std::make_unique<Evaluator>(boardSize,
+                                       rule,
+                                       numaNodeId,
+                                       std::move(blackWeightPath),
+                                       std::move(whiteWeightPath));
+}
+#endif
+
+EVAL_ISA_NAMESPACE_END
 }  // namespace Evaluation::mix10
@@ -29,6 +29,7 @@
 #include <vector>
 
 namespace Evaluation::mix10 {
+EVAL_ISA_NAMESPACE_BEGIN
 
 using namespace Evaluation;
 
@@ -136,11 +137,32 @@ public:
     Accumulator(int boardSize);
     ~Accumulator();
 
+    /// Number of slots in the snapshot table.
+    static constexpr int NumSnapshots = 16;
+    /// Max number of restored versions that can be in the version stack at the same time.
+    /// A restored version takes a full copy of the state instead of the changed part.
+    static constexpr int MaxRestoredVersions = 4;
+
     /// Init accumulator state to empty board.
     void clear(const Weight &w);
     /// Incremental update mix6 network state.
     void move(const Weight &w, Color pieceColor, int x, int y);
     void undo() { currentVersion--; }
+    /// Roll back to a previous version, which must not be above the current version.
+    void rollback(int version) { currentVersion = version; }
+    /// Current version, which equals to the number of stones on board.
+    int version() const { return currentVersion; }
+    /// Get the highest version not above the given version that has a valid state.
+    int lastValidVersion(int version) const;
+
+    /// Save current network state to the snapshot table. A state is identified by both
+    /// the zobrist key and the stone hash of the board, so that a collision of zobrist
+    /// keys can not restore the state of another position.
+    void saveSnapshot(HashKey key, uint64_t stoneHash);
+    /// Restore network state from the snapshot table as the given version. Versions
+    /// between the current version and the restored version are no longer valid.
+    /// @return Whether the state is found in the snapshot table and restored.
+    bool restoreSnapshot(HashKey key, uint64_t stoneHash, int version);
 
     void updateSharedSmallHead(const Weight &w);
     void updateSharedLargeHead(const Weight &w);
@@ -174,6 +196,20 @@ private:
     std::array<int16_t, FeatureDim> *mapSum;  // [N_inner, FeatureDim] (aligned)
     /// Map feature after depth wise conv
     std::array<int16_t, FeatDWConvDim> *mapConv;  // [N_outer, DWConvDim] (aligned)
+    /// Whether the state of a version is valid, and whether it is restored from snapshot
+    bool *versionValid;     // [H*W+1]
+    bool *versionRestored;  // [H*W+1]
+
+    //=============================================================
+    // Snapshot table
+
+    HashKey                            *snapshotKey;         // [N_snapshot]
+    uint64_t                           *snapshotStoneHash;   // [N_snapshot]
+    int                                *snapshotVersion;     // [N_snapshot] (-1 for empty)
+    ValueSumType                       *snapshotValueSum;    // [N_snapshot] (aligned)
+    std::array<uint32_t, 4>            *snapshotIndexTable;  // [N_snapshot, H*W] (unaligned)
+    std::array<int16_t, FeatureDim>    *snapshotMapSum;      // [N_snapshot, H*W] (aligned)
+    std::array<int16_t, FeatDWConvDim> *snapshotMapConv;     // [N_snapshot, (H+2)*(W+2)] (aligned)
 
     //=============================================================
     int    boardSize;
@@ -183,6 +219,14 @@ private:
 
     void initIndexTable();
     int  getBucketIndex() { return 0; }
+
+    /// Calculate the input of large value linear 1 from the value feature sum.
+    void evaluateLargeValueFeature(const Weight::HeadBucket &bucket, int8_t layer0[]);
+    /// Calculate large policy value of all cells from output of the pwconv weight layers.
+    void evaluatePolicyLargeOutput(const Weight::HeadBucket &bucket,
+                                   const int32_t             layer2i32[],
+                                   const int32_t             layer3i32[],
+                                   PolicyBuffer             &policyBuffer);
 };
 
 class Evaluator : public Evaluation::Evaluator
@@ -198,9 +242,14 @@ public:
     void initEmptyBoard();
     void beforeMove(const Board &board, Pos pos);
     void afterUndo(const Board &board, Pos pos);
+    void applyPendingUpdates(const Board &board);
 
     ValueType evaluateValue(const Board &board, AccLevel level);
     void      evaluatePolicy(const Board &board, PolicyBuffer &policyBuffer, AccLevel level);
+    /// Best level uses the large heads, and other levels use the small heads.
+    int         getNumValueAccLevel() const { return 2; }
+    int         getNumPolicyAccLevel() const { return 2; }
+    UpdateStats getUpdateStats() const { return updateStats; }
 
 private:
     struct MoveCache
@@ -217,13 +266,24 @@ private:
     };
 
     /// Clear all caches to sync accumulator state with current board state.
-    void clearCache(Color side);
+    void clearCache(Color side, const Board &board);
     /// Record new board action, but not update accumulator instantly.
     void addCache(Color side, int x, int y, bool isUndo);
 
     Weight /* non-owning ptr */ *weight[2];
     std::unique_ptr<Accumulator> accumulator[2];
     std::vector<MoveCache>       moveCache[2];
+    UpdateStats                  updateStats {};
 };
 
+#ifdef EVAL_ISA
+/// Create an evaluator with kernels of this instruction set (used by runtime dispatch).
+std::unique_ptr<Evaluation::Evaluator> createEvaluator(int                   boardSize,
+                                                       Rule                  rule,
+                                                       Numa::NumaNodeId      numaNodeId,
+                                                       std::filesystem::path blackWeightPath,
+                                                       std::filesystem::path whiteWeightPath);
+#endif
+
+EVAL_ISA_NAMESPACE_END
 }  // namespace Evaluation::mix10
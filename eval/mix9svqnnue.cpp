@@ -18,6 +18,8 @@
 
 #include "mix9svqnnue.h"
 
+#include "../config.h"
+#include "../core/hash.h"
 #include "../core/iohelper.h"
 #include "../core/platform.h"
 #include "../core/utils.h"
@@ -149,11 +151,19 @@ struct Mix9svqWeightLoader : WeightLoader<mix9svq::Weight>
     {
         simd::preprocessLinear<OutSize * 2, InSize>(b.value_corner_up1.weight);
         simd::preprocessLinear<OutSize * 2, InSize>(b.value_corner_up2.weight);
+        simd::preprocessLinearSignedInputBias<OutSize, OutSize>(b.value_corner_down.weight,
+                                                                b.value_corner_down.bias);
         simd::preprocessLinear<OutSize, OutSize>(b.value_corner_down.weight);
     }
 };
 
-static Evaluation::WeightRegistry<StandardHeaderLoader<Mix9svqWeightLoader>> WeightReg;
+/// Weight registry is constructed on first use, so that nothing of a kernel variant
+/// not supported by the CPU is executed at startup in runtime dispatch builds.
+auto &weightRegistry()
+{
+    static Evaluation::WeightRegistry<StandardHeaderLoader<Mix9svqWeightLoader>> WeightReg;
+    return WeightReg;
+}
 
 constexpr int                   Alignment = simd::NativeAlignment;
 constexpr simd::InstructionType IT        = simd::NativeInstType;
@@ -171,82 +181,6 @@ using I16Op = simd::detail::VecOp<int16_t, IT>;
 using I32Op = simd::detail::VecOp<int32_t, IT>;
 using F32Op = simd::detail::VecOp<float, IT>;
 
-
-
-template <int OutSize, int InSize, bool SignedInput = false>
-inline void linear4(int32_t *output0,
-                    int32_t *output1,
-                    int32_t *output2,
-                    int32_t *output3,
-                    const int8_t *input0,
-                    const int8_t *input1,
-                    const int8_t *input2,
-                    const int8_t *input3,
-                    const int8_t *weight,
-                    const int32_t *bias)
-{
-    using I8LS  = simd::detail::VecLoadStore<int8_t, Alignment, IT>;
-    using I32LS = simd::detail::VecLoadStore<int32_t, Alignment, IT>;
-    using I8Op  = simd::detail::VecOp<int8_t, IT>;
-    using I32Op = simd::detail::VecOp<int32_t, IT>;
-
-    using OutB = Batch<OutSize, int32_t>;
-    using InB  = Batch<InSize, int8_t>;
-
-    typename I32Op::R acc0[OutB::NumBatch];
-    typename I32Op::R acc1[OutB::NumBatch];
-    typename I32Op::R acc2[OutB::NumBatch];
-    typename I32Op::R acc3[OutB::NumBatch];
-
-    for (int j = 0; j < OutB::NumBatch; j++) {
-        auto b  = I32LS::load(bias + j * OutB::RegWidth);
-        acc0[j] = b;
-        acc1[j] = b;
-        acc2[j] = b;
-        acc3[j] = b;
-    }
-
-    constexpr int ChunkSize = 4;
-    constexpr int NumChunks = InSize / ChunkSize;
-    static_assert(InSize % ChunkSize == 0, "InSize must be a multiple of ChunkSize=4");
-
-    const auto input0_32 = reinterpret_cast<const int32_t *>(input0);
-    const auto input1_32 = reinterpret_cast<const int32_t *>(input1);
-    const auto input2_32 = reinterpret_cast<const int32_t *>(input2);
-    const auto input3_32 = reinterpret_cast<const int32_t *>(input3);
-
-    for (int i = 0; i < NumChunks; i++) {
-        auto in0 = typename I8Op::R(I32Op::set1(input0_32[i]));
-        auto in1 = typename I8Op::R(I32Op::set1(input1_32[i]));
-        auto in2 = typename I8Op::R(I32Op::set1(input2_32[i]));
-        auto in3 = typename I8Op::R(I32Op::set1(input3_32[i]));
-
-        auto wBase = reinterpret_cast<const typename I8Op::R *>(weight + i * OutSize * ChunkSize);
-
-        for (int j = 0; j < OutB::NumBatch; j++) {
-            auto w = I8LS::load(&wBase[j]);
-            if constexpr (SignedInput) {
-                I8Op::dot4_i8i8_accum(acc0[j], in0, w);
-                I8Op::dot4_i8i8_accum(acc1[j], in1, w);
-                I8Op::dot4_i8i8_accum(acc2[j], in2, w);
-                I8Op::dot4_i8i8_accum(acc3[j], in3, w);
-            } else {
-                I8Op::dot4_u7i8_accum(acc0[j], in0, w);
-                I8Op::dot4_u7i8_accum(acc1[j], in1, w);
-                I8Op::dot4_u7i8_accum(acc2[j], in2, w);
-                I8Op::dot4_u7i8_accum(acc3[j], in3, w);
-            }
-        }
-    }
-
-    for (int j = 0; j < OutB::NumBatch; j++) {
-        I32LS::store(output0 + j * OutB::RegWidth, acc0[j]);
-        I32LS::store(output1 + j * OutB::RegWidth, acc1[j]);
-        I32LS::store(output2 + j * OutB::RegWidth, acc2[j]);
-        I32LS::store(output3 + j * OutB::RegWidth, acc3[j]);
-    }
-}
-
 template <int OutSize, int InSize>
 inline void starBlock4(int8_t *output0,
                        int8_t *output1,
@@ -269,16 +203,16 @@ inline void starBlock4(int8_t *output0,
     alignas(Alignment) int8_t up1_3[OutSize * 2], up2_3[OutSize * 2];
 
     // Corner Up 1
-    linear4<OutSize * 2, InSize, false>(upi32_0,
-                                        upi32_1,
-                                        upi32_2,
-                                        upi32_3,
-                                        input0,
-                                        input1,
-                                        input2,
-                                        input3,
-                                        w.value_corner_up1.weight,
-                                        w.value_corner_up1.bias);
+    simd::linear4<OutSize * 2, InSize, false>(upi32_0,
+                                              upi32_1,
+                                              upi32_2,
+                                              upi32_3,
+                                              input0,
+                                              input1,
+                                              input2,
+                                              input3,
+                                              w.value_corner_up1.weight,
+                                              w.value_corner_up1.bias);
 
     simd::crelu<OutSize * 2, 128>(up1_0, upi32_0);
     simd::crelu<OutSize * 2, 128>(up1_1, upi32_1);
@@ -286,16 +220,16 @@ inline void starBlock4(int8_t *output0,
     simd::crelu<OutSize * 2, 128>(up1_3, upi32_3);
 
     // Corner Up 2
-    linear4<OutSize * 2, InSize, false>(upi32_0,
-                                        upi32_1,
-                                        upi32_2,
-                                        upi32_3,
-                                        input0,
-                                        input1,
-                                        input2,
-                                        input3,
-                                        w.value_corner_up2.weight,
-                                        w.value_corner_up2.bias);
+    simd::linear4<OutSize * 2, InSize, false>(upi32_0,
+                                              upi32_1,
+                                              upi32_2,
+                                              upi32_3,
+                                              input0,
+                                              input1,
+                                              input2,
+                                              input3,
+                                              w.value_corner_up2.weight,
+                                              w.value_corner_up2.bias);
 
     simd::crelu<OutSize * 2, 128, true>(up2_0, upi32_0);
     simd::crelu<OutSize * 2, 128, true>(up2_1, upi32_1);
@@ -318,16 +252,16 @@ inline void starBlock4(int8_t *output0,
     alignas(Alignment) int32_t outputi32_3[OutSize];
 
     // Corner Down (SignedInput=true)
-    linear4<OutSize, OutSize, true>(outputi32_0,
-                                    outputi32_1,
-                                    outputi32_2,
-                                    outputi32_3,
-                                    dotsum0,
-                                    dotsum1,
-                                    dotsum2,
-                                    dotsum3,
-                                    w.value_corner_down.weight,
-                                    w.value_corner_down.bias);
+    simd::linear4<OutSize, OutSize, true>(outputi32_0,
+                                          outputi32_1,
+                                          outputi32_2,
+                                          outputi32_3,
+                                          dotsum0,
+                                          dotsum1,
+                                          dotsum2,
+                                          dotsum3,
+                                          w.value_corner_down.weight,
+                                          w.value_corner_down.bias);
 
     simd::crelu<OutSize, 128>(output0, outputi32_0);
     simd::crelu<OutSize, 128>(output1, outputi32_1);
@@ -364,9 +298,22 @@ starBlock(int8_t output[OutSize], int8_t input[InSize], const StarBlockWeight<Ou
     simd::crelu<OutSize, 128>(output, outputi32);
 }
 
+/// Calculate the final value (win/loss/draw) from the output of value linear 2.
+inline std::tuple<float, float, float> valueOutput(const Weight::HeadBucket &bucket,
+                                                   const int8_t              layer2[ValueDim])
+{
+    // linear 3 final
+    alignas(Alignment) int32_t layer3i32[4];
+    simd::linear<4, ValueDim>(layer3i32, layer2, bucket.value_l3.weight, bucket.value_l3.bias);
+
+    const float scale = 1.0f / (128 * 128);
+    return {layer3i32[0] * scale, layer3i32[1] * scale, layer3i32[2] * scale};
+}
+
 }  // namespace
 
 namespace Evaluation::mix9svq {
+EVAL_ISA_NAMESPACE_BEGIN
 
 Accumulator::Accumulator(int boardSize)
     : boardSize(boardSize)
@@ -374,8 +321,9 @@ Accumulator::Accumulator(int boardSize)
     , currentVersion(-1)
 {
     int nCells        = boardSize * boardSize;
-    int nInnerChanges = MaxInnerChanges[boardSize];
-    int nOuterChanges = MaxOuterChanges[boardSize];
+    int nOuterCells   = outerBoardSize * outerBoardSize;
+    int nInnerChanges = MaxInnerChanges[boardSize] + MaxRestoredVersions * nCells;
+    int nOuterChanges = MaxOuterChanges[boardSize] + MaxRestoredVersions * nOuterCells;
 
     valueSumTable          = MemAlloc::alignedArrayAlloc<ValueSumType, Alignment>(nCells + 1);
     versionChangeNumTable  = new ChangeNum[nCells + 1];
@@ -385,6 +333,24 @@ Accumulator::Accumulator(int boardSize)
     mapSum = MemAlloc::alignedArrayAlloc<std::array<int16_t, FeatureDim>, Alignment>(nInnerChanges);
     mapConv =
         MemAlloc::alignedArrayAlloc<std::array<int16_t, FeatDWConvDim>, Alignment>(nOuterChanges);
+    versionValid    = new bool[nCells + 1];
+    versionRestored = new bool[nCells + 1];
+
+    snapshotKey        = new HashKey[NumSnapshots];
+    snapshotStoneHash  = new uint64_t[NumSnapshots];
+    snapshotVersion    = new int[NumSnapshots];
+    snapshotValueSum   = MemAlloc::alignedArrayAlloc<ValueSumType, Alignment>(NumSnapshots);
+    snapshotIndexTable = new std::array<uint32_t, 4>[NumSnapshots * nCells];
+    snapshotMapSum     = MemAlloc::alignedArrayAlloc<std::array<int16_t, FeatureDim>, Alignment>(
+        NumSnapshots * nCells);
+    snapshotMapConv = MemAlloc::alignedArrayAlloc<std::array<int16_t, FeatDWConvDim>, Alignment>(
+        NumSnapshots * nOuterCells);
+
+    // Only version 0 is valid before any move, and all snapshot slots are empty
+    std::fill_n(versionValid, nCells + 1, false);
+    std::fill_n(versionRestored, nCells + 1, false);
+    std::fill_n(snapshotVersion, NumSnapshots, -1);
+    versionValid[0] = true;
 
     // Compute group index based on board pos
     std::fill_n(groupIndex, arraySize(groupIndex), 0);
@@ -414,6 +380,15 @@ Accumulator::~Accumulator()
     delete[] indexTable;
     MemAlloc::alignedFree(mapSum);
     MemAlloc::alignedFree(mapConv);
+    delete[] versionValid;
+    delete[] versionRestored;
+    delete[] snapshotKey;
+    delete[] snapshotStoneHash;
+    delete[] snapshotVersion;
+    MemAlloc::alignedFree(snapshotValueSum);
+    delete[] snapshotIndexTable;
+    MemAlloc::alignedFree(snapshotMapSum);
+    MemAlloc::alignedFree(snapshotMapConv);
 }
 
 void Accumulator::initIndexTable()
@@ -788,6 +763,8 @@ void Accumulator::move(const Weight &w, Color pieceColor, int x, int y)
     // Move to next version
     currentVersion++;
     versionChangeNumTable[currentVersion] = {uint16_t(newMapIdx), uint16_t(newMapConvIdx)};
+    versionValid[currentVersion]          = true;
+    versionRestored[currentVersion]       = false;
 
     // Store value sum
     auto &valueSumOld = valueSumTable[currentVersion - 1];
@@ -806,14 +783,82 @@ void Accumulator::move(const Weight &w, Color pieceColor, int x, int y)
             }
 }
 
-std::tuple<float, float, float> Accumulator::evaluateValue(const Weight &w)
+int Accumulator::lastValidVersion(int version) const
+{
+    while (!versionValid[version])
+        version--;
+    return version;
+}
+
+void Accumulator::saveSnapshot(HashKey key, uint64_t stoneHash)
+{
+    const int nCells      = boardSize * boardSize;
+    const int nOuterCells = outerBoardSize * outerBoardSize;
+    const int slot        = Hash::indexBits(key) % NumSnapshots;
+    const int innerBase   = currentVersion * nCells;
+    const int outerBase   = currentVersion * nOuterCells;
+
+    snapshotKey[slot]       = key;
+    snapshotStoneHash[slot] = stoneHash;
+    snapshotVersion[slot]   = currentVersion;
+    snapshotValueSum[slot]  = valueSumTable[currentVersion];
+    for (int i = 0; i < nCells; i++) {
+        int mapIdx                            = versionInnerIndexTable[innerBase + i];
+        snapshotIndexTable[slot * nCells + i] = indexTable[mapIdx];
+        snapshotMapSum[slot * nCells + i]     = mapSum[mapIdx];
+    }
+    for (int i = 0; i < nOuterCells; i++)
+        snapshotMapConv[slot * nOuterCells + i] = mapConv[versionOuterIndexTable[outerBase + i]];
+}
+
+bool Accumulator::restoreSnapshot(HashKey key, uint64_t stoneHash, int version)
+{
+    const int slot = Hash::indexBits(key) % NumSnapshots;
+    if (snapshotVersion[slot] != version || snapshotKey[slot] != key
+        || snapshotStoneHash[slot] != stoneHash)
+        return false;
+
+    // Make sure the full copy of state still fits in the change tables
+    if (std::count(versionRestored, versionRestored + currentVersion + 1, true)
+        >= MaxRestoredVersions)
+        return false;
+
+    const int       nCells      = boardSize * boardSize;
+    const int       nOuterCells = outerBoardSize * outerBoardSize;
+    const int       innerBase   = version * nCells;
+    const int       outerBase   = version * nOuterCells;
+    const ChangeNum changeNum   = versionChangeNumTable[currentVersion];
+
+    for (int i = 0; i < nCells; i++) {
+        int mapIdx                            = changeNum.inner + i;
+        indexTable[mapIdx]                    = snapshotIndexTable[slot * nCells + i];
+        mapSum[mapIdx]                        = snapshotMapSum[slot * nCells + i];
+        versionInnerIndexTable[innerBase + i] = mapIdx;
+    }
+    for (int i = 0; i < nOuterCells; i++) {
+        int mapConvIdx                        = changeNum.outer + i;
+        mapConv[mapConvIdx]                   = snapshotMapConv[slot * nOuterCells + i];
+        versionOuterIndexTable[outerBase + i] = mapConvIdx;
+    }
+    valueSumTable[version]         = snapshotValueSum[slot];
+    versionChangeNumTable[version] = {uint16_t(changeNum.inner + nCells),
+                                      uint16_t(changeNum.outer + nOuterCells)};
+
+    // Versions skipped by the restored version have no valid state
+    std::fill(versionValid + currentVersion + 1, versionValid + version, false);
+    std::fill(versionRestored + currentVersion + 1, versionRestored + version, false);
+    versionValid[version]    = true;
+    versionRestored[version] = true;
+    currentVersion           = version;
+    return true;
+}
+
+void Accumulator::evaluateValueFeature(const Weight::HeadBucket &bucket, int8_t layer0[])
 {
     const auto &valueSum = valueSumTable[currentVersion];
-    const auto &bucket   = w.buckets[getBucketIndex()];
 
     // convert value sum from int32 to int8
     // global feature sum
-    alignas(Alignment) int8_t layer0[FeatureDim + ValueDim * 4];
     simd::crelu<FeatureDim, 256, true>(layer0, valueSum.global.data());
     // group feature sum
     alignas(Alignment) int8_t group0[ValueSumType::NGroup][ValueSumType::NGroup][FeatureDim];
@@ -881,6 +926,14 @@ std::tuple<float, float, float> Accumulator::evaluateValue(const Weight &w)
                                    group2[1][0],
                                    group2[1][1],
                                    bucket.value_quad);
+}
+
+std::tuple<float, float, float> Accumulator::evaluateValue(const Weight &w)
+{
+    const auto &bucket = w.buckets[getBucketIndex()];
+
+    alignas(Alignment) int8_t layer0[FeatureDim + ValueDim * 4];
+    evaluateValueFeature(bucket, layer0);
 
     // linear 1
     alignas(Alignment) int32_t layer1i32[ValueDim];
@@ -900,12 +953,7 @@ std::tuple<float, float, float> Accumulator::evaluateValue(const Weight &w)
                                      bucket.value_l2.bias);
     simd::crelu<ValueDim, 128>(layer2, layer2i32);
 
-    // linear 3 final
-    alignas(Alignment) int32_t layer3i32[4];
-    simd::linear<4, ValueDim>(layer3i32, layer2, bucket.value_l3.weight, bucket.value_l3.bias);
-
-    const float scale = 1.0f / (128 * 128);
-    return {layer3i32[0] * scale, layer3i32[1] * scale, layer3i32[2] * scale};
+    return valueOutput(bucket, layer2);
 }
 
 void Accumulator::evaluatePolicy(const Weight &w, PolicyBuffer &policyBuffer)
@@ -926,13 +974,21 @@ void Accumulator::evaluatePolicy(const Weight &w, PolicyBuffer &policyBuffer)
     simd::crelu<PolicyDim * 2, 128>(layer1, layer1i32);
 
     alignas(Alignment) int32_t layer2i32[PolicyPWConvDim * PolicyDim + PolicyPWConvDim];
-    alignas(Alignment) int16_t pwconvWeighti16[PolicyPWConvDim * PolicyDim];
-    alignas(Alignment) int32_t pwconvBiasi32[PolicyPWConvDim];
     simd::linear<PolicyPWConvDim * PolicyDim + PolicyPWConvDim, PolicyDim * 2>(
         layer2i32,
         layer1,
         bucket.policy_pwconv_layer_l2.weight,
         bucket.policy_pwconv_layer_l2.bias);
+
+    evaluatePolicyOutput(bucket, layer2i32, policyBuffer);
+}
+
+void Accumulator::evaluatePolicyOutput(const Weight::HeadBucket &bucket,
+                                       const int32_t             layer2i32[],
+                                       PolicyBuffer             &policyBuffer)
+{
+    alignas(Alignment) int16_t pwconvWeighti16[PolicyPWConvDim * PolicyDim];
+    alignas(Alignment) int32_t pwconvBiasi32[PolicyPWConvDim];
     simd::crelu<PolicyPWConvDim * PolicyDim, 1, true>(pwconvWeighti16, layer2i32);
     // To get pwconv bias, we need to scale the output of layer2 by 128
     {
@@ -944,7 +1000,11 @@ void Accumulator::evaluatePolicy(const Weight &w, PolicyBuffer &policyBuffer)
         }
     }
 
-    const int outerVersionIdxBase = currentVersion * outerBoardSize * outerBoardSize;
+    // Gather cells to compute, so that they can be processed in groups of four
+    int            numCells = 0;
+    uint16_t       cellInnerIdx[MAX_MOVES];
+    const int16_t *cellMapConv[MAX_MOVES];
+    const int      outerVersionIdxBase = currentVersion * outerBoardSize * outerBoardSize;
     for (int y = 0, innerIdx = 0, outerIdx = outerBoardSize + 1; y < boardSize;
          y++, outerIdx += 2) {
         for (int x = 0; x < boardSize; x++, innerIdx++, outerIdx++) {
@@ -952,31 +1012,53 @@ void Accumulator::evaluatePolicy(const Weight &w, PolicyBuffer &policyBuffer)
                 continue;
 
             // Get mapConv index of current version at this point
-            int mapConvIdx = versionOuterIndexTable[outerVersionIdxBase + outerIdx];
-
-            // Compute dynamic point-wise policy conv
-            // static_assert(PolicyDim <= FeatDWConvDim,
-            //               "Assume PolicyDim <= FeatDWConvDim in evaluatePolicy()!");
-            alignas(Alignment) int32_t policyLayer1i32[PolicyPWConvDim];
-            simd::linear<PolicyPWConvDim, PolicyDim, false, true, true>(policyLayer1i32,
-                                                                        mapConv[mapConvIdx].data(),
-                                                                        pwconvWeighti16,
-                                                                        pwconvBiasi32);
-
-            // Apply relu, convert to float and accumulate all channels of pwconv feature
-            typedef Batch<PolicyPWConvDim, float> PWConvB;
-            auto                                  policyAccum = F32Op::setzero();
-            for (int i = 0; i < PWConvB::NumBatch; i++) {
-                auto featI32 = I32LS::load(policyLayer1i32 + i * PWConvB::RegWidth);
-                featI32      = I32Op::max(featI32, I32Op::setzero());
-                auto featF32 = Convert<int32_t, float>::convert1(featI32);
-                auto outputW = F32LS::load(bucket.policy_output_weight + i * PWConvB::RegWidth);
-                policyAccum  = F32Op::fmadd(featF32, outputW, policyAccum);
-            }
+            int mapConvIdx         = versionOuterIndexTable[outerVersionIdxBase + outerIdx];
+            cellInnerIdx[numCells] = innerIdx;
+            cellMapConv[numCells]  = mapConv[mapConvIdx].data();
+            numCells++;
+        }
+    }
 
-            float policy           = F32Op::reduceadd(policyAccum) + bucket.policy_output_bias;
-            policyBuffer(innerIdx) = policy;
+    // Apply relu, convert to float and accumulate all channels of pwconv feature
+    auto policyOutput = [&](const int32_t policyLayer1i32[PolicyPWConvDim]) {
+        typedef Batch<PolicyPWConvDim, float> PWConvB;
+        auto                                  policyAccum = F32Op::setzero();
+        for (int i = 0; i < PWConvB::NumBatch; i++) {
+            auto featI32 = I32LS::load(policyLayer1i32 + i * PWConvB::RegWidth);
+            featI32      = I32Op::max(featI32, I32Op::setzero());
+            auto featF32 = Convert<int32_t, float>::convert1(featI32);
+            auto outputW = F32LS::load(bucket.policy_output_weight + i * PWConvB::RegWidth);
+            policyAccum  = F32Op::fmadd(featF32, outputW, policyAccum);
         }
+        return F32Op::reduceadd(policyAccum) + bucket.policy_output_bias;
+    };
+
+    // Compute dynamic point-wise policy conv for four cells at once
+    int i = 0;
+    for (; i + 4 <= numCells; i += 4) {
+        alignas(Alignment) int32_t policyLayer1i32[4][PolicyPWConvDim];
+        simd::linear4<PolicyPWConvDim, PolicyDim, false, true>(policyLayer1i32[0],
+                                                               policyLayer1i32[1],
+                                                               policyLayer1i32[2],
+                                                               policyLayer1i32[3],
+                                                               cellMapConv[i + 0],
+                                                               cellMapConv[i + 1],
+                                                               cellMapConv[i + 2],
+                                                               cellMapConv[i + 3],
+                                                               pwconvWeighti16,
+                                                               pwconvBiasi32);
+        for (int k = 0; k < 4; k++)
+            policyBuffer(cellInnerIdx[i + k]) = policyOutput(policyLayer1i32[k]);
+    }
+
+    // Compute the remaining cells one by one
+    for (; i < numCells; i++) {
+        alignas(Alignment) int32_t policyLayer1i32[PolicyPWConvDim];
+        simd::linear<PolicyPWConvDim, PolicyDim, false, true, true>(policyLayer1i32,
+                                                                    cellMapConv[i],
+                                                                    pwconvWeighti16,
+                                                                    pwconvBiasi32);
+        policyBuffer(cellInnerIdx[i]) = policyOutput(policyLayer1i32);
     }
 }
 
@@ -988,14 +1070,19 @@ Evaluator::Evaluator(int                   boardSize,
     : Evaluation::Evaluator(boardSize, rule)
     , weight {nullptr, nullptr}
 {
-    CompressedWrapper<StandardHeaderLoader<Mix9svqWeightLoader>> loader(
+    PreprocessedCacheWrapper<CompressedWrapper<StandardHeaderLoader<Mix9svqWeightLoader>>> loader(
         Compressor::Type::LZ4_DEFAULT);
+    loader.setCacheDirectory(Config::WeightCacheDirectory);
+    loader.setSharedMemory(Config::WeightSharedMemory);
+    // Signed input offset changes the preprocessed bias, so it is part of the layout
+    loader.setCacheTag(std::string("mix9svq-") + simd::instTypeName(simd::NativeInstType)
+                       + (simd::SignedInputOffset ? "-vnni" : ""));
 
     if (boardSize > 22)
         throw UnsupportedBoardSizeError(boardSize);
 
-    Time startTime     = now();
-    bool printLoadInfo = false;
+    Time              startTime = now();
+    std::atomic<bool> printLoadInfo {false};
     loader.setHeaderValidator([&](StandardHeader header, auto &args) -> bool {
         constexpr uint32_t ArchHash = ArchHashBase
                                       ^ (((FeatDWConvDim / 8) << 20) | ((ValueDim / 8) << 14)
@@ -1016,17 +1103,27 @@ Evaluator::Evaluator(int                   boardSize,
         return true;
     });
 
+    // Weights of both sides are independent, so they are loaded in parallel
+    auto weights = weightRegistry().loadWeightsFromFiles(
+        loader,
+        {
+            {blackWeightPath, {{}, boardSize, rule, blackWeightPath}},
+            {whiteWeightPath, {{}, boardSize, rule, whiteWeightPath}},
+        },
+        numaNodeId);
+    weight[BLACK] = weights[0];
+    weight[WHITE] = weights[1];
     for (const auto &[weightSide, weightPath] : {
              std::make_pair(BLACK, blackWeightPath),
              std::make_pair(WHITE, whiteWeightPath),
          }) {
-        weight[weightSide] = WeightReg.loadWeightFromFile(loader,
-                                                          weightPath,
-                                                          numaNodeId,
-                                                          {{}, boardSize, rule, weightPath});
-        if (!weight[weightSide])
+        if (!weight[weightSide]) {
+            for (Color side : {BLACK, WHITE})
+                if (weight[side])
+                    weightRegistry().unloadWeight(weight[side]);
             throw std::runtime_error("failed to load nnue weight from "
                                      + pathToConsoleString(weightPath));
+        }
     }
 
     if (printLoadInfo)
@@ -1043,9 +1140,9 @@ Evaluator::Evaluator(int                   boardSize,
 Evaluator::~Evaluator()
 {
     if (weight[BLACK])
-        WeightReg.unloadWeight(weight[BLACK]);
+        weightRegistry().unloadWeight(weight[BLACK]);
     if (weight[WHITE])
-        WeightReg.unloadWeight(weight[WHITE]);
+        weightRegistry().unloadWeight(weight[WHITE]);
 }
 
 void Evaluator::initEmptyBoard()
@@ -1066,12 +1163,18 @@ void Evaluator::afterUndo(const Board &board, Pos pos)
     addCache(board.sideToMove(), pos.x(), pos.y(), true);
 }
 
+void Evaluator::applyPendingUpdates(const Board &board)
+{
+    clearCache(BLACK, board);
+    clearCache(WHITE, board);
+}
+
 ValueType Evaluator::evaluateValue(const Board &board, AccLevel level)
 {
     Color self = board.sideToMove(), oppo = ~self;
 
     // Apply all incremental update for both sides and calculate value
-    clearCache(self);
+    clearCache(self, board);
     auto [win, loss, draw] = accumulator[self]->evaluateValue(*weight[self]);
 
     return ValueType(win, loss, draw, true);
@@ -1082,26 +1185,61 @@ void Evaluator::evaluatePolicy(const Board &board, PolicyBuffer &policyBuffer, A
     Color self = board.sideToMove();
 
     // Apply all incremental update and calculate policy
-    clearCache(self);
+    clearCache(self, board);
     accumulator[self]->evaluatePolicy(*weight[self], policyBuffer);
 }
 
-void Evaluator::clearCache(Color side)
+void Evaluator::clearCache(Color side, const Board &board)
 {
-    constexpr Color opponentMap[4] = {WHITE, BLACK, WALL, EMPTY};
-
-    for (MoveCache &mc : moveCache[side]) {
-        if (side == WHITE) {
-            mc.oldColor = opponentMap[mc.oldColor];
-            mc.newColor = opponentMap[mc.newColor];
-        }
+    Accumulator &acc   = *accumulator[side];
+    auto        &cache = moveCache[side];
+
+    // Pending updates are always some undos followed by some moves, as
+    // contrary updates cancel out each other when they are added.
+    int numUndo = 0;
+    while (numUndo < int(cache.size()) && cache[numUndo].oldColor != EMPTY)
+        numUndo++;
+    int numMove       = int(cache.size()) - numUndo;
+    int targetVersion = acc.version() - numUndo + numMove;
+    int baseVersion   = acc.lastValidVersion(acc.version() - numUndo);
+    int numReplay     = targetVersion - baseVersion;
+    assert(targetVersion == board.nonPassMoveCount());
+
+    cache.clear();
+    acc.rollback(baseVersion);
+    updateStats.numSyncs++;
+    updateStats.numPendingMoves += numMove;
+    if (numReplay == 0)
+        return;
+
+    // Restore the state from snapshot table to skip a long replay
+    const int  minReplay   = Config::EvaluatorSnapshotMinReplay;
+    const bool useSnapshot = minReplay > 0 && numReplay >= minReplay;
+    HashKey    key         = board.zobristKey();
+    uint64_t   stoneHash   = useSnapshot ? board.stoneHash() : 0;
+    if (useSnapshot && acc.restoreSnapshot(key, stoneHash, targetVersion)) {
+        updateStats.numSnapshotRestores++;
+        return;
+    }
 
-        if (mc.oldColor == EMPTY)
-            accumulator[side]->move(*weight[side], mc.newColor, mc.x, mc.y);
-        else
-            accumulator[side]->undo();
+    // Replay the last moves on board from the base version. This might include more
+    // moves than the cache if the versions skipped by a restored version are undone.
+    int startPly = board.ply();
+    for (int n = numReplay; n > 0;)
+        if (board.getHistoryMove(--startPly) != Pos::PASS)
+            n--;
+    for (int i = startPly; i < board.ply(); i++) {
+        Pos pos = board.getHistoryMove(i);
+        if (pos == Pos::PASS)
+            continue;
+
+        Color pieceColor = side == WHITE ? ~board.get(pos) : board.get(pos);
+        acc.move(*weight[side], pieceColor, pos.x(), pos.y());
     }
-    moveCache[side].clear();
+    updateStats.numReplayedMoves += numReplay;
+
+    if (useSnapshot)
+        acc.saveSnapshot(key, stoneHash);
 }
 
 void Evaluator::addCache(Color side, int x, int y, bool isUndo)
@@ -1123,4 +1261,20 @@ void Evaluator::addCache(Color side, int x, int y, bool isUndo)
     }
 }
 
+#ifdef EVAL_ISA
+std::unique_ptr<Evaluation::Evaluator> createEvaluator(int                   boardSize,
+                                                       Rule                  rule,
+                                                       Numa::NumaNodeId      numaNodeId,
+                                                       std::filesystem::path blackWeightPath,
+                                                       std::filesystem::path whiteWeightPath)
+{
+    return std::make_unique<Evaluator>(boardSize,
+                                       rule,
+                                       numaNodeId,
+                                       std::move(blackWeightPath),
+                                       std::move(whiteWeightPath));
+}
+#endif
+
+EVAL_ISA_NAMESPACE_END
 }  // namespace Evaluation::mix9svq
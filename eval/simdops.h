@@ -20,13 +20,27 @@
 #include "../core/platform.h"
 #include "../core/utils.h"
 
+#include <cassert>
 #include <cstring>
 #include <simde/x86/avx2.h>
 #include <simde/x86/fma.h>
 #include <tuple>
 #include <type_traits>
 
+// With runtime dispatch, evaluator kernels are compiled once for each instruction
+// set, and EVAL_ISA names the variant being compiled. Everything depending on the
+// instruction set is then put into an inline namespace of that name, so variants
+// can be linked into one binary without clashing symbols.
+#ifdef EVAL_ISA
+    #define EVAL_ISA_NAMESPACE_BEGIN inline namespace EVAL_ISA {
+    #define EVAL_ISA_NAMESPACE_END   }
+#else
+    #define EVAL_ISA_NAMESPACE_BEGIN
+    #define EVAL_ISA_NAMESPACE_END
+#endif
+
 namespace Evaluation::simd {
+EVAL_ISA_NAMESPACE_BEGIN
 
 enum InstructionType {
     SCALAR,
@@ -63,6 +77,19 @@ constexpr bool isMinimalInstType(InstructionType instType)
     }
 }
 
+/// Get the name of the given instruction type.
+constexpr const char *instTypeName(InstructionType instType)
+{
+    switch (instType) {
+    default: return "scalar";
+    case SSE: return "sse";
+    case AVX2: return "avx2";
+    case AVX512: return "avx512";
+    case NEON: return "neon";
+    case WASM_SIMD: return "wasm_simd";
+    }
+}
+
 /// Returns the next lower instruction type.
 constexpr InstructionType getInstTypeOfWidth(InstructionType instType, size_t width)
 {
@@ -92,6 +119,15 @@ constexpr size_t          NativeAlignment = 16;
 constexpr InstructionType NativeInstType  = SCALAR;
 #endif
 
+#if defined(USE_VNNI)
+/// With VNNI, int8 linear layers offset signed inputs to unsigned by adding 128, so that each
+/// product is a single unsigned dot product. The extra 128 * sum(weight) is not subtracted
+/// in every call, but folded into the bias by preprocessLinearSignedInputBias().
+constexpr bool SignedInputOffset = true;
+#else
+constexpr bool SignedInputOffset = false;
+#endif
+
 constexpr bool isAlignSizeOK(size_t alignSize)
 {
     return alignSize > 0 && alignSize <= 64 && isPowerOfTwo(alignSize);
@@ -982,23 +1018,34 @@ namespace detail {
 #endif
         }
 
+#if defined(USE_VNNI)
+        /// Compute 4-element dot product of [u8x16] and [i8x16] then accumulate into [i32x4].
+        /// Unlike dot4_u7i8_accum(), the full u8 range is exact as there is no i16 saturation.
+        static FORCE_INLINE void dot4_u8i8_accum(R &acc, R a, R b)
+        {
+    #if !defined(USE_AVX512)
+            acc = _mm_dpbusd_avx_epi32(acc, a, b);
+    #else
+            acc = _mm_dpbusd_epi32(acc, a, b);
+    #endif
+        }
+#endif
+
         /// Compute 4-element dot product of [i8x16] and [i8x16] then accumulate into [i32x4].
         static FORCE_INLINE void dot4_i8i8_accum(R &acc, R a, R b)
         {
             const R highest_bit = simde_mm_set1_epi8(0x80);
 
+#if defined(USE_VNNI)
+            // Offset a to unsigned by adding 128, then subtract the extra 128 * b
+            R bias = _mm_setzero_si128();
+            dot4_u8i8_accum(acc, simde_mm_xor_si128(a, highest_bit), b);
+            dot4_u8i8_accum(bias, highest_bit, b);
+            acc = simde_mm_sub_epi32(acc, bias);
+#else
             R msb  = simde_mm_and_si128(a, highest_bit);
             R low7 = simde_mm_andnot_si128(highest_bit, a);
 
-#if defined(USE_VNNI)
-    #if !defined(USE_AVX512)
-            msb  = _mm_dpbusd_avx_epi32(_mm_setzero_si128(), msb, b);  // 0 or 128
-            low7 = _mm_dpbusd_avx_epi32(_mm_setzero_si128(), low7, b);
-    #else
-            msb  = _mm_dpbusd_epi32(_mm_setzero_si128(), msb, b);  // 0 or 128
-            low7 = _mm_dpbusd_epi32(_mm_setzero_si128(), low7, b);
-    #endif
-#else
             // Multiply a * b in two parts and accumulate neighbouring outputs into int16 values
             msb  = simde_mm_maddubs_epi16(msb, b);  // 0 or 128
             low7 = simde_mm_maddubs_epi16(low7, b);
@@ -1007,11 +1054,11 @@ namespace detail {
             const R one = simde_mm_set1_epi16(1);
             low7        = simde_mm_madd_epi16(low7, one);
             msb         = simde_mm_madd_epi16(msb, one);
-#endif
 
             // Place value of the MSB was negative
             R product0 = simde_mm_sub_epi32(low7, msb);
             acc        = simde_mm_add_epi32(acc, product0);
+#endif
         }
     };
 
@@ -1045,23 +1092,34 @@ namespace detail {
 #endif
         }
 
+#if defined(USE_VNNI)
+        /// Compute 4-element dot product of [u8x32] and [i8x32] then accumulate into [i32x8].
+        /// Unlike dot4_u7i8_accum(), the full u8 range is exact as there is no i16 saturation.
+        static FORCE_INLINE void dot4_u8i8_accum(R &acc, R a, R b)
+        {
+    #if !defined(USE_AVX512)
+            acc = _mm256_dpbusd_avx_epi32(acc, a, b);
+    #else
+            acc = _mm256_dpbusd_epi32(acc, a, b);
+    #endif
+        }
+#endif
+
         /// Compute 4-element dot product of [i8x32] and [i8x32] then accumulate into [i32x8].
         static FORCE_INLINE void dot4_i8i8_accum(R &acc, R a, R b)
         {
             const R highest_bit = simde_mm256_set1_epi8(0x80);
 
+#if defined(USE_VNNI)
+            // Offset a to unsigned by adding 128, then subtract the extra 128 * b
+            R bias = _mm256_setzero_si256();
+            dot4_u8i8_accum(acc, simde_mm256_xor_si256(a, highest_bit), b);
+            dot4_u8i8_accum(bias, highest_bit, b);
+            acc = simde_mm256_sub_epi32(acc, bias);
+#else
             R msb  = simde_mm256_and_si256(a, highest_bit);
             R low7 = simde_mm256_andnot_si256(highest_bit, a);
 
-#if defined(USE_VNNI)
-    #if !defined(USE_AVX512)
-            msb  = _mm256_dpbusd_avx_epi32(_mm256_setzero_si256(), msb, b);  // 0 or 128
-            low7 = _mm256_dpbusd_avx_epi32(_mm256_setzero_si256(), low7, b);
-    #else
-            msb  = _mm256_dpbusd_epi32(_mm256_setzero_si256(), msb, b);  // 0 or 128
-            low7 = _mm256_dpbusd_epi32(_mm256_setzero_si256(), low7, b);
-    #endif
-#else
             // Multiply a * b in two parts and accumulate neighbouring outputs into int16 values
             msb  = simde_mm256_maddubs_epi16(msb, b);  // 0 or 128
             low7 = simde_mm256_maddubs_epi16(low7, b);
@@ -1070,11 +1128,11 @@ namespace detail {
             const R one = simde_mm256_set1_epi16(1);
             low7        = simde_mm256_madd_epi16(low7, one);
             msb         = simde_mm256_madd_epi16(msb, one);
-#endif
 
             // Place value of the MSB was negative
             R product0 = simde_mm256_sub_epi32(low7, msb);
             acc        = simde_mm256_add_epi32(acc, product0);
+#endif
         }
     };
 
@@ -1105,18 +1163,30 @@ namespace detail {
     #endif
         }
 
+    #if defined(USE_VNNI)
+        /// Compute 4-element dot product of [u8x64] and [i8x64] then accumulate into [i32x16].
+        /// Unlike dot4_u7i8_accum(), the full u8 range is exact as there is no i16 saturation.
+        static FORCE_INLINE void dot4_u8i8_accum(R &acc, R a, R b)
+        {
+            acc = _mm512_dpbusd_epi32(acc, a, b);
+        }
+    #endif
+
         /// Compute 4-element dot product of [i8x64] and [i8x64] then accumulate into [i32x16].
         static FORCE_INLINE void dot4_i8i8_accum(R &acc, R a, R b)
         {
             const R highest_bit = _mm512_set1_epi8(0x80);
 
+    #if defined(USE_VNNI)
+            // Offset a to unsigned by adding 128, then subtract the extra 128 * b
+            R bias = _mm512_setzero_si512();
+            dot4_u8i8_accum(acc, _mm512_xor_si512(a, highest_bit), b);
+            dot4_u8i8_accum(bias, highest_bit, b);
+            acc = _mm512_sub_epi32(acc, bias);
+    #else
             R msb  = _mm512_and_si512(a, highest_bit);
             R low7 = _mm512_andnot_si512(highest_bit, a);
 
-    #if defined(USE_VNNI)
-            msb  = _mm512_dpbusd_epi32(_mm512_setzero_si512(), msb, b);  // 0 or 128
-            low7 = _mm512_dpbusd_epi32(_mm512_setzero_si512(), low7, b);
-    #else
             // Multiply a * b in two parts and accumulate neighbouring outputs into int16 values
             msb  = _mm512_maddubs_epi16(msb, b);  // 0 or 128
             low7 = _mm512_maddubs_epi16(low7, b);
@@ -1125,11 +1195,11 @@ namespace detail {
             const R one = _mm512_set1_epi16(1);
             low7        = _mm512_madd_epi16(low7, one);
             msb         = _mm512_madd_epi16(msb, one);
-    #endif
 
             // Place value of the MSB was negative
             R product0 = _mm512_sub_epi32(low7, msb);
             acc        = _mm512_add_epi32(acc, product0);
+    #endif
         }
     };
 #endif
@@ -1985,9 +2055,13 @@ namespace detail {
                     reinterpret_cast<const typename I8Op::R *>(weight + i * OutSize * ChunkSize);
                 if constexpr (PreReLU)
                     in0 = I8Op::max(in0, I8Op::setzero());
+                if constexpr (SignedInput && SignedInputOffset)
+                    in0 = I8Op::bitwisexor(in0, I8Op::set1(int8_t(0x80)));
 
                 for (int j = 0; j < OutB::NumBatch; j++) {
-                    if constexpr (SignedInput)
+                    if constexpr (SignedInput && SignedInputOffset)
+                        I8Op::dot4_u8i8_accum(acc[j], in0, I8LS::load(&w0[j]));
+                    else if constexpr (SignedInput)
                         I8Op::dot4_i8i8_accum(acc[j], in0, I8LS::load(&w0[j]));
                     else
                         I8Op::dot4_u7i8_accum(acc[j], in0, I8LS::load(&w0[j]));
@@ -2054,7 +2128,14 @@ namespace detail {
                     const auto w1 = I8LS::load(weight + offset1 + j * B::RegWidth);
                     const auto w2 = I8LS::load(weight + offset2 + j * B::RegWidth);
                     const auto w3 = I8LS::load(weight + offset3 + j * B::RegWidth);
-                    if constexpr (SignedInput) {
+                    if constexpr (SignedInput && SignedInputOffset) {
+                        in = I8Op::bitwisexor(in, I8Op::set1(int8_t(0x80)));
+                        I8Op::dot4_u8i8_accum(sum0, in, w0);
+                        I8Op::dot4_u8i8_accum(sum1, in, w1);
+                        I8Op::dot4_u8i8_accum(sum2, in, w2);
+                        I8Op::dot4_u8i8_accum(sum3, in, w3);
+                    }
+                    else if constexpr (SignedInput) {
                         I8Op::dot4_i8i8_accum(sum0, in, w0);
                         I8Op::dot4_i8i8_accum(sum1, in, w1);
                         I8Op::dot4_i8i8_accum(sum2, in, w2);
@@ -2295,6 +2376,23 @@ void preprocessLinear(InputType weight[OutSize * InSize])
     }
 }
 
+/// Preprocess the bias of int8 linear layer that is applied on signed inputs. When signed
+/// inputs are offset (see SignedInputOffset), 128 * sum(weight) of each output row is
+/// subtracted from its bias, and nothing is changed otherwise.
+/// @note Weight must be in its original row-major layout, before preprocessLinear().
+template <int OutSize, int InSize>
+void preprocessLinearSignedInputBias(const int8_t weight[OutSize * InSize], int32_t bias[OutSize])
+{
+    if constexpr (SignedInputOffset) {
+        for (int i = 0; i < OutSize; i++) {
+            int32_t weightSum = 0;
+            for (int j = 0; j < InSize; j++)
+                weightSum += weight[i * InSize + j];
+            bias[i] -= 128 * weightSum;
+        }
+    }
+}
+
 /// Preprocess int8/int16 hyper linear layer used for computing dynamic linear weight.
 template <int DynamicOutSize,
           int DynamicInSize,
@@ -2349,6 +2447,7 @@ void preprocessDynamicWeightLinear(WeightType *weight, BiasType *bias)
 }
 
 /// Apply int8/int16 linear layer with int32 accumulation.
+/// For int8 signed inputs, bias must be preprocessed by preprocessLinearSignedInputBias().
 template <int             OutSize,
           int             InSize,
           bool            SignedInput = false,
@@ -2373,6 +2472,8 @@ AccType *linear(AccType         *output,
     assert(isPtrAligned<Alignment>(weight));
     if constexpr (Bias)
         assert(isPtrAligned<Alignment>(bias));
+    static_assert(!(std::is_same_v<InputType, int8_t> && SignedInput && SignedInputOffset) || Bias,
+                  "Offset signed inputs require the preprocessed bias");
 
     typedef detail::Affine<OutSize, InSize, InputType, Alignment, Inst> Affine;
     Affine::template forward<SignedInput, Bias, PreReLU, PostReLU>(output, input, weight, bias);
@@ -2380,6 +2481,137 @@ AccType *linear(AccType         *output,
     return output + OutSize;
 }
 
+/// Apply the same int8/int16 linear layer with int32 accumulation to four inputs at
+/// once, so that each loaded weight row is reused four times. Outputs are identical
+/// to calling linear() with bias on each input, and the weight must be in the chunked
+/// layout of linear() (preprocessed by preprocessLinear() for static weights). Like
+/// linear(), bias of int8 signed inputs must be preprocessed for the input offset.
+template <int             OutSize,
+          int             InSize,
+          bool            SignedInput = false,
+          bool            PreReLU     = false,
+          int             Alignment   = NativeAlignment,
+          InstructionType Inst        = NativeInstType,
+          typename InputType          = int8_t>
+void linear4(int32_t         *output0,
+             int32_t         *output1,
+             int32_t         *output2,
+             int32_t         *output3,
+             const InputType *input0,
+             const InputType *input1,
+             const InputType *input2,
+             const InputType *input3,
+             const InputType  weight[OutSize * InSize],
+             const int32_t    bias[OutSize])
+{
+    typedef detail::VecBatch<OutSize, int32_t, Inst>         OutB;
+    typedef detail::VecLoadStore<InputType, Alignment, Inst> InLS;
+    typedef detail::VecLoadStore<int32_t, Alignment, Inst>   I32LS;
+    typedef detail::VecOp<InputType, Inst>                   InOp;
+    typedef detail::VecOp<int32_t, Inst>                     I32Op;
+    static_assert(std::is_same_v<InputType, int8_t> || std::is_same_v<InputType, int16_t>,
+                  "Only int8_t or int16_t input is supported");
+    static_assert(OutSize > 1 && detail::VecBatch<OutSize, int32_t, Inst, true>::NumExtra == 0,
+                  "linear4() requires the chunked weight layout of linear()");
+    static_assert(isAlignSizeOK(Alignment));
+    assert(isPtrAligned<Alignment>(weight));
+    assert(isPtrAligned<Alignment>(bias));
+
+    constexpr bool Int8Input = std::is_same_v<InputType, int8_t>;
+
+    typename I32Op::R acc0[OutB::NumBatch];
+    typename I32Op::R acc1[OutB::NumBatch];
+    typename I32Op::R acc2[OutB::NumBatch];
+    typename I32Op::R acc3[OutB::NumBatch];
+
+    for (int j = 0; j < OutB::NumBatch; j++) {
+        auto b  = I32LS::load(bias + j * OutB::RegWidth);
+        acc0[j] = b;
+        acc1[j] = b;
+        acc2[j] = b;
+        acc3[j] = b;
+    }
+
+    // Each chunk of input elements fits in one int32 to be broadcasted
+    constexpr int ChunkSize = 4 / sizeof(InputType);
+    constexpr int NumChunks = InSize / ChunkSize;
+    static_assert(InSize % ChunkSize == 0, "InSize must be a multiple of ChunkSize");
+
+    const auto input0_32 = reinterpret_cast<const int32_t *>(input0);
+    const auto input1_32 = reinterpret_cast<const int32_t *>(input1);
+    const auto input2_32 = reinterpret_cast<const int32_t *>(input2);
+    const auto input3_32 = reinterpret_cast<const int32_t *>(input3);
+
+    for (int i = 0; i < NumChunks; i++) {
+        auto in0 = typename InOp::R(I32Op::set1(input0_32[i]));
+        auto in1 = typename InOp::R(I32Op::set1(input1_32[i]));
+        auto in2 = typename InOp::R(I32Op::set1(input2_32[i]));
+        auto in3 = typename InOp::R(I32Op::set1(input3_32[i]));
+        if constexpr (PreReLU) {
+            in0 = InOp::max(in0, InOp::setzero());
+            in1 = InOp::max(in1, InOp::setzero());
+            in2 = InOp::max(in2, InOp::setzero());
+            in3 = InOp::max(in3, InOp::setzero());
+        }
+
+        auto wBase = reinterpret_cast<const typename InOp::R *>(weight + i * OutSize * ChunkSize);
+
+        if constexpr (!Int8Input) {
+            for (int j = 0; j < OutB::NumBatch; j++) {
+                auto w  = InLS::load(&wBase[j]);
+                acc0[j] = I32Op::add(acc0[j], InOp::dot2(in0, w));
+                acc1[j] = I32Op::add(acc1[j], InOp::dot2(in1, w));
+                acc2[j] = I32Op::add(acc2[j], InOp::dot2(in2, w));
+                acc3[j] = I32Op::add(acc3[j], InOp::dot2(in3, w));
+            }
+            continue;
+        }
+
+        // Signed inputs are offset to unsigned, and bias has the offset folded in
+        if constexpr (Int8Input && SignedInput && SignedInputOffset) {
+            const auto highest_bit = InOp::set1(int8_t(0x80));
+            in0                    = InOp::bitwisexor(in0, highest_bit);
+            in1                    = InOp::bitwisexor(in1, highest_bit);
+            in2                    = InOp::bitwisexor(in2, highest_bit);
+            in3                    = InOp::bitwisexor(in3, highest_bit);
+
+            for (int j = 0; j < OutB::NumBatch; j++) {
+                auto w = InLS::load(&wBase[j]);
+                InOp::dot4_u8i8_accum(acc0[j], in0, w);
+                InOp::dot4_u8i8_accum(acc1[j], in1, w);
+                InOp::dot4_u8i8_accum(acc2[j], in2, w);
+                InOp::dot4_u8i8_accum(acc3[j], in3, w);
+            }
+            continue;
+        }
+
+        if constexpr (Int8Input) {
+            for (int j = 0; j < OutB::NumBatch; j++) {
+                auto w = InLS::load(&wBase[j]);
+                if constexpr (SignedInput) {
+                    InOp::dot4_i8i8_accum(acc0[j], in0, w);
+                    InOp::dot4_i8i8_accum(acc1[j], in1, w);
+                    InOp::dot4_i8i8_accum(acc2[j], in2, w);
+                    InOp::dot4_i8i8_accum(acc3[j], in3, w);
+                }
+                else {
+                    InOp::dot4_u7i8_accum(acc0[j], in0, w);
+                    InOp::dot4_u7i8_accum(acc1[j], in1, w);
+                    InOp::dot4_u7i8_accum(acc2[j], in2, w);
+                    InOp::dot4_u7i8_accum(acc3[j], in3, w);
+                }
+            }
+        }
+    }
+
+    for (int j = 0; j < OutB::NumBatch; j++) {
+        I32LS::store(output0 + j * OutB::RegWidth, acc0[j]);
+        I32LS::store(output1 + j * OutB::RegWidth, acc1[j]);
+        I32LS::store(output2 + j * OutB::RegWidth, acc2[j]);
+        I32LS::store(output3 + j * OutB::RegWidth, acc3[j]);
+    }
+}
+
 /// Divide an int32 array by a 2-exp divisor, then apply clipped relu to the int32
 /// array and store the saturated int8 results.
 template <int             Size,
@@ -2557,4 +2789,5 @@ int8_t *dot2(int8_t output[OutSize], int8_t input_u7[OutSize * 2], int8_t input_
     return output + OutSize;
 }
 
+EVAL_ISA_NAMESPACE_END
 }  // namespace Evaluation::simd
@@ -0,0 +1,149 @@
+// Correctness check of int8 linear layers against a scalar reference.
+// Covers linear() and linear4() with signed and unsigned inputs, including the VNNI path
+// where signed inputs are offset to unsigned and the offset is folded into the bias.
+//
+// Build and run it once for every instruction set to check from eval/, with the flags of
+// that instruction set, e.g. for AVX2, AVX2 with AVX-VNNI and AVX512 with VNNI:
+//   -mavx2 -mfma -mbmi2 -DUSE_SSE -DUSE_AVX2
+//   -mavx2 -mfma -mbmi2 -mavxvnni -DUSE_SSE -DUSE_AVX2 -DUSE_VNNI
+//   -march=skylake-avx512 -mavx512vnni -DUSE_SSE -DUSE_AVX2 -DUSE_AVX512 -DUSE_VNNI
+// g++ -std=c++17 -O2 <flags> -I../external/simde/include test_linear_vnni_correctness.cpp
+
+#include "simdops.h"
+
+#include <cstring>
+#include <iostream>
+#include <random>
+
+using namespace Evaluation;
+
+constexpr int                   Alignment = simd::NativeAlignment;
+constexpr simd::InstructionType IT        = simd::NativeInstType;
+
+template <int OutSize, int InSize>
+struct FCWeight
+{
+    alignas(Alignment) int8_t weight[OutSize * InSize];
+    alignas(Alignment) int32_t bias[OutSize];
+};
+
+std::mt19937 rng(42);
+
+void fill_random_i8(int8_t *data, int size, int minValue, int maxValue)
+{
+    std::uniform_int_distribution<int> dist(minValue, maxValue);
+    for (int i = 0; i < size; ++i)
+        data[i] = (int8_t)dist(rng);
+}
+
+void fill_random_i32(int32_t *data, int size)
+{
+    std::uniform_int_distribution<int> dist(-10000, 10000);
+    for (int i = 0; i < size; ++i)
+        data[i] = dist(rng);
+}
+
+// Scalar reference on the original (not preprocessed) weight
+template <int OutSize, int InSize>
+void linear_scalar(int32_t output[OutSize], const int8_t input[InSize], const FCWeight<OutSize, InSize> &w)
+{
+    for (int i = 0; i < OutSize; ++i) {
+        int32_t sum = w.bias[i];
+        for (int j = 0; j < InSize; ++j)
+            sum += int32_t(w.weight[i * InSize + j]) * int32_t(input[j]);
+        output[i] = sum;
+    }
+}
+
+template <int OutSize, int InSize, bool SignedInput, bool TestLinear4>
+bool test_linear(const char *name)
+{
+    FCWeight<OutSize, InSize> w, wp;
+    fill_random_i8(w.weight, OutSize * InSize, -128, 127);
+    fill_random_i32(w.bias, OutSize);
+
+    // Preprocess a copy of the weight the same way the evaluators do
+    std::memcpy(&wp, &w, sizeof(w));
+    if constexpr (SignedInput)
+        simd::preprocessLinearSignedInputBias<OutSize, InSize>(wp.weight, wp.bias);
+    simd::preprocessLinear<OutSize, InSize>(wp.weight);
+
+    // Pad output rows so that every row stays aligned for small output sizes
+    constexpr int OutStride = (OutSize * 4 + Alignment - 1) / Alignment * Alignment / 4;
+
+    bool pass = true;
+    for (int round = 0; round < 100; ++round) {
+        alignas(Alignment) int8_t  input[4][InSize];
+        alignas(Alignment) int32_t outputRef[4][OutStride];
+        alignas(Alignment) int32_t outputNew[4][OutStride];
+        alignas(Alignment) int32_t output4[4][OutStride];
+
+        // Unsigned inputs are clipped relu outputs in [0, 127]. The first round checks
+        // the extreme values of the input range.
+        for (int k = 0; k < 4; ++k) {
+            if (round == 0)
+                std::memset(input[k], SignedInput && k % 2 ? -128 : 127, InSize);
+            else
+                fill_random_i8(input[k], InSize, SignedInput ? -128 : 0, 127);
+            linear_scalar(outputRef[k], input[k], w);
+            simd::linear<OutSize, InSize, SignedInput>(outputNew[k], input[k], wp.weight, wp.bias);
+        }
+        if constexpr (TestLinear4)
+            simd::linear4<OutSize, InSize, SignedInput>(output4[0],
+                                                        output4[1],
+                                                        output4[2],
+                                                        output4[3],
+                                                        input[0],
+                                                        input[1],
+                                                        input[2],
+                                                        input[3],
+                                                        wp.weight,
+                                                        wp.bias);
+
+        for (int k = 0; k < 4; ++k)
+            for (int i = 0; i < OutSize; ++i) {
+                if (outputRef[k][i] != outputNew[k][i]) {
+                    if (pass)
+                        std::cout << name << ": linear mismatch at index " << i
+                                  << ": Ref=" << outputRef[k][i] << " New=" << outputNew[k][i]
+                                  << std::endl;
+                    pass = false;
+                }
+                if (TestLinear4 && outputRef[k][i] != output4[k][i]) {
+                    if (pass)
+                        std::cout << name << ": linear4 mismatch at index " << i
+                                  << ": Ref=" << outputRef[k][i] << " New=" << output4[k][i]
+                                  << std::endl;
+                    pass = false;
+                }
+            }
+    }
+
+    std::cout << name << (pass ? ": passed" : ": FAILED") << std::endl;
+    return pass;
+}
+
+int main()
+{
+    std::cout << "Running int8 linear correctness test for " << simd::instTypeName(IT)
+              << (simd::SignedInputOffset ? " with VNNI" : "") << "..." << std::endl;
+
+    bool pass = true;
+    // Chunked layout, used by linear() and linear4()
+    pass &= test_linear<64, 64, true, true>("signed 64x64");
+    pass &= test_linear<64, 64, false, true>("unsigned 64x64");
+    pass &= test_linear<32, 64, true, true>("signed 32x64");
+    pass &= test_linear<64, 128, true, true>("signed 64x128");
+    // Horizontal sum layout for small outputs, only used by linear()
+    pass &= test_linear<4, 64, true, false>("signed 4x64");
+    pass &= test_linear<4, 64, false, false>("unsigned 4x64");
+
+    if (pass) {
+        std::cout << "Test PASSED: All outputs match exactly." << std::endl;
+        return 0;
+    }
+    else {
+        std::cout << "Test FAILED: Outputs do not match." << std::endl;
+        return 1;
+    }
+}
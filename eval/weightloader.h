@@ -18,15 +18,29 @@
 
 #pragma once
 
+#include "../core/hash.h"
 #include "../core/iohelper.h"
 #include "../core/platform.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <exception>
 #include <filesystem>
 #include <fstream>
 #include <functional>
+#include <future>
+#include <iomanip>
 #include <istream>
-#include <mutex>
+#include <iterator>
+#include <new>
+#include <random>
+#include <shared_mutex>
+#include <sstream>
+#include <thread>
 #include <type_traits>
+#include <vector>
 
 namespace Evaluation {
 
@@ -50,6 +64,11 @@ struct WeightLoader
     /// @return Weight pointer if load succeeded, otherwise nullptr.
     virtual LargePagePtr<WeightType> load(std::istream &is, LoadArgs args) = 0;
 
+    /// Parse and validate only the header part from the given input stream, without
+    /// loading the weight. Default behaviour accepts any input as there is no header.
+    /// @return Whether the header is valid for the load arguments.
+    virtual bool loadHeader(std::istream &is, LoadArgs args) { return true; }
+
     /// Whether this weight loader needs a binary stream.
     /// Default behaviour is true. Only used when loading from istream.
     virtual bool needsBinaryStream() const { return true; }
@@ -119,6 +138,22 @@ struct StandardHeaderLoader
     }
 
     LargePagePtr<WeightType> load(std::istream &is, LoadArgs args) override
+    {
+        if (!readHeader(is, args))
+            return nullptr;
+        return baseLoader.load(is, args);
+    }
+
+    bool loadHeader(std::istream &is, LoadArgs args) override { return readHeader(is, args); }
+
+private:
+    BaseLoader                                      baseLoader;
+    std::function<bool(StandardHeader, LoadArgs &)> headerValidator;
+    std::function<void(StandardHeader, LoadArgs &)> headerReader;
+
+    /// Read the standard header and run header validator and reader on it.
+    /// @return Whether the header is valid. Input stream is positioned after the header.
+    bool readHeader(std::istream &is, LoadArgs &args)
     {
         struct RawHeaderData
         {
@@ -133,7 +168,7 @@ struct StandardHeaderLoader
 
         is.read(reinterpret_cast<char *>(&headerData), sizeof(RawHeaderData));
         if (headerData.magic != 0xacd8cc6a)
-            return nullptr;
+            return false;
 
         // Read or skip description text
         if (headerValidator) {
@@ -145,7 +180,7 @@ struct StandardHeaderLoader
                                           parseBoardSizeMask(headerData.boardsize_mask),
                                           std::move(description)};
             if (!headerValidator(header, args))
-                return nullptr;
+                return false;
             if (headerReader)
                 headerReader(header, args);
         }
@@ -153,14 +188,9 @@ struct StandardHeaderLoader
             is.ignore(headerData.desc_len);
         }
 
-        return baseLoader.load(is, args);
+        return true;
     }
 
-private:
-    BaseLoader                                      baseLoader;
-    std::function<bool(StandardHeader, LoadArgs &)> headerValidator;
-    std::function<void(StandardHeader, LoadArgs &)> headerReader;
-
     static std::vector<Rule> parseRuleMask(uint32_t ruleMask)
     {
         std::vector<Rule> rules;
@@ -208,11 +238,206 @@ struct CompressedWrapper : BaseLoader
         return BaseLoader::load(*is, loadArgs);
     }
 
+    bool loadHeader(std::istream &rawInputStream, LoadArgs loadArgs) override
+    {
+        Compressor    compressor(rawInputStream, compressType);
+        std::istream *is = compressor.openInputStream(entryName);
+        if (!is)
+            return false;
+        return BaseLoader::loadHeader(*is, loadArgs);
+    }
+
 private:
     Compressor::Type compressType;
     std::string      entryName;
 };
 
+/// Weight loader wrapper that caches the final in-memory weight image on disk or in
+/// shared memory. Cache is keyed by the hash of the raw weight file, the size of weight type
+/// and a layout tag (usually the instruction set the weight is preprocessed for). On a cache
+/// hit, only the header is parsed from the raw input, and the weight image is mapped from the
+/// cache with read-only pages, which are shared by all processes using the same cache. The
+/// loaded weight must only depend on the content of the weight file.
+template <typename BaseLoader>
+struct PreprocessedCacheWrapper : BaseLoader
+{
+    using typename BaseLoader::LoadArgs;
+    using typename BaseLoader::WeightType;
+    static_assert(std::is_trivially_copyable_v<WeightType>,
+                  "weight type must be trivially copyable to be cached as an image");
+
+    template <typename... Args>
+    PreprocessedCacheWrapper(Args... args) : BaseLoader(std::forward<Args>(args)...)
+    {}
+
+    /// Set the directory to store cache files. An empty path disables the file cache.
+    /// The directory can be on a hugetlbfs mount to back the weight with huge pages.
+    void setCacheDirectory(std::filesystem::path dir) { cacheDir = std::move(dir); }
+
+    /// Set the tag that identifies the memory layout of the preprocessed weight.
+    void setCacheTag(std::string tag) { cacheTag = std::move(tag); }
+
+    /// Set whether to store the cache in named shared memory objects instead of files.
+    /// Shared memory cache takes precedence over the cache directory when enabled.
+    /// Objects are named "rapfi-<tag>-<key>", and under POSIX they persist until removed.
+    /// Valid images are never removed automatically, as other engines may still map them,
+    /// so unused ones have to be removed by deleting /dev/shm/rapfi-* under Linux.
+    void setSharedMemory(bool enable) { sharedMemory = enable; }
+
+    LargePagePtr<WeightType> load(std::istream &rawInputStream, LoadArgs loadArgs) override
+    {
+        if (cacheDir.empty() && !sharedMemory)
+            return BaseLoader::load(rawInputStream, loadArgs);
+
+        // Read the whole raw weight into memory to compute its hash
+        std::string rawData {std::istreambuf_iterator<char>(rawInputStream),
+                             std::istreambuf_iterator<char>()};
+        Hash::XXHasher hasher(CacheVersion);
+        hasher(rawData.data(), rawData.size());
+        hasher << sizeof(WeightType);
+        hasher(cacheTag.data(), cacheTag.size());
+        uint64_t cacheKey = hasher;
+
+        std::ostringstream cacheName;
+        cacheName << cacheTag << '-' << std::hex << std::setfill('0') << std::setw(16) << cacheKey;
+        std::istringstream rawStream(std::move(rawData), std::ios::in | std::ios::binary);
+
+        if (auto weight = loadCache(cacheName.str(), cacheKey)) {
+            // Header still needs to be validated against the load arguments
+            if (!BaseLoader::loadHeader(rawStream, loadArgs))
+                return nullptr;
+            return weight;
+        }
+
+        auto weight = BaseLoader::load(rawStream, loadArgs);
+        if (!weight)
+            return nullptr;
+
+        // Use the shared image instead of keeping a private copy in this process. If another
+        // process has created the shared memory object first, wait for its image instead.
+        if (saveCache(cacheName.str(), cacheKey, *weight) || sharedMemory) {
+            if (auto sharedWeight = loadCache(cacheName.str(), cacheKey))
+                return sharedWeight;
+        }
+        return weight;
+    }
+
+private:
+    /// Trailer placed right after the weight image in cache.
+    struct CacheTrailer
+    {
+        uint64_t magic;
+        uint64_t key;
+        uint64_t weightSize;
+    };
+
+    static constexpr uint64_t CacheVersion = 1;
+    static constexpr uint64_t CacheMagic   = 0x65686361637770ab;
+    static constexpr size_t   CacheSize    = sizeof(WeightType) + sizeof(CacheTrailer);
+    /// Longest time to wait for another process to finish writing a shared memory image.
+    static constexpr auto PublishTimeout = std::chrono::seconds(5);
+
+    std::filesystem::path cacheDir;
+    std::string           cacheTag;
+    bool                  sharedMemory = false;
+
+    std::string           sharedMemoryName(const std::string &name) const { return "rapfi-" + name; }
+    std::filesystem::path cacheFilePath(const std::string &name) const
+    {
+        return cacheDir / (name + ".cache");
+    }
+
+    /// Map the weight image from the cache if it is valid for the given key.
+    /// A shared memory image whose trailer is not written yet is being published by another
+    /// process, so it is waited for at most PublishTimeout. An image that is still invalid
+    /// then is left by a publisher that died while writing, or is garbage, so the object is
+    /// removed to be published again by this process.
+    LargePagePtr<WeightType> loadCache(const std::string &name, uint64_t cacheKey) const
+    {
+        size_t mappedSize = 0;
+        void  *mapped     = sharedMemory ? MemAlloc::openSharedMemory(sharedMemoryName(name),
+                                                                 mappedSize)
+                                         : MemAlloc::mapFile(cacheFilePath(name), mappedSize);
+        if (!mapped)
+            return nullptr;
+
+        LargePagePtr<WeightType> weight(static_cast<WeightType *>(mapped),
+                                        LargePageDeleter<WeightType> {mappedSize});
+
+        auto isValidImage = [&]() {
+            if (mappedSize < CacheSize)
+                return false;
+
+            CacheTrailer trailer;
+            char        *trailerPtr = static_cast<char *>(mapped) + sizeof(WeightType);
+            std::memcpy(&trailer, trailerPtr, sizeof(trailer));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return trailer.magic == CacheMagic && trailer.key == cacheKey
+                   && trailer.weightSize == sizeof(WeightType);
+        };
+
+        if (sharedMemory && mappedSize >= CacheSize) {
+            // Writes of the publisher show up in our mapping, with the trailer written last
+            auto deadline = std::chrono::steady_clock::now() + PublishTimeout;
+            while (!isValidImage() && std::chrono::steady_clock::now() < deadline)
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        if (isValidImage())
+            return weight;
+
+        if (sharedMemory) {
+            MESSAGEL("Removing invalid shared weight image " << sharedMemoryName(name));
+            MemAlloc::removeSharedMemory(sharedMemoryName(name));
+        }
+        return nullptr;
+    }
+
+    /// Write the weight image to the cache. Failure of writing is silently ignored.
+    /// Cache files are first written to a temporary file and then renamed to the cache path,
+    /// and shared memory objects get their trailer written last, so that other processes
+    /// never accept a partially written cache.
+    /// @return Whether the cache is written.
+    bool saveCache(const std::string &name, uint64_t cacheKey, const WeightType &weight) const
+    {
+        CacheTrailer trailer {CacheMagic, cacheKey, sizeof(WeightType)};
+
+        if (sharedMemory) {
+            void *mapped = MemAlloc::createSharedMemory(sharedMemoryName(name), CacheSize);
+            if (!mapped)
+                return false;
+
+            std::memcpy(mapped, &weight, sizeof(WeightType));
+            std::atomic_thread_fence(std::memory_order_release);
+            std::memcpy(static_cast<char *>(mapped) + sizeof(WeightType), &trailer, sizeof(trailer));
+            MemAlloc::unmapFile(mapped, CacheSize);
+            return true;
+        }
+
+        std::error_code ec;
+        std::filesystem::create_directories(cacheDir, ec);
+
+        std::filesystem::path cachePath = cacheFilePath(name);
+        std::filesystem::path tempPath  = cachePath;
+        tempPath += "." + std::to_string(std::random_device {}()) + ".tmp";
+
+        size_t mappedSize = CacheSize;
+        void  *mapped     = MemAlloc::createMappedFile(tempPath, mappedSize);
+        if (!mapped)
+            return false;
+
+        std::memcpy(mapped, &weight, sizeof(WeightType));
+        std::memcpy(static_cast<char *>(mapped) + sizeof(WeightType), &trailer, sizeof(trailer));
+        MemAlloc::unmapFile(mapped, mappedSize);
+
+        std::filesystem::rename(tempPath, cachePath, ec);
+        if (!ec)
+            return true;
+        std::filesystem::remove(tempPath, ec);
+        return false;
+    }
+};
+
 /// WeightRegistry is the global registry for loaded weights.
 /// Usually each evaluator loads weight from file on its own, however in most case all
 /// evaluator loads the same weight and it is very memory comsuming to have multiple
@@ -234,11 +459,24 @@ public:
     ///      on this NUMA node, it will be copyed to the current NUMA node using first-touch policy.
     /// @param loadArgs Extra loading arguments for the weight loader.
     /// @return Weight pointer, or nullptr if load failed.
+    /// @note Loading is done without holding the registry lock, so different weights can be
+    ///     loaded concurrently from multiple threads. Concurrent requests of the same weight
+    ///     wait for the first request to finish.
     WeightType *loadWeightFromFile(Loader               &loader,
                                    std::filesystem::path filepath,
                                    Numa::NumaNodeId      numaNodeId,
                                    LoadArgs              loadArgs = {});
 
+    /// Loads a list of independent weights in parallel with the same loader.
+    /// @param requests A list of file paths and load arguments of weights to load.
+    /// @return Weight pointers in the order of requests, nullptr for the failed ones.
+    ///     If any loading throws, other loaded weights are unloaded and the first
+    ///     exception is rethrown.
+    std::vector<WeightType *>
+    loadWeightsFromFiles(Loader                                                   &loader,
+                         std::vector<std::pair<std::filesystem::path, LoadArgs>> requests,
+                         Numa::NumaNodeId                                          numaNodeId);
+
     /// Unloads a loaded weight.
     void unloadWeight(WeightType *weight);
 
@@ -246,18 +484,29 @@ private:
     struct LoadedWeight
     {
         LargePagePtr<WeightType> weight;      // Pointer to the loaded weight
-        size_t                   refCount;    // Reference count of the loaded weight
+        std::atomic<size_t>      refCount;    // Reference count of the loaded weight
         std::filesystem::path    filepath;    // File path from which the weight was loaded
         Numa::NumaNodeId         numaNodeId;  // Numa node ID where the weight was loaded
         LoadArgs                 loadArgs;    // Extra loading arguments used for loading the weight
+        std::atomic<bool>        ready;       // Whether the weight has finished loading
+        std::shared_future<void> loaded;      // Becomes ready when the loading has finished
     };
 
+    /// Loads weight from file without touching the weight pool.
+    static LargePagePtr<WeightType>
+    loadFromFile(Loader &loader, const std::filesystem::path &filepath, LoadArgs loadArgs);
+
+    /// Copies a loaded weight to memory on the given NUMA node.
+    static LargePagePtr<WeightType> copyToNumaNode(const WeightType &weight,
+                                                   Numa::NumaNodeId  numaNodeId);
+
     /// Pool of loaded weights.
     /// Each weight is stored with its reference count, file path, NUMA node ID and load arguments.
-    std::vector<LoadedWeight> weightPool;
+    std::vector<std::shared_ptr<LoadedWeight>> weightPool;
 
-    /// Mutex to protect concurrent access to the weight pool.
-    std::mutex poolMutex;
+    /// Mutex to protect concurrent access to the weight pool. Lookups of loaded weights
+    /// only take a shared lock, while modifying the weight pool takes an exclusive lock.
+    std::shared_mutex poolMutex;
 };
 
 template <typename WeightLoader>
@@ -268,66 +517,214 @@ WeightRegistry<WeightLoader>::loadWeightFromFile(
     Numa::NumaNodeId                                numaNodeId,
     typename WeightRegistry<WeightLoader>::LoadArgs loadArgs)
 {
-    std::lock_guard<std::mutex> lock(poolMutex);
-
-    // Find weights in loaded weight weightPool
-    for (auto &w : weightPool) {
-        if (w.filepath == filepath && w.loadArgs == loadArgs) {
-            if (w.numaNodeId != numaNodeId) {
-                // If weight is loaded on a different NUMA node, copy it to the current NUMA node
-                // We rely on the first-touch policy to allocate memory on the current NUMA node.
-                LargePagePtr<WeightType> copiedWeight {nullptr};
-                if constexpr (std::is_copy_constructible_v<WeightType>)
-                    copiedWeight = make_unique_large_page<WeightType>(*w.weight);
-
-                // If the copy was successful, add it to the weight pool, and return the pointer.
-                // Otherwise if we fail to copy, we use the original weight without local NUMA copy.
-                if (copiedWeight) {
-                    auto copiedWeightPtr = copiedWeight.get();
-                    weightPool.push_back(
-                        {std::move(copiedWeight), 1, filepath, numaNodeId, std::move(loadArgs)});
-                    return copiedWeightPtr;
+    auto isSameWeight = [&](const LoadedWeight &w) {
+        return w.filepath == filepath && w.loadArgs == loadArgs;
+    };
+
+    for (;;) {
+        // Find weights loaded on the current NUMA node in weightPool
+        std::shared_ptr<LoadedWeight> pending;
+        {
+            std::shared_lock<std::shared_mutex> lock(poolMutex);
+            for (auto &w : weightPool) {
+                if (isSameWeight(*w) && w->numaNodeId == numaNodeId) {
+                    if (w->ready) {
+                        w->refCount++;
+                        return w->weight.get();
+                    }
+                    pending = w;
+                    break;
                 }
             }
+        }
 
-            w.refCount++;
-            return w.weight.get();
+        // If the weight is being loaded by another thread, wait for it and look up again
+        if (pending) {
+            pending->loaded.wait();
+            continue;
         }
+
+        std::unique_lock<std::shared_mutex> lock(poolMutex);
+
+        // Check again as the pool might have been changed before we get the exclusive lock.
+        // If the weight is being loaded on other NUMA nodes, also wait for it to finish.
+        std::shared_ptr<LoadedWeight> source;
+        for (auto &w : weightPool) {
+            if (!isSameWeight(*w))
+                continue;
+            if (w->numaNodeId == numaNodeId || !w->ready) {
+                pending = w;
+                break;
+            }
+            source = w;
+        }
+        if (pending) {
+            lock.unlock();
+            pending->loaded.wait();
+            continue;
+        }
+
+        // Hold a reference to the source weight so that it won't be unloaded during copying
+        if (source)
+            source->refCount++;
+
+        // Insert a pending entry so that other requests of this weight wait for us
+        std::promise<void> loadedPromise;
+        auto               entry = std::make_shared<LoadedWeight>();
+        entry->refCount          = 0;
+        entry->filepath          = filepath;
+        entry->numaNodeId        = numaNodeId;
+        entry->loadArgs          = loadArgs;
+        entry->ready             = false;
+        entry->loaded            = loadedPromise.get_future().share();
+        weightPool.push_back(entry);
+        lock.unlock();
+
+        // If weight is loaded on a different NUMA node, copy it to the current NUMA node.
+        // Otherwise load from file without holding the lock.
+        LargePagePtr<WeightType> weight {nullptr};
+        try {
+            if (source)
+                weight = copyToNumaNode(*source->weight, numaNodeId);
+            else
+                weight = loadFromFile(loader, filepath, loadArgs);
+        }
+        catch (...) {
+            lock.lock();
+            weightPool.erase(std::find(weightPool.begin(), weightPool.end(), entry));
+            lock.unlock();
+            loadedPromise.set_value();
+            if (source)
+                unloadWeight(source->weight.get());
+            throw;
+        }
+
+        WeightType *weightPtr = weight.get();
+        lock.lock();
+        if (weight) {
+            entry->weight   = std::move(weight);
+            entry->refCount = 1;
+            entry->ready    = true;
+        }
+        else
+            weightPool.erase(std::find(weightPool.begin(), weightPool.end(), entry));
+        lock.unlock();
+        loadedPromise.set_value();
+
+        if (source) {
+            // If the copy was successful, we can release the reference of the source weight.
+            // Otherwise if we fail to copy, we use the original weight without local NUMA copy.
+            if (!weightPtr)
+                return source->weight.get();
+            unloadWeight(source->weight.get());
+        }
+        return weightPtr;
     }
+}
 
-    // If not found, load from file
-    std::ios_base::openmode mode = std::ios::in;
-    if (loader.needsBinaryStream())
-        mode = mode | std::ios::binary;
-    std::ifstream fileStream(filepath, mode);
+template <typename WeightLoader>
+inline std::vector<typename WeightRegistry<WeightLoader>::WeightType *>
+WeightRegistry<WeightLoader>::loadWeightsFromFiles(
+    typename WeightRegistry<WeightLoader>::Loader &loader,
+    std::vector<std::pair<std::filesystem::path, typename WeightRegistry<WeightLoader>::LoadArgs>>
+                     requests,
+    Numa::NumaNodeId numaNodeId)
+{
+    std::vector<WeightType *>        weights(requests.size(), nullptr);
+    std::vector<std::exception_ptr> exceptions(requests.size(), nullptr);
 
-    if (!fileStream.is_open())
-        return nullptr;
+    auto loadRequest = [&](size_t i) {
+        try {
+            weights[i] =
+                loadWeightFromFile(loader, requests[i].first, numaNodeId, requests[i].second);
+        }
+        catch (...) {
+            exceptions[i] = std::current_exception();
+        }
+    };
 
-    // Load weight using weight loader
-    auto weight = loader.load(fileStream, loadArgs);
-    if (!weight)
-        return nullptr;
+#ifdef MULTI_THREADING
+    // The first request is loaded in the current thread, and others in helper threads
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < requests.size(); i++)
+        threads.emplace_back(loadRequest, i);
+    if (!requests.empty())
+        loadRequest(0);
+    for (auto &th : threads)
+        th.join();
+#else
+    for (size_t i = 0; i < requests.size(); i++)
+        loadRequest(i);
+#endif
+
+    for (auto &e : exceptions) {
+        if (e) {
+            for (WeightType *weight : weights)
+                if (weight)
+                    unloadWeight(weight);
+            std::rethrow_exception(e);
+        }
+    }
 
-    // If load succeeded, add to weightPool
-    auto weightPtr = weight.get();
-    weightPool.push_back({std::move(weight), 1, filepath, numaNodeId, std::move(loadArgs)});
-    return weightPtr;
+    return weights;
 }
 
 template <typename WeightLoader>
 inline void WeightRegistry<WeightLoader>::unloadWeight(
     typename WeightRegistry<WeightLoader>::WeightType *weight)
 {
-    std::lock_guard<std::mutex> lock(poolMutex);
+    std::unique_lock<std::shared_mutex> lock(poolMutex);
 
     for (size_t i = 0; i < weightPool.size(); i++) {
-        if (weightPool[i].weight.get() == weight) {
-            if (--weightPool[i].refCount == 0)
+        if (weightPool[i]->ready && weightPool[i]->weight.get() == weight) {
+            if (--weightPool[i]->refCount == 0)
                 weightPool.erase(weightPool.begin() + i);
             return;
         }
     }
 }
 
+template <typename WeightLoader>
+inline LargePagePtr<typename WeightRegistry<WeightLoader>::WeightType>
+WeightRegistry<WeightLoader>::loadFromFile(typename WeightRegistry<WeightLoader>::Loader &loader,
+                                           const std::filesystem::path &filepath,
+                                           typename WeightRegistry<WeightLoader>::LoadArgs loadArgs)
+{
+    std::ios_base::openmode mode = std::ios::in;
+    if (loader.needsBinaryStream())
+        mode = mode | std::ios::binary;
+    std::ifstream fileStream(filepath, mode);
+
+    if (!fileStream.is_open())
+        return nullptr;
+
+    // Load weight using weight loader
+    return loader.load(fileStream, std::move(loadArgs));
+}
+
+template <typename WeightLoader>
+inline LargePagePtr<typename WeightRegistry<WeightLoader>::WeightType>
+WeightRegistry<WeightLoader>::copyToNumaNode(
+    const typename WeightRegistry<WeightLoader>::WeightType &weight,
+    Numa::NumaNodeId                                         numaNodeId)
+{
+    if constexpr (std::is_trivially_copyable_v<WeightType>) {
+        // Copy the weight in parallel with threads bound to the NUMA node, so that the
+        // untouched pages of the new allocation are placed on that node.
+        static_assert(alignof(WeightType) <= 4096,
+                      "alignedLargePageAlloc() may fail for such a big alignment requirement");
+        void *rawMemory = MemAlloc::alignedLargePageAlloc(sizeof(WeightType));
+        if (!rawMemory)
+            return nullptr;
+        Numa::copyOnNode(rawMemory, &weight, sizeof(WeightType), numaNodeId);
+        return LargePagePtr<WeightType>(std::launder(reinterpret_cast<WeightType *>(rawMemory)));
+    }
+    else if constexpr (std::is_copy_constructible_v<WeightType>) {
+        // We rely on the first-touch policy to allocate memory on the current NUMA node.
+        return make_unique_large_page<WeightType>(weight);
+    }
+    else
+        return nullptr;
+}
+
 }  // namespace Evaluation
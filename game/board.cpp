@@ -25,32 +25,91 @@
 #include "../search/searchthread.h"
 
 #include <algorithm>
-#include <cstring>  // for std::memset
+#include <cstring>  // for std::memset, std::memcpy
 #include <iomanip>
 #include <sstream>
 #include <tuple>
 
+#ifdef USE_SSE
+    #include <emmintrin.h>
+#endif
+
 namespace {
 
+/// Gets the bitmask of pattern4 types that have a non-zero count.
+uint32_t p4ExistMask(const uint16_t (&p4Count)[PATTERN4_NB])
+{
+#ifdef USE_SSE
+    // Counts are copied to a zero padded buffer of 16, so that they can be loaded as two
+    // vectors of 8 without reading past the array. Padding lanes are masked out.
+    static_assert(PATTERN4_NB <= 16 && PATTERN4_NB > 8);
+    alignas(16) uint16_t counts[16] = {};
+    std::memcpy(counts, p4Count, sizeof(p4Count));
+
+    const __m128i zero   = _mm_setzero_si128();
+    __m128i       count0 = _mm_load_si128(reinterpret_cast<const __m128i *>(counts));
+    __m128i       count1 = _mm_load_si128(reinterpret_cast<const __m128i *>(counts + 8));
+    __m128i isZero = _mm_packs_epi16(_mm_cmpeq_epi16(count0, zero), _mm_cmpeq_epi16(count1, zero));
+    return ~uint32_t(_mm_movemask_epi8(isZero)) & ((1u << PATTERN4_NB) - 1);
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < PATTERN4_NB; i++)
+        mask |= uint32_t(p4Count[i] != 0) << i;
+    return mask;
+#endif
+}
+
+
 /// Checks whether current p4Count in stateInfo matches that on board (used in debug).
 bool checkP4(const Board *board)
 {
     int p4[SIDE_NB][PATTERN4_NB] = {0};
     FOR_EVERY_EMPTY_POS(board, pos)
     {
-        p4[BLACK][board->cell(pos).pattern4[BLACK]]++;
-        p4[WHITE][board->cell(pos).pattern4[WHITE]]++;
+        for (Color c : {BLACK, WHITE}) {
+            p4[c][board->cell(pos).pattern4[c]]++;
+            if (!board->p4Bitboard(c, board->cell(pos).pattern4[c]).test(pos))
+                return false;
+        }
     }
     for (Color c : {BLACK, WHITE})
         for (Pattern4 i = FORBID; i < PATTERN4_NB; i = Pattern4(i + 1)) {
             if (p4[c][i] != board->stateInfo().p4Count[c][i])
                 return false;
+            if (p4[c][i] != board->p4Bitboard(c, i).count())
+                return false;
         }
     return true;
 }
 
 }  // namespace
 
+void StateInfo::updateThreatMask()
+{
+    uint32_t p4Exist[SIDE_NB] = {p4ExistMask(p4Count[BLACK]), p4ExistMask(p4Count[WHITE])};
+    auto     has = [](uint32_t exist, Pattern4 p4) -> uint32_t { return (exist >> p4) & 0x1; };
+
+    for (Color self : {BLACK, WHITE}) {
+        uint32_t s = p4Exist[self], o = p4Exist[~self];
+
+        uint32_t mask = 0;
+        mask |= has(o, A_FIVE);                                         // oppo five
+        mask |= has(s, B_FLEX4) << 1;                                   // self flex four
+        mask |= has(o, B_FLEX4) << 2;                                   // oppo flex four
+        mask |= (has(s, D_BLOCK4_PLUS) | has(s, C_BLOCK4_FLEX3)) << 3;  // self four plus
+        mask |= has(s, E_BLOCK4) << 4;                                  // self four
+        mask |= (has(s, G_FLEX3_PLUS) | has(s, F_FLEX3_2X)) << 5;       // self three plus
+        mask |= has(s, H_FLEX3) << 6;                                   // self three
+        mask |= (has(o, D_BLOCK4_PLUS) | has(o, C_BLOCK4_FLEX3)) << 7;  // oppo four plus
+        mask |= has(o, E_BLOCK4) << 8;                                  // oppo four
+        mask |= (has(o, G_FLEX3_PLUS) | has(o, F_FLEX3_2X)) << 9;       // oppo three plus
+        mask |= has(o, H_FLEX3) << 10;                                  // oppo three
+
+        assert(mask < THREAT_NB);
+        threatMask[self] = mask;
+    }
+}
+
 Board::Board(int boardSize, CandidateRange candRange)
     : boardSize(boardSize)
     , boardCellCount(boardSize * boardSize)
@@ -60,6 +119,7 @@ Board::Board(int boardSize, CandidateRange candRange)
     , currentZobristKey(0)
     , candidateRange(nullptr)
     , candidateRangeSize(0)
+    , symmetryKeysTracked(false)
     , evaluator_(nullptr)
     , thisThread_(nullptr)
 {
@@ -109,6 +169,7 @@ Board::Board(const Board &other, Search::SearchThread *thread)
     , candidateRange(other.candidateRange)
     , candidateRangeSize(other.candidateRangeSize)
     , candAreaExpandDist(other.candAreaExpandDist)
+    , symmetryKeysTracked(other.symmetryKeysTracked)
     , evaluator_(thread ? thread->evaluator.get() : nullptr)
     , thisThread_(thread)
 {
@@ -117,6 +178,8 @@ Board::Board(const Board &other, Search::SearchThread *thread)
     std::copy_n(other.bitKey1, arraySize(bitKey1), bitKey1);
     std::copy_n(other.bitKey2, arraySize(bitKey2), bitKey2);
     std::copy_n(other.bitKey3, arraySize(bitKey3), bitKey3);
+    std::copy_n(&other.p4Bits[0][0], SIDE_NB * PATTERN4_NB, &p4Bits[0][0]);
+    std::copy_n(other.symmetryKeys, TRANS_NB, symmetryKeys);
 
     stateInfos  = new StateInfo[1 + boardCellCount * 2] {};
     updateCache = new UpdateCache[1 + boardCellCount * 2];
@@ -144,6 +207,7 @@ void Board::newGame()
     std::fill_n(bitKey1, arraySize(bitKey1), 0);
     std::fill_n(bitKey2, arraySize(bitKey2), 0);
     std::fill_n(bitKey3, arraySize(bitKey3), 0);
+    std::fill_n(&p4Bits[0][0], SIDE_NB * PATTERN4_NB, Bitboard {});
 
     // Init board state to empty
     moveCount         = 0;
@@ -151,6 +215,7 @@ void Board::newGame()
     passCount[WHITE]  = 0;
     currentSide       = BLACK;
     currentZobristKey = Hash::zobrist[BLACK][FULL_BOARD_CELL_COUNT - 1];
+    std::fill_n(symmetryKeys, TRANS_NB, currentZobristKey);
     for (Pos i = Pos::FULL_BOARD_START; i < Pos::FULL_BOARD_END; i++) {
         cells[i].piece = i.isInBoard(boardSize, boardSize) ? EMPTY : WALL;
 
@@ -180,10 +245,12 @@ void Board::newGame()
         c.updatePattern4AndScore<R>(pcode[BLACK], pcode[WHITE]);
         st.p4Count[BLACK][c.pattern4[BLACK]]++;
         st.p4Count[WHITE][c.pattern4[WHITE]]++;
+        setP4Bits(pos, c);
         valueBlack += c.valueBlack = Config::getValueBlack(R, pcode[BLACK], pcode[WHITE]);
     }
     st.valueBlack = valueBlack;
     st.candArea   = CandArea();
+    st.updateThreatMask();
 
     // For full board candidate range, we manually set all empty cells to candidates.
     if (candidateRangeSize == 0)
@@ -235,6 +302,8 @@ void Board::move(Pos pos)
 
     cells[pos].piece = currentSide;
     currentZobristKey ^= Hash::zobrist[currentSide][pos];
+    if (symmetryKeysTracked)
+        flipSymmetryKeys(pos, currentSide);
     flipBitKey(pos, currentSide);
 
     Value deltaValueBlack            = VALUE_ZERO;
@@ -282,9 +351,11 @@ void Board::move(Pos pos)
 
             st.p4Count[BLACK][c.pattern4[BLACK]]--;
             st.p4Count[WHITE][c.pattern4[WHITE]]--;
+            resetP4Bits(posi, c);
             c.updatePattern4AndScore<R>(pcode[BLACK], pcode[WHITE]);
             st.p4Count[BLACK][c.pattern4[BLACK]]++;
             st.p4Count[WHITE][c.pattern4[WHITE]]++;
+            setP4Bits(posi, c);
 
             if (c.pattern4[BLACK] >= C_BLOCK4_FLEX3)
                 st.lastPattern4Move[BLACK][c.pattern4[BLACK] - C_BLOCK4_FLEX3] = posi;
@@ -305,6 +376,9 @@ void Board::move(Pos pos)
     }
     st.p4Count[BLACK][c.pattern4[BLACK]]--;
     st.p4Count[WHITE][c.pattern4[WHITE]]--;
+    resetP4Bits(pos, c);
+    if (MT == MoveType::NORMAL || MT == MoveType::NO_EVALUATOR)
+        st.updateThreatMask();
 
     if (MT != MoveType::NO_EVAL_MULTI)
         currentSide = ~currentSide;
@@ -361,7 +435,10 @@ void Board::undo()
 
     flipBitKey(lastPos, currentSide);
     currentZobristKey ^= Hash::zobrist[currentSide][lastPos];
+    if (symmetryKeysTracked)
+        flipSymmetryKeys(lastPos, currentSide);
     cells[lastPos].piece = EMPTY;
+    setP4Bits(lastPos, cells[lastPos]);  // pattern4 is kept unchanged under the stone
 
     moveCount--;
     const UpdateCache &pc             = updateCache[moveCount];
@@ -384,6 +461,7 @@ void Board::undo()
             if (c.piece != EMPTY)
                 continue;
 
+            resetP4Bits(posi, c);
             c.pattern2x[dir]  = PatternConfig::lookupPattern<R>(bitKey[dir]);
             c.pattern4[BLACK] = pc[updateCacheIdx].pattern4[BLACK];
             c.pattern4[WHITE] = pc[updateCacheIdx].pattern4[WHITE];
@@ -392,6 +470,7 @@ void Board::undo()
             if constexpr (MT == MoveType::NORMAL || MT == MoveType::NO_EVALUATOR) {
                 c.valueBlack = pc[updateCacheIdx].valueBlack;
             }
+            setP4Bits(posi, c);
             updateCacheIdx++;
         }
 
@@ -439,6 +518,7 @@ void Board::setBlock(Pos pos)
         deltaValueBlack -= cells[pos].valueBlack;
         st.p4Count[BLACK][cells[pos].pattern4[BLACK]]--;
         st.p4Count[WHITE][cells[pos].pattern4[WHITE]]--;
+        resetP4Bits(pos, cells[pos]);
 
         // An EMPTY cell has both BLACK and WHITE bits set (11b).
         // A WALL has them clear (00b). We flip both to clear them.
@@ -448,6 +528,8 @@ void Board::setBlock(Pos pos)
     else if (oldPiece == BLACK || oldPiece == WHITE) {
         // This cell had a piece. Remove it from Zobrist hash.
         currentZobristKey ^= Hash::zobrist[oldPiece][pos];
+        if (symmetryKeysTracked)
+            flipSymmetryKeys(pos, oldPiece);
 
         // A piece cell (e.g., BLACK) has the *opposite* bit set (WHITE, 10b).
         // We flip with the piece color (BLACK, 01b) to clear it.
@@ -490,6 +572,7 @@ void Board::setBlock(Pos pos)
             deltaValueBlack -= c.valueBlack;
             st.p4Count[BLACK][c.pattern4[BLACK]]--;
             st.p4Count[WHITE][c.pattern4[WHITE]]--;
+            resetP4Bits(posi, c);
 
             // Recalculate line pattern
             c.pattern2x[dir] = PatternConfig::lookupPattern<R>(bitKey[dir]);
@@ -505,6 +588,7 @@ void Board::setBlock(Pos pos)
             // Add new pattern contribution
             st.p4Count[BLACK][c.pattern4[BLACK]]++;
             st.p4Count[WHITE][c.pattern4[WHITE]]++;
+            setP4Bits(posi, c);
 
             // Update last pattern4 move locations
             if (c.pattern4[BLACK] >= C_BLOCK4_FLEX3)
@@ -522,6 +606,7 @@ void Board::setBlock(Pos pos)
 
     // Apply the accumulated value changes
     st.valueBlack += deltaValueBlack;
+    st.updateThreatMask();
 
     assert(checkP4(this));
 
@@ -536,6 +621,20 @@ template void Board::setBlock<FREESTYLE>(Pos pos);
 template void Board::setBlock<STANDARD>(Pos pos);
 template void Board::setBlock<RENJU>(Pos pos);
 
+void Board::setSymmetryKeysTracked(bool enable)
+{
+    if (enable && !symmetryKeysTracked) {
+        std::fill_n(symmetryKeys, TRANS_NB, Hash::zobrist[BLACK][FULL_BOARD_CELL_COUNT - 1]);
+        FOR_EVERY_POSITION(this, pos)
+        {
+            Color c = get(pos);
+            if (c == BLACK || c == WHITE)
+                flipSymmetryKeys(pos, c);
+        }
+    }
+    symmetryKeysTracked = enable;
+}
+
 bool Board::checkForbiddenPoint(Pos pos) const
 {
     const Cell &fpCell = cell(pos);
@@ -57,6 +57,39 @@ class Evaluator;
     FOR_EVERY_CANDAREA_POS(board, pos, (board)->stateInfo().candArea) \
     if ((board)->isEmpty(pos) && (board)->cell(pos).isCandidate())
 
+#define FOR_EVERY_BITBOARD_POS(bitboard, pos)                               \
+    for (int _i = 0; _i < Bitboard::NumWords; _i++)                         \
+        for (uint64_t _bits = (bitboard).bits[_i]; _bits; _bits &= _bits - 1) \
+            if (Pos pos {int16_t(_i * 64 + lsb(_bits))}; true)
+
+/// Bitboard struct represents a set of cells on the full board, with one bit
+/// for each cell. Positions are iterated in the ascending order of Pos.
+struct Bitboard
+{
+    static constexpr int NumWords = FULL_BOARD_CELL_COUNT / 64;
+    uint64_t             bits[NumWords];
+
+    void set(Pos pos) { bits[pos >> 6] |= 1ULL << (pos & 63); }
+    void reset(Pos pos) { bits[pos >> 6] &= ~(1ULL << (pos & 63)); }
+    bool test(Pos pos) const { return (bits[pos >> 6] >> (pos & 63)) & 0x1; }
+
+    /// Count the number of cells in this bitboard.
+    int count() const
+    {
+        int cnt = 0;
+        for (uint64_t b : bits)
+            cnt += popcount(b);
+        return cnt;
+    }
+
+    Bitboard &operator|=(const Bitboard &other)
+    {
+        for (int i = 0; i < NumWords; i++)
+            bits[i] |= other.bits[i];
+        return *this;
+    }
+};
+
 /// CandArea struct represents a rectangle area on board which can be considered
 /// as move candidate.
 struct CandArea
@@ -86,6 +119,7 @@ struct StateInfo
     Pos      lastFlex4AttackMove[SIDE_NB];
     Pos      lastPattern4Move[SIDE_NB][3];
     uint16_t p4Count[SIDE_NB][PATTERN4_NB];
+    uint16_t threatMask[SIDE_NB];
     Value    valueBlack;
 
     /// Query the last emerged pattern4 pos.
@@ -95,6 +129,13 @@ struct StateInfo
         assert(p4 >= C_BLOCK4_FLEX3 && p4 <= A_FIVE);
         return lastPattern4Move[side][p4 - C_BLOCK4_FLEX3];
     }
+
+    /// Recompute the threat mask of both sides from the current pattern4 counts.
+    /// Threat mask is an index of [0, THREAT_NB) made of the existence of pattern4
+    /// types that cause non-linear eval changes, used in classical evaluation.
+    /// @note Like valueBlack, threat mask is only updated by moves that evaluate
+    ///     (NORMAL and NO_EVALUATOR), and is stale after NO_EVAL moves.
+    void updateThreatMask();
 };
 
 /// Cell struct contains all information for a move cell on board, including current
@@ -290,9 +331,37 @@ public:
                ^ (pos != Pos::PASS ? Hash::zobrist[currentSide][pos] : HashKey {});
     }
 
+    /// Set whether to update the zobrist keys of stones under all symmetry transforms in
+    /// move and undo. They are only needed by database lookups, so they are not tracked by
+    /// default, and are recomputed from the stones on board when tracking is enabled.
+    void setSymmetryKeysTracked(bool enable);
+
+    /// Whether zobrist keys of stones under all symmetry transforms are being tracked.
+    bool isSymmetryKeysTracked() const { return symmetryKeysTracked; }
+
+    /// Fetch the smallest zobrist key of stones among all symmetry transforms, which is
+    /// identical for all positions that are equivalent under symmetry.
+    /// @note Only valid when symmetry keys are tracked.
+    HashKey canonicalZobristKey() const
+    {
+        assert(symmetryKeysTracked);
+        HashKey key = symmetryKeys[IDENTITY];
+        for (HashKey symKey : symmetryKeys)
+            if (symKey < key)
+                key = symKey;
+        return key ^ Hash::zobristSide[currentSide];
+    }
+
+    /// Compute a hash of all stones on board from the bit keys. It is independent of the
+    /// zobrist key, so it can be used as a second signature to verify a zobrist key match.
+    uint64_t stoneHash() const { return XXH64(bitKey0, sizeof(bitKey0), 0); }
+
     /// Get the current pattern4 accumulate counter for one side.
     uint16_t p4Count(Color side, Pattern4 p4) const { return stateInfo().p4Count[side][p4]; }
 
+    /// Get the bitboard of all empty cells that has the pattern4 for one side.
+    const Bitboard &p4Bitboard(Color side, Pattern4 p4) const { return p4Bits[side][p4]; }
+
     // ------------------------------------------------------------------------
     // history board state queries
 
@@ -364,6 +433,12 @@ private:
     uint64_t bitKey2[FULL_BOARD_SIZE * 2 - 1];  // [UP_RIGHT(MSB) - DOWN_LEFT(LSB)]
     uint64_t bitKey3[FULL_BOARD_SIZE * 2 - 1];  // [DOWN_RIGHT(MSB) - UP_LEFT(LSB)]
 
+    // Bitboards of empty cells of each pattern4 for both sides.
+    Bitboard p4Bits[SIDE_NB][PATTERN4_NB];
+
+    // Zobrist keys of stones under all symmetry transforms, only updated when tracked.
+    HashKey symmetryKeys[TRANS_NB];
+
     int                    boardSize;           /// Size of the board
     int                    boardCellCount;      /// Number of cells of the board
     int                    moveCount;           /// Number of moves played (=numStones+numPasses)
@@ -375,11 +450,15 @@ private:
     const Direction       *candidateRange;      /// Candidate array pointer
     uint32_t               candidateRangeSize;  /// Size of candidate array
     uint32_t               candAreaExpandDist;  /// Expand distance of candidate area
+    bool                   symmetryKeysTracked; /// Whether symmetry keys are updated
     Evaluation::Evaluator *evaluator_;          /// External evaluator pointer
     Search::SearchThread  *thisThread_;         /// External search thread pointer
 
     void setBitKey(Pos pos, Color c);
     void flipBitKey(Pos pos, Color c);
+    void flipSymmetryKeys(Pos pos, Color c);
+    void setP4Bits(Pos pos, const Cell &c);
+    void resetP4Bits(Pos pos, const Cell &c);
 };
 
 /// Set bitkey of 4 directions at pos to color.
@@ -396,6 +475,15 @@ inline void Board::setBitKey(Pos pos, Color c)
     bitKey3[FULL_BOARD_SIZE - 1 - x + y] |= mask << (2 * x);
 }
 
+/// Toggle a stone at pos in the zobrist keys of all symmetry transforms.
+inline void Board::flipSymmetryKeys(Pos pos, Color c)
+{
+    for (int trans = IDENTITY; trans < TRANS_NB; trans++) {
+        Pos transformedPos = applyTransform(pos, boardSize, TransformType(trans));
+        symmetryKeys[trans] ^= Hash::zobrist[c][transformedPos];
+    }
+}
+
 /// Flip the color of bitkey of 4 directions at pos.
 inline void Board::flipBitKey(Pos pos, Color c)
 {
@@ -416,6 +504,20 @@ inline void Board::flipBitKey(Pos pos, Color c)
     bitKey3[FULL_BOARD_SIZE - 1 - x + y] ^= mask << (2 * x);
 }
 
+/// Add pos to the pattern4 bitboards of its current pattern4 of both sides.
+inline void Board::setP4Bits(Pos pos, const Cell &c)
+{
+    p4Bits[BLACK][c.pattern4[BLACK]].set(pos);
+    p4Bits[WHITE][c.pattern4[WHITE]].set(pos);
+}
+
+/// Remove pos from the pattern4 bitboards of its current pattern4 of both sides.
+inline void Board::resetP4Bits(Pos pos, const Cell &c)
+{
+    p4Bits[BLACK][c.pattern4[BLACK]].reset(pos);
+    p4Bits[WHITE][c.pattern4[WHITE]].reset(pos);
+}
+
 template <Rule R>
 inline uint64_t Board::getKeyAt(Pos pos, int dir) const
 {
@@ -109,9 +109,9 @@ constexpr bool preCheckFilter(const Board &board, Color side)
 /// @note Board state must satisfy `board.p4Count(side, p4) > 0`.
 Pos findFirstPattern4Pos(const Board &board, Color side, Pattern4 p4)
 {
-    FOR_EVERY_CAND_POS(&board, pos)
+    FOR_EVERY_BITBOARD_POS(board.p4Bitboard(side, p4), pos)
     {
-        if (board.cell(pos).pattern4[side] == p4)
+        if (board.cell(pos).isCandidate())
             return pos;
     }
 
@@ -123,9 +123,15 @@ Pos findFirstPattern4Pos(const Board &board, Color side, Pattern4 p4)
 /// @param side Color of side with a FOUR pattern4.
 ScoredMove *findAllPseudoFourDefendPos(const Board &board, Color side, ScoredMove *moveList)
 {
-    FOR_EVERY_CAND_POS(&board, pos)
+    Bitboard fourOrForbid = board.p4Bitboard(side, FORBID);
+    for (Pattern4 p4 = E_BLOCK4; p4 < PATTERN4_NB; p4 = Pattern4(p4 + 1))
+        fourOrForbid |= board.p4Bitboard(side, p4);
+
+    FOR_EVERY_BITBOARD_POS(fourOrForbid, pos)
     {
         const Cell &c = board.cell(pos);
+        if (!c.isCandidate())
+            continue;
 
         if (c.pattern4[side] >= E_BLOCK4)
             *moveList++ = pos;
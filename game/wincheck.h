@@ -74,9 +74,9 @@ inline Value quickWinCheck(const Board &board, int ply, Value beta = VALUE_INFIN
 
             // Fast static check for opponent defence at C_BLOCK4_FLEX3 move
             Board &b = const_cast<Board &>(board);  // Get a mutable reference of board
-            FOR_EVERY_CAND_POS(&b, pos)
+            FOR_EVERY_BITBOARD_POS(board.p4Bitboard(self, C_BLOCK4_FLEX3), pos)
             {
-                if (b.cell(pos).pattern4[self] != C_BLOCK4_FLEX3)
+                if (!b.cell(pos).isCandidate())
                     continue;
 
                 b.move<Rule, Board::MoveType::NO_EVAL>(pos);
@@ -45,13 +45,18 @@ int main(int argc, char *argv[])
         SELFPLAY,
         DATAPREP,
         DATABASE,
+        PERFT,
+        EVALBENCH,
+        EVALFUZZ,
+        CACHEBENCH,
     } runMode = GOMOCUP_PROTOCOL;
 
     {
         cxxopts::Options options("rapfi");
         options.add_options()  //
             ("mode",
-             "One of [gomocup, bench, opengen, tuning, selfplay, dataprep, database] run modes",
+             "One of [gomocup, bench, opengen, tuning, selfplay, dataprep, database, perft, "
+             "evalbench, evalfuzz, cachebench] run modes",
              cxxopts::value<std::string>()->default_value("gomocup"))  //
             ("config",
              "Path to the specified config file",
@@ -83,6 +88,14 @@ int main(int argc, char *argv[])
                 runMode = DATAPREP;
             else if (mode == "DATABASE")
                 runMode = DATABASE;
+            else if (mode == "PERFT")
+                runMode = PERFT;
+            else if (mode == "EVALBENCH")
+                runMode = EVALBENCH;
+            else if (mode == "EVALFUZZ")
+                runMode = EVALFUZZ;
+            else if (mode == "CACHEBENCH")
+                runMode = CACHEBENCH;
             else
                 throw std::invalid_argument("unknown mode " + mode);
 
@@ -123,6 +136,10 @@ int main(int argc, char *argv[])
     case SELFPLAY: Command::selfplay(argc, argv); break;
     case DATAPREP: Command::dataprep(argc, argv); break;
     case DATABASE: Command::database(argc, argv); break;
+    case PERFT: Command::perft(argc, argv); break;
+    case EVALBENCH: Command::evalbench(argc, argv); break;
+    case EVALFUZZ: Command::evalfuzz(argc, argv); break;
+    case CACHEBENCH: Command::cachebench(argc, argv); break;
     default: Command::gomocupLoop(); break;
     }
 #else
@@ -701,7 +701,7 @@ Value search(Board &board, SearchStack *ss, Value alpha, Value beta, Depth depth
     // Step 4. Transposition table lookup.
     // Use a different hash key in case of an skip move to avoid overriding full search result.
     Pos     skipMove = ss->skipMove;
-    HashKey posKey   = board.zobristKey() ^ (skipMove ? Hash::LCHash(skipMove) : 0);
+    HashKey posKey   = board.zobristKey() ^ HashKey(skipMove ? Hash::LCHash(skipMove) : 0);
     Value   ttValue  = VALUE_NONE;
     Value   ttEval   = VALUE_NONE;
     bool    ttIsPv   = false;
@@ -18,6 +18,7 @@
 
 #include "hashtable.h"
 
+#include "../core/hash.h"
 #include "../core/iohelper.h"
 #include "../core/platform.h"
 #include "../core/utils.h"
@@ -40,7 +41,7 @@ static constexpr int ENTRIES_PER_BUCKET = 5;
 /// TTEntry struct is a single entry in the transposition table.
 /// To achieve the maximum space efficiency, each TTEntry struct
 /// is compactly stored, using 12 bytes:
-///     key32        32 bit     (lower 32bit of zobrist key xor data)
+///     key32        32 bit     (lower 32bit of key check bits xor data)
 ///     value        16 bit     (value of search)
 ///     eval         16 bit     (value of static evaluation)
 ///     pvNode        1 bit     (is this node pv)
@@ -167,7 +168,7 @@ void HashTable::clear()
 
 TTEntry *HashTable::firstEntry(HashKey key) const
 {
-    return table[mulhi64(key, numBuckets)].entry;
+    return table[mulhi64(Hash::indexBits(key), numBuckets)].entry;
 }
 
 void HashTable::prefetch(HashKey key) const
@@ -185,7 +186,7 @@ bool HashTable::probe(HashKey hashKey,
                       int     ply)
 {
     TTEntry *entry = firstEntry(hashKey);
-    uint32_t key32 = uint32_t(hashKey);
+    uint32_t key32 = uint32_t(Hash::checkBits(hashKey));
 
     // Iterate the bucket to find a matched entry
     for (int i = 0; i < ENTRIES_PER_BUCKET; i++) {
@@ -220,7 +221,7 @@ void HashTable::store(HashKey hashKey,
                       int     ply)
 {
     TTEntry *entry        = firstEntry(hashKey);
-    uint32_t newKey32     = uint32_t(hashKey);
+    uint32_t newKey32     = uint32_t(Hash::checkBits(hashKey));
     TTEntry *replace      = &entry[0];
     auto     replaceValue = [=](const TTEntry &e) {
         uint8_t relativeAge = generation - e.generation8;
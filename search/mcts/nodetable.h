@@ -16,6 +16,7 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "../../core/hash.h"
 #include "../../core/types.h"
 #include "node.h"
 
@@ -69,7 +70,7 @@ public:
     /// @note This function is thread-safe.
     Shard getShardByHash(HashKey hash) const
     {
-        size_t index = hash & mask;
+        size_t index = Hash::indexBits(hash) & mask;
         return getShardByShardIndex(index);
     }
 
@@ -103,6 +104,17 @@ public:
 
         // Try to emplace the node after acquiring the writer lock
         auto [it, inserted] = shard.table.emplace(hash, std::forward<Args>(args)...);
+#ifdef WIDE_HASH_KEY
+        // Nodes sharing the same lower 64 bits are adjacent in the ordered table
+        if (inserted) {
+            auto next     = std::next(it);
+            bool collided = next != shard.table.end()
+                            && Hash::isNarrowCollision(next->getHash(), hash);
+            collided |= it != shard.table.begin()
+                        && Hash::isNarrowCollision(std::prev(it)->getHash(), hash);
+            Hash::nodeTableCollisions.record(collided);
+        }
+#endif
         // We also return whether the node is actually created by us
         return {std::addressof(const_cast<Node &>(*it)), inserted};
     }
@@ -1145,6 +1145,9 @@ void MCTSSearcher::recycleOldNodes(MainSearchThread &th)
     MESSAGEL("Reachable nodes: " << numReachableNodes.load()
                                  << ", Recycled nodes: " << numRecycledNodes.load()
                                  << ", Root visit: " << root->getVisits());
+#ifdef WIDE_HASH_KEY
+    MESSAGEL("Node table 64-bit key collision rate: " << Hash::nodeTableCollisions.rate());
+#endif
 }
 
 void MCTSSearcher::updateRootMovesData(MainSearchThread &th)
@@ -25,6 +25,12 @@
 #include "searchthread.h"
 
 #include <algorithm>
+#include <cstddef>
+#include <memory>
+
+#ifdef USE_AVX2
+    #include <immintrin.h>
+#endif
 
 namespace {
 
@@ -74,6 +80,101 @@ void fastPartialSort(ScoredMove *begin, ScoredMove *end, Score limit, Comparator
     }
 }
 
+/// Accumulate history scores of all moves in the list. For AVX2, history entries
+/// of 8 moves are gathered at once, and the rest moves are done in scalar.
+/// @param mainHist Main history of the side to move, indexed by [pos][type], or nullptr.
+/// @param contHist Continuation history of the previous move, indexed by [pos], or nullptr.
+/// @param contHist1Ply Continuation history of the previous opponent move, or nullptr.
+void addHistoryScores(ScoredMove    *begin,
+                      ScoredMove    *end,
+                      const Board   &board,
+                      const int16_t *mainHist,
+                      const int16_t *contHist,
+                      const int16_t *contHist1Ply)
+{
+    using namespace Search;
+    static_assert(MAIN_HIST_TYPE_NB == 2 && HIST_ATTACK == 0 && HIST_QUIET == 1);
+
+    Color self = board.sideToMove();
+
+#ifdef USE_AVX2
+    static_assert(sizeof(ScoredMove) == 8 && offsetof(ScoredMove, pos) == 0);
+    static_assert(offsetof(Cell, pattern4) == 2 && sizeof(Cell) % 4 == 0);
+
+    // In-board moves are always followed by boundary cells, so reading 4 bytes at
+    // a history entry never goes outside the table.
+    const int    *cellBase      = reinterpret_cast<const int *>(&board.cell(Pos::FULL_BOARD_START));
+    const __m256i moveIndex     = _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14);
+    const __m256i lowMask       = _mm256_set1_epi32(0xffff);
+    const __m256i belowFlex3    = _mm256_set1_epi32(H_FLEX3 - 1);
+    const __m256  divisor       = _mm256_set1_ps(383.0f);
+    const __m256  divisor1Ply   = _mm256_set1_ps(389.0f);
+    const int     pattern4Shift = 16 + 8 * self;
+
+    for (; end - begin >= 8; begin += 8) {
+        __m256i pos = _mm256_i32gather_epi32(reinterpret_cast<const int *>(begin), moveIndex, 4);
+        pos         = _mm256_and_si256(pos, lowMask);
+        __m256i sum = _mm256_setzero_si256();
+
+        if (mainHist) {
+            // Gather [HIST_ATTACK, HIST_QUIET] pair and select by the pattern4 of cell
+            __m256i cellOffset = _mm256_mullo_epi32(pos, _mm256_set1_epi32(sizeof(Cell)));
+            __m256i cellHead   = _mm256_i32gather_epi32(cellBase, cellOffset, 1);
+            __m256i p4         = _mm256_and_si256(_mm256_srli_epi32(cellHead, pattern4Shift),
+                                          _mm256_set1_epi32(0xff));
+            __m256i isAttack   = _mm256_cmpgt_epi32(p4, belowFlex3);
+            __m256i pair   = _mm256_i32gather_epi32(reinterpret_cast<const int *>(mainHist), pos, 4);
+            __m256i attack = _mm256_srai_epi32(_mm256_slli_epi32(pair, 16), 16);
+            __m256i quiet  = _mm256_srai_epi32(pair, 16);
+            // Integer division rounding towards zero, same as scalar x / 128 and x / 256
+            attack = _mm256_srai_epi32(
+                _mm256_add_epi32(attack, _mm256_srli_epi32(_mm256_srai_epi32(attack, 31), 25)),
+                7);
+            quiet = _mm256_srai_epi32(
+                _mm256_add_epi32(quiet, _mm256_srli_epi32(_mm256_srai_epi32(quiet, 31), 24)),
+                8);
+            sum = _mm256_add_epi32(sum, _mm256_blendv_epi8(quiet, attack, isAttack));
+        }
+
+        // Float division is exact for truncation here, as |x| < 2^15 and x / d is
+        // correctly rounded, which never crosses an integer boundary.
+        if (contHist) {
+            __m256i h = _mm256_i32gather_epi32(reinterpret_cast<const int *>(contHist), pos, 2);
+            h         = _mm256_srai_epi32(_mm256_slli_epi32(h, 16), 16);
+            h         = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(h), divisor));
+            sum       = _mm256_add_epi32(sum, h);
+        }
+
+        if (contHist1Ply) {
+            __m256i h = _mm256_i32gather_epi32(reinterpret_cast<const int *>(contHist1Ply), pos, 2);
+            h         = _mm256_srai_epi32(_mm256_slli_epi32(h, 16), 16);
+            h         = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(h), divisor1Ply));
+            sum       = _mm256_add_epi32(sum, h);
+        }
+
+        alignas(32) int32_t delta[8];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(delta), sum);
+        for (int i = 0; i < 8; i++)
+            begin[i].score += delta[i];
+    }
+#endif
+
+    for (ScoredMove *m = begin; m < end; ++m) {
+        if (mainHist) {
+            if (board.cell(m->pos).pattern4[self] >= H_FLEX3)
+                m->score += mainHist[m->pos * MAIN_HIST_TYPE_NB + HIST_ATTACK] / 128;
+            else
+                m->score += mainHist[m->pos * MAIN_HIST_TYPE_NB + HIST_QUIET] / 256;
+        }
+
+        if (contHist)
+            m->score += contHist[m->pos] / 383;
+
+        if (contHist1Ply)
+            m->score += contHist1Ply[m->pos] / 389;
+    }
+}
+
 /// Make the first current move to have policy = 1.0f and the rest to have policy = 0.0f.
 void markFirstMoveOneHot(ScoredMove *curMove, ScoredMove *endMove)
 {
@@ -294,7 +395,6 @@ void MovePicker::scoreAllMoves()
         maxPolicyScore = std::numeric_limits<Score>::lowest() / 2;
     }
 
-    maxScore = std::numeric_limits<Score>::lowest() / 2;
     for (auto &m : *this) {
         const Cell &c = board.cell(m);
 
@@ -311,13 +411,6 @@ void MovePicker::scoreAllMoves()
         else
             assert(false && "incorrect score type");
 
-        if (bool(Type & MAIN_HISTORY) && mainHistory) {
-            if (c.pattern4[self] >= H_FLEX3)
-                m.score += (*mainHistory)[self][m.pos][HIST_ATTACK] / 128;
-            else
-                m.score += (*mainHistory)[self][m.pos][HIST_QUIET] / 256;
-        }
-
         if (bool(Type & COUNTER_MOVE) && counterMoveHistory) {
             if (Pos lastMove = board.getLastMove(); board.isInBoard(lastMove)) {
                 const int CounterMoveBonus = 21;
@@ -328,19 +421,29 @@ void MovePicker::scoreAllMoves()
                     m.score += CounterMoveBonus;
             }
         }
+    }
 
-        if (bool(Type & CONTINUATION_HISTORY) && continuationHistory && board.isInBoard(prevMove)) {
-            m.score += (*continuationHistory)[self][prevMove][m.pos] / 383;
-        }
-
-        if (bool(Type & CONTINUATION_HISTORY_1PLY) && continuationHistory1Ply && board.isInBoard(prevMoveOpp)) {
-            m.score += (*continuationHistory1Ply)[self][prevMoveOpp][m.pos] / 389;
-        }
-
-
+    // Add history scores to all moves in one pass
+    auto histTable = [](const auto &entries) {
+        return reinterpret_cast<const int16_t *>(std::addressof(entries[0]));
+    };
+    const int16_t *mainHist =
+        bool(Type & MAIN_HISTORY) && mainHistory ? histTable((*mainHistory)[self][0]) : nullptr;
+    const int16_t *contHist =
+        bool(Type & CONTINUATION_HISTORY) && continuationHistory && board.isInBoard(prevMove)
+            ? histTable((*continuationHistory)[self][prevMove])
+            : nullptr;
+    const int16_t *contHist1Ply = bool(Type & CONTINUATION_HISTORY_1PLY)
+                                          && continuationHistory1Ply
+                                          && board.isInBoard(prevMoveOpp)
+                                      ? histTable((*continuationHistory1Ply)[self][prevMoveOpp])
+                                      : nullptr;
+    if (mainHist || contHist || contHist1Ply)
+        addHistoryScores(begin(), end(), board, mainHist, contHist, contHist1Ply);
 
+    maxScore = std::numeric_limits<Score>::lowest() / 2;
+    for (auto &m : *this)
         maxScore = std::max(maxScore, m.score);
-    }
 
     // Compute normalized policy score if needed
     if (useNormalizedPolicy) {
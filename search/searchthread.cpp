@@ -187,6 +187,9 @@ void SearchThread::setBoardAndEvaluator(const Board &board)
 
     // Clone the board (this will also sync the evaluator to the board state)
     this->board = std::make_unique<Board>(board, this);
+
+    // Database lookups read the canonical key kept by the board, so only track it with a db
+    this->board->setSymmetryKeysTracked(dbClient != nullptr);
 }
 
 void MainSearchThread::checkExit(uint32_t elapsedCalls)
@@ -317,6 +320,15 @@ void ThreadPool::setupEvaluator(std::function<EvaluatorMaker> maker)
     evaluatorMaker = maker;
 }
 
+std::unique_ptr<Evaluation::Evaluator>
+ThreadPool::createEvaluator(int boardSize, Rule rule, Numa::NumaNodeId numaId)
+{
+    if (!evaluatorMaker)
+        return nullptr;
+
+    return evaluatorMaker(boardSize, rule, numaId);
+}
+
 void ThreadPool::startThinking(const Board          &board,
                                const SearchOptions  &options,
                                bool                  inPonder,
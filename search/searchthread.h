@@ -210,6 +210,10 @@ public:
     void setupDatabase(std::unique_ptr<Database::DBStorage> dbStorage);
     /// Setup evaluator maker for future evaluator creation.
     void setupEvaluator(std::function<EvaluatorMaker> evaluatorMaker);
+    /// Create a new evaluator instance with the current evaluator maker.
+    /// @return The created evaluator, or nullptr if no evaluator maker is set.
+    std::unique_ptr<Evaluation::Evaluator>
+    createEvaluator(int boardSize, Rule rule, Numa::NumaNodeId numaId = Numa::DefaultNumaNodeId);
     /// Start multi-threaded thinking for the given position.
     /// @param board The position to start searching.
     /// @param options Options of this search.